@@ -152,6 +152,8 @@ struct utils_file;
 compat_fd compat_file_open( const char *path, int write );
 off_t compat_file_get_length( compat_fd fd );
 int compat_file_read( compat_fd fd, struct utils_file *file );
+int compat_file_map( compat_fd fd, struct utils_file *file );
+void compat_file_unmap( struct utils_file *file );
 int compat_file_write( compat_fd fd, const unsigned char *buffer,
                        size_t length );
 int compat_file_close( compat_fd fd );
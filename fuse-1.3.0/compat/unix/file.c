@@ -32,6 +32,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif			/* #ifdef HAVE_SYS_MMAN_H */
+
 #include "compat.h"
 #include "utils.h"
 #include "ui/ui.h"
@@ -71,6 +75,46 @@ compat_file_read( compat_fd fd, utils_file *file )
   return 0;
 }
 
+int
+compat_file_map( compat_fd fd, utils_file *file )
+{
+#ifdef HAVE_SYS_MMAN_H
+  void *buffer;
+
+  if( file->length ) {
+    buffer = mmap( NULL, file->length, PROT_READ, MAP_PRIVATE, fileno( fd ),
+                   0 );
+    if( buffer != MAP_FAILED ) {
+      file->buffer = buffer;
+      file->mapped = 1;
+      return 0;
+    }
+  }
+#endif			/* #ifdef HAVE_SYS_MMAN_H */
+
+  file->mapped = 0;
+  file->buffer = libspectrum_new( unsigned char, file->length );
+  if( compat_file_read( fd, file ) ) {
+    libspectrum_free( file->buffer );
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+compat_file_unmap( utils_file *file )
+{
+#ifdef HAVE_SYS_MMAN_H
+  if( file->mapped ) {
+    munmap( file->buffer, file->length );
+    return;
+  }
+#endif			/* #ifdef HAVE_SYS_MMAN_H */
+
+  libspectrum_free( file->buffer );
+}
+
 int
 compat_file_write( compat_fd fd, const unsigned char *buffer, size_t length )
 {
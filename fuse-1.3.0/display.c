@@ -38,9 +38,11 @@
 #include "movie.h"
 #include "peripherals/scld.h"
 #include "rectangle.h"
+#include "runahead.h"
 #include "screenshot.h"
 #include "settings.h"
 #include "spectrum.h"
+#include "statesave.h"
 #include "ui/ui.h"
 #include "ui/uidisplay.h"
 
@@ -156,9 +158,8 @@ int
 display_init( int *argc, char ***argv )
 {
   int i, j, k, x, y;
-  int error;
 
-  if(ui_init(argc, argv))
+  if( !settings_current.headless && ui_init( argc, argv ) )
     return 1;
 
   /* Set up the 'all pixels must be refreshed' marker */
@@ -192,18 +193,32 @@ display_init( int *argc, char ***argv )
 
   display_refresh_all();
 
-  border_changes_last = 0;
   if( border_changes ) {
     libspectrum_free( border_changes );
   }
   border_changes = NULL;
-  error = add_border_sentinel(); if( error ) return error;
-  display_last_border = scld_last_dec.name.hires ?
-                            display_hires_border : display_lores_border;
+  display_reset_border();
+
+  statesave_register( &display_lores_border, sizeof( display_lores_border ) );
+  statesave_register( &display_hires_border, sizeof( display_hires_border ) );
+  statesave_register( &display_frame_count, sizeof( display_frame_count ) );
+  statesave_register( &display_flash_reversed,
+                      sizeof( display_flash_reversed ) );
 
   return 0;
 }
 
+/* Forget this frame's border changes and start again from the current
+   border colour */
+void
+display_reset_border( void )
+{
+  border_changes_last = 0;
+  add_border_sentinel();
+  display_last_border = scld_last_dec.name.hires ?
+                            display_hires_border : display_lores_border;
+}
+
 static int
 display_init_wrapper( void *context )
 {
@@ -887,7 +902,7 @@ update_border( void )
 
 /* Send the updated screen to the UI-specific code */
 static void
-update_ui_screen( void )
+show_ui_screen( void )
 {
   static int frame_count = 0;
   int scale = machine_current->timex ? 2 : 1;
@@ -905,9 +920,10 @@ update_ui_screen( void )
         movie_add_area( 0, 0, DISPLAY_ASPECT_WIDTH >> 3,
                         DISPLAY_SCREEN_HEIGHT );
       }
-      uidisplay_area( 0, 0,
-                      scale * DISPLAY_ASPECT_WIDTH,
-                      scale * DISPLAY_SCREEN_HEIGHT );
+      if( !settings_current.headless )
+        uidisplay_area( 0, 0,
+                        scale * DISPLAY_ASPECT_WIDTH,
+                        scale * DISPLAY_SCREEN_HEIGHT );
       display_redraw_all = 0;
     } else {
       for( i = 0, ptr = rectangle_inactive;
@@ -916,17 +932,40 @@ update_ui_screen( void )
             if( movie_recording ) {
               movie_add_area( ptr->x, ptr->y, ptr->w, ptr->h );
             }
+            if( !settings_current.headless )
               uidisplay_area( 8 * scale * ptr->x, scale * ptr->y,
-                        8 * scale * ptr->w, scale * ptr->h );
+                              8 * scale * ptr->w, scale * ptr->h );
       }
     }
 
     rectangle_inactive_count = 0;
 
-    uidisplay_frame_end();
+    if( !settings_current.headless ) uidisplay_frame_end();
   }
 }
 
+static void
+update_ui_screen( void )
+{
+  /* Frames emulated only to bring the state up to date are never shown;
+     whoever emulated them redraws the whole screen afterwards. Run-ahead
+     shows a later frame in place of this one */
+  if( fuse_emulation_hidden || runahead_active ) {
+    rectangle_inactive_count = 0;
+    return;
+  }
+
+  show_ui_screen();
+}
+
+/* Show the screen as it now stands in full, after frames which weren't */
+void
+display_show_frame( void )
+{
+  display_redraw_all = 1;
+  show_ui_screen();
+}
+
 int
 display_frame( void )
 {
@@ -117,6 +117,8 @@ int display_dirty_border(void);
 int display_frame(void);
 void display_refresh_main_screen(void);
 void display_refresh_all(void);
+void display_reset_border( void );
+void display_show_frame( void );
 
 #define display_get_addr( x, y ) \
   scld_last_dec.name.altdfile ? display_line_start[(y)]+(x)+ALTDFILE_OFFSET : \
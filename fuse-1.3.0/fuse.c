@@ -59,6 +59,7 @@
 #include "display.h"
 #include "event.h"
 #include "fuse.h"
+#include "headless.h"
 #include "infrastructure/startup_manager.h"
 #include "keyboard.h"
 #include "machine.h"
@@ -67,6 +68,7 @@
 #include "module.h"
 #include "movie.h"
 #include "mempool.h"
+#include "netplay.h"
 #include "peripherals/ay.h"
 #include "peripherals/dck.h"
 #include "peripherals/disk/beta.h"
@@ -91,14 +93,18 @@
 #include "pokefinder/pokemem.h"
 #include "profile.h"
 #include "psg.h"
+#include "runahead.h"
 #include "rzx.h"
+#include "rzxverify.h"
 #include "settings.h"
 #include "slt.h"
 #include "snapshot.h"
 #include "sound.h"
 #include "spectrum.h"
+#include "statehash.h"
 #include "tape.h"
 #include "timer/timer.h"
+#include "trace.h"
 #include "ui/scaler/scaler.h"
 #include "ui/ui.h"
 #include "ui/uimedia.h"
@@ -116,6 +122,10 @@ int fuse_exiting;
 /* Is Spectrum emulation currently paused, and if so, how many times? */
 int fuse_emulation_paused;
 
+/* Are we emulating frames only to bring the machine state up to date,
+   without showing or playing them? */
+int fuse_emulation_hidden = 0;
+
 /* The creator information we'll store in file formats that support this */
 libspectrum_creator *fuse_creator;
 
@@ -190,6 +200,10 @@ int main(int argc, char **argv)
 
   if( settings_current.unittests ) {
     r = unittests_run();
+  } else if( settings_current.rzx_verify ) {
+    r = rzxverify_run();
+  } else if( settings_current.headless ) {
+    r = headless_run();
   } else {
     while( !fuse_exiting ) {
       z80_do_opcodes();
@@ -310,11 +324,13 @@ run_startup_manager( int *argc, char ***argv )
   melodik_register_startup();
   memory_register_startup();
   mempool_register_startup();
+  netplay_register_startup();
   opus_register_startup();
   plusd_register_startup();
   printer_register_startup();
   profile_register_startup();
   psg_register_startup();
+  runahead_register_startup();
   rzx_register_startup();
   scld_register_startup();
   settings_register_startup();
@@ -326,8 +342,10 @@ run_startup_manager( int *argc, char ***argv )
   specdrum_register_startup();
   spectranet_register_startup();
   spectrum_register_startup();
+  statehash_register_startup();
   tape_register_startup();
   timer_register_startup();
+  trace_register_startup();
   ula_register_startup();
   usource_register_startup();
   z80_register_startup();
@@ -371,6 +389,12 @@ static int fuse_init(int argc, char **argv)
     return 0;
   }
 
+  /* RZX verification needs neither a display nor sound */
+  if( settings_current.rzx_verify ) {
+    settings_current.headless = 1;
+    settings_current.sound = 0;
+  }
+
   start_scaler = utils_safe_strdup( settings_current.start_scaler_mode );
 
   /* Windows will create a console for our output if there isn't one already,
@@ -402,6 +426,8 @@ static int fuse_init(int argc, char **argv)
   fuse_emulation_paused = 0;
   movie_init();
 
+  if( settings_current.netplay && netplay_start() ) return 1;
+
   return 0;
 }
 
@@ -932,7 +958,7 @@ static int fuse_end(void)
   periph_end();
   fuse_keyboard_end();
   fuse_joystick_end();
-  ui_end();
+  if( !settings_current.headless ) ui_end();
   ui_media_drive_end();
   module_end();
   pokemem_end();
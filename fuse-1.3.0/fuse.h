@@ -40,6 +40,9 @@ extern int fuse_emulation_paused;	/* Is Spectrum emulation paused? */
 int fuse_emulation_pause(void);		/* Stop and start emulation */
 int fuse_emulation_unpause(void);
 
+extern int fuse_emulation_hidden;	/* Are frames being neither shown
+					   nor played? */
+
 #ifdef UI_WIN32
 int fuse_main(int argc, char **argv);
 #endif
@@ -0,0 +1,86 @@
+/* headless.c: Running the emulator without a user interface
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "fuse.h"
+#include "headless.h"
+#include "machine.h"
+#include "settings.h"
+#include "timer/timer.h"
+#include "z80/z80.h"
+
+static libspectrum_dword frame_count = 0;
+
+/* Print how fast the emulation ran, for --headless-profile */
+static void
+headless_profile( double seconds )
+{
+  double rate, real_rate;
+
+  if( seconds <= 0 || !frame_count ) return;
+
+  rate = frame_count / seconds;
+  real_rate = (double)machine_current->timings.processor_speed /
+              machine_current->timings.tstates_per_frame;
+
+  fprintf( stderr,
+           "%s: headless: %lu frames in %.3f s, %.1f frames/s, "
+           "%.1f times real time\n", fuse_progname,
+           (unsigned long)frame_count, seconds, rate, rate / real_rate );
+}
+
+int
+headless_run( void )
+{
+  libspectrum_dword frames = settings_current.headless_frames > 0 ?
+                             settings_current.headless_frames : 0;
+  double start = timer_get_time();
+
+  while( !fuse_exiting && ( !frames || frame_count < frames ) ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+
+  if( settings_current.headless_profile )
+    headless_profile( timer_get_time() - start );
+
+  return 0;
+}
+
+libspectrum_dword
+headless_frame_count( void )
+{
+  return frame_count;
+}
+
+void
+headless_frame( void )
+{
+  frame_count++;
+}
@@ -0,0 +1,42 @@
+/* headless.h: Running the emulator without a user interface
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_HEADLESS_H
+#define FUSE_HEADLESS_H
+
+#include <libspectrum.h>
+
+/* The emulator keeps its state in globals, so there is one machine per
+   process; run several processes to emulate several machines at once */
+
+/* Run until `settings_current.headless_frames' have been emulated (or
+   forever if that is zero) or until Fuse is asked to exit */
+int headless_run( void );
+
+/* How many frames have been emulated since startup */
+libspectrum_dword headless_frame_count( void );
+
+/* Called by the emulation core at the end of each frame */
+void headless_frame( void );
+
+#endif			/* #ifndef FUSE_HEADLESS_H */
@@ -29,8 +29,13 @@
 #include <glib.h>
 #endif				/* #ifdef HAVE_LIB_GLIB */
 
+#include <stdio.h>
+
 #include <libspectrum.h>
 
+#include "compat.h"
+#include "fuse.h"
+#include "settings.h"
 #include "startup_manager.h"
 #include "ui/ui.h"
 
@@ -46,9 +51,25 @@ static GArray *registered_modules;
 
 static GArray *end_functions;
 
+/* When the startup manager began, for profiling; negative once the first
+   frame has been reported */
+static double startup_time;
+
+static const char * const module_names[] = {
+  "ay", "beta", "creator", "debugger", "didaktik", "disciple", "display",
+  "divide", "event", "fdd", "fuller", "if1", "if2", "kempmouse",
+  "libspectrum", "libxml2", "machine", "machines_periph", "melodik", "memory",
+  "mempool", "netplay", "opus", "plusd", "printer", "profile", "psg",
+  "runahead", "rzx", "scld", "settings_end", "setuid", "simpleide", "slt",
+  "sound", "speccyboot", "specdrum", "spectranet", "spectrum", "statehash",
+  "tape", "timer", "trace", "ula", "usource", "z80", "zxatasp", "zxcf",
+};
+
 void
 startup_manager_init( void )
 {
+  startup_time = compat_timer_get_time();
+
   registered_modules =
     g_array_new( FALSE, FALSE, sizeof( registered_module_t ) );
   end_functions =
@@ -112,6 +133,7 @@ startup_manager_run( void )
   int progress_made;
   guint i;
   int error;
+  double start = 0;
 
   /* Loop until we can't make any more progress; this will either be because
      we've called every function (good!) or because there's a logical error
@@ -127,10 +149,18 @@ startup_manager_run( void )
       if( registered_module->dependencies->len == 0 ) {
 
         if( registered_module->init_fn ) {
+          if( settings_current.startup_profile )
+            start = compat_timer_get_time();
+
           error = registered_module->init_fn(
             registered_module->init_context
           );
           if( error ) return error;
+
+          if( settings_current.startup_profile )
+            fprintf( stderr, "%s: startup: %-16s %8.2f ms\n", fuse_progname,
+                     module_names[ registered_module->module ],
+                     ( compat_timer_get_time() - start ) * 1000 );
         }
 
         if( registered_module->end_fn )
@@ -155,9 +185,23 @@ startup_manager_run( void )
     return 1;
   }
 
+  if( settings_current.startup_profile )
+    fprintf( stderr, "%s: startup: %-16s %8.2f ms\n", fuse_progname, "total",
+             ( compat_timer_get_time() - startup_time ) * 1000 );
+
   return 0;
 }
 
+void
+startup_manager_frame( void )
+{
+  if( !settings_current.startup_profile || startup_time < 0 ) return;
+
+  fprintf( stderr, "%s: startup: %-16s %8.2f ms\n", fuse_progname,
+           "first frame", ( compat_timer_get_time() - startup_time ) * 1000 );
+  startup_time = -1;
+}
+
 void
 startup_manager_run_end( void )
 {
@@ -50,11 +50,13 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_MELODIK,
   STARTUP_MANAGER_MODULE_MEMORY,
   STARTUP_MANAGER_MODULE_MEMPOOL,
+  STARTUP_MANAGER_MODULE_NETPLAY,
   STARTUP_MANAGER_MODULE_OPUS,
   STARTUP_MANAGER_MODULE_PLUSD,
   STARTUP_MANAGER_MODULE_PRINTER,
   STARTUP_MANAGER_MODULE_PROFILE,
   STARTUP_MANAGER_MODULE_PSG,
+  STARTUP_MANAGER_MODULE_RUNAHEAD,
   STARTUP_MANAGER_MODULE_RZX,
   STARTUP_MANAGER_MODULE_SCLD,
   STARTUP_MANAGER_MODULE_SETTINGS_END,
@@ -66,8 +68,10 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_SPECDRUM,
   STARTUP_MANAGER_MODULE_SPECTRANET,
   STARTUP_MANAGER_MODULE_SPECTRUM,
+  STARTUP_MANAGER_MODULE_STATEHASH,
   STARTUP_MANAGER_MODULE_TAPE,
   STARTUP_MANAGER_MODULE_TIMER,
+  STARTUP_MANAGER_MODULE_TRACE,
   STARTUP_MANAGER_MODULE_ULA,
   STARTUP_MANAGER_MODULE_USOURCE,
   STARTUP_MANAGER_MODULE_Z80,
@@ -76,6 +80,8 @@ typedef enum startup_manager_module {
  
 } startup_manager_module;
 
+/* Keep module_names in startup_manager.c in step with the above */
+
 /* Callback for each module's init function */
 typedef int (*startup_manager_init_fn)( void *context );
 
@@ -102,4 +108,8 @@ int startup_manager_run( void );
 /* Run all the end functions in inverse order of the init functions */
 void startup_manager_run_end( void );
 
+/* Called at the end of every frame; reports the time taken to get to
+   the first one when startup profiling is on */
+void startup_manager_frame( void );
+
 #endif				/* #ifndef FUSE_STARTUP_MANAGER_H */
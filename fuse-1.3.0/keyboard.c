@@ -29,6 +29,8 @@
 #include <glib.h>
 #endif				/* #ifdef HAVE_LIB_GLIB */
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "ui/ui.h"
@@ -39,6 +41,12 @@
 */
 libspectrum_byte keyboard_return_values[8];
 
+/* The keys held down on the host. Normally these are copied straight to
+   `keyboard_return_values'; while input is latched, whoever latched it
+   does that instead, once per frame */
+libspectrum_byte keyboard_host_values[8];
+static int keyboard_latched = 0;
+
 /* The hash used for storing the UI -> Fuse input layer key mappings */
 static GHashTable *keysyms_hash;
 
@@ -330,7 +338,11 @@ keyboard_press( keyboard_key_name key )
 
   ptr = g_hash_table_lookup( keyboard_data, &key );
 
-  if( ptr ) keyboard_return_values[ ptr->port ] &= ~( ptr->bit );
+  if( !ptr ) return;
+
+  keyboard_host_values[ ptr->port ] &= ~( ptr->bit );
+  if( !keyboard_latched )
+    keyboard_return_values[ ptr->port ] = keyboard_host_values[ ptr->port ];
 }
 
 void
@@ -340,18 +352,34 @@ keyboard_release( keyboard_key_name key )
 
   ptr = g_hash_table_lookup( keyboard_data, &key );
 
-  if( ptr ) keyboard_return_values[ ptr->port ] |= ptr->bit;
+  if( !ptr ) return;
+
+  keyboard_host_values[ ptr->port ] |= ptr->bit;
+  if( !keyboard_latched )
+    keyboard_return_values[ ptr->port ] = keyboard_host_values[ ptr->port ];
 }
 
 int keyboard_release_all( void )
 {
   int i;
 
-  for( i=0; i<8; i++ ) keyboard_return_values[i] = 0xff;
+  for( i=0; i<8; i++ ) keyboard_host_values[i] = 0xff;
+  if( !keyboard_latched )
+    memcpy( keyboard_return_values, keyboard_host_values,
+            sizeof( keyboard_return_values ) );
 
   return 0;
 }
 
+void
+keyboard_latch( int latch )
+{
+  keyboard_latched = latch;
+  if( !latch )
+    memcpy( keyboard_return_values, keyboard_host_values,
+            sizeof( keyboard_return_values ) );
+}
+
 const keyboard_spectrum_keys_t*
 keyboard_get_spectrum_keys( input_key keysym )
 {
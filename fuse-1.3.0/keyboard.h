@@ -32,6 +32,7 @@
 
 extern libspectrum_byte keyboard_default_value;
 extern libspectrum_byte keyboard_return_values[8];
+extern libspectrum_byte keyboard_host_values[8];
 
 /* A numeric identifier for each Spectrum key. Chosen to map to ASCII in
    most cases */
@@ -97,6 +98,10 @@ void keyboard_press(keyboard_key_name key);
 void keyboard_release(keyboard_key_name key);
 int keyboard_release_all( void );
 
+/* Stop (or restart) host key presses reaching the emulated machine
+   directly; see keyboard_host_values */
+void keyboard_latch( int latch );
+
 /* Which Spectrum keys should be emulated as pressed when each input
    layer key is pressed */
 
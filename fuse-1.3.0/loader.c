@@ -25,12 +25,22 @@
 
 #include <config.h>
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "event.h"
+#include "fuse.h"
 #include "loader.h"
 #include "memory.h"
 #include "settings.h"
 #include "spectrum.h"
+#include "statesave.h"
 #include "tape.h"
+#include "ui/ui.h"
+#include "unittests/unittests.h"
+#include "utils.h"
 #include "z80/z80.h"
 
 static int successive_reads = 0;
@@ -45,8 +55,445 @@ typedef enum acceleration_mode_t {
   ACCELERATION_MODE_DECREASING,
 } acceleration_mode_t;
 
-static acceleration_mode_t acceleration_mode;
-static size_t acceleration_pc;
+/* The loader signature database. Each signature describes the edge
+   detection loop of a loader as a sequence of pattern bytes:
+
+     xx       the byte xx (in hex)
+     xx/yy    either of the bytes xx or yy
+     ??       any byte
+     jr       the displacement of a relative jump to the start of the loop
+     jp       the two byte address of an absolute jump to the start of the
+              loop
+     {        marks the start of the loop (default: the first byte)
+     ^        marks where PC is after the IN which triggered the check
+
+   preceded by the name of the loader and the role of its edge counter,
+   "inc:r" or "dec:r", where r is the register being counted.
+
+   A signature file may also contain "flash" entries:
+
+     flash name entry pattern
+
+   which specify that the routine at 'entry' (in hex) loads a block using
+   the ROM's LD-BYTES register conventions, and so can be replaced by
+   copying the data straight from the tape when flash loading is enabled.
+   The pattern is matched starting at 'entry' to make sure the routine is
+   really there */
+
+#define LOADER_PATTERN_MAX_LENGTH 32
+#define LOADER_PATTERN_MAX_ALTERNATIVES 4
+
+#define SIGNATURE_SEPARATORS " \t\r\n"
+
+typedef enum loader_pattern_type_t {
+  LOADER_PATTERN_EXACT,
+  LOADER_PATTERN_ANY,
+  LOADER_PATTERN_JR,
+  LOADER_PATTERN_JP_LOW,
+  LOADER_PATTERN_JP_HIGH,
+} loader_pattern_type_t;
+
+typedef struct loader_pattern_byte_t {
+
+  loader_pattern_type_t type;
+
+  size_t count;
+  libspectrum_byte values[ LOADER_PATTERN_MAX_ALTERNATIVES ];
+
+} loader_pattern_byte_t;
+
+typedef struct loader_pattern_t {
+
+  size_t length;
+  size_t anchor;		/* Offset of PC at the time of the IN */
+  size_t loop;			/* Offset of the start of the loop */
+  loader_pattern_byte_t bytes[ LOADER_PATTERN_MAX_LENGTH ];
+
+} loader_pattern_t;
+
+typedef struct loader_signature_t {
+
+  char *name;
+  acceleration_mode_t mode;
+  libspectrum_byte *counter;
+  loader_pattern_t pattern;
+
+} loader_signature_t;
+
+typedef struct loader_flash_t {
+
+  char *name;
+  libspectrum_word entry;
+  loader_pattern_t pattern;
+
+} loader_flash_t;
+
+static const char * const builtin_signatures[] = {
+
+  /* The ROM loader and variants: Bleepload, Microsphere, Paul Owens */
+  "rom inc:b 04 c8 3e 00/7f db fe ^ 1f 00/a7/c8/d0 a9 e6 20 28 jr",
+
+  "speedlock inc:b 04 c8 3e 00/7f db fe ^ 1f a9 e6 20 28 jr",
+
+  "search inc:b 04 c8 3e 00/7f db fe ^ a9 e6 40 d8 00 28 jr",
+
+  "digital-integration dec:b { 05 c8 db fe ^ a9 e6 40 ca jp",
+
+};
+
+static GArray *loader_signatures;	/* loader_signature_t */
+static GArray *loader_flashes;		/* loader_flash_t */
+
+/* The file the current database was loaded from */
+static char *loader_signatures_file;
+static int loader_signatures_loaded = 0;
+
+/* Is there at least one flash loader the main loop should look for? */
+int loader_flash_active = 0;
+
+/* Results of signature detection are cached per PC, so a loader
+   alternating between several edge loops doesn't repeatedly search the
+   whole database */
+#define LOADER_CACHE_SIZE 16
+
+typedef struct loader_cache_entry_t {
+
+  int valid;
+  libspectrum_word pc;
+  const libspectrum_byte *page;	/* Memory mapped at PC when cached */
+  libspectrum_byte code[4];	/* The bytes just before PC */
+  const loader_signature_t *signature;	/* NULL if not a known loader */
+
+} loader_cache_entry_t;
+
+static loader_cache_entry_t loader_cache[ LOADER_CACHE_SIZE ];
+
+static void
+loader_cache_clear( void )
+{
+  memset( loader_cache, 0, sizeof( loader_cache ) );
+}
+
+static libspectrum_byte*
+counter_register( char name )
+{
+  switch( name ) {
+  case 'b': return &z80.bc.b.h;
+  case 'c': return &z80.bc.b.l;
+  case 'd': return &z80.de.b.h;
+  case 'e': return &z80.de.b.l;
+  case 'h': return &z80.hl.b.h;
+  case 'l': return &z80.hl.b.l;
+  default: return NULL;
+  }
+}
+
+static int
+parse_pattern_byte( const char *token, loader_pattern_byte_t *byte )
+{
+  char *end;
+  unsigned long value;
+
+  if( !strcmp( token, "??" ) ) {
+    byte->type = LOADER_PATTERN_ANY;
+    return 0;
+  }
+
+  byte->type = LOADER_PATTERN_EXACT;
+  byte->count = 0;
+
+  while( 1 ) {
+    if( byte->count == LOADER_PATTERN_MAX_ALTERNATIVES ) return 1;
+
+    value = strtoul( token, &end, 16 );
+    if( end == token || value > 0xff ) return 1;
+
+    byte->values[ byte->count++ ] = value;
+
+    if( *end == '\0' ) return 0;
+    if( *end != '/' ) return 1;
+
+    token = end + 1;
+  }
+}
+
+/* Parse the remaining whitespace separated tokens from the current
+   strtok() call into 'pattern'; returns 0 on success */
+static int
+parse_pattern( loader_pattern_t *pattern )
+{
+  const char *token;
+  int anchored = 0;
+
+  pattern->length = 0;
+  pattern->anchor = 0;
+  pattern->loop = 0;
+
+  while( ( token = strtok( NULL, SIGNATURE_SEPARATORS ) ) ) {
+
+    if( !strcmp( token, "^" ) ) {
+      pattern->anchor = pattern->length;
+      anchored = 1;
+      continue;
+    }
+
+    if( !strcmp( token, "{" ) ) {
+      pattern->loop = pattern->length;
+      continue;
+    }
+
+    if( pattern->length + 2 > LOADER_PATTERN_MAX_LENGTH ) return 1;
+
+    if( !strcmp( token, "jr" ) ) {
+      pattern->bytes[ pattern->length++ ].type = LOADER_PATTERN_JR;
+    } else if( !strcmp( token, "jp" ) ) {
+      pattern->bytes[ pattern->length++ ].type = LOADER_PATTERN_JP_LOW;
+      pattern->bytes[ pattern->length++ ].type = LOADER_PATTERN_JP_HIGH;
+    } else if( parse_pattern_byte( token,
+                                   &pattern->bytes[ pattern->length++ ] ) ) {
+      return 1;
+    }
+
+  }
+
+  if( !pattern->length ) return 1;
+  if( !anchored ) pattern->anchor = 0;
+
+  return 0;
+}
+
+/* Does 'pattern' match the code with its anchor at 'pc'? */
+static int
+pattern_match( const loader_pattern_t *pattern, libspectrum_word pc )
+{
+  libspectrum_word start = pc - pattern->anchor;
+  libspectrum_word loop = start + pattern->loop;
+  libspectrum_word address = start;
+  const loader_pattern_byte_t *byte;
+  libspectrum_byte b;
+  size_t i, j;
+
+  for( i = 0; i < pattern->length; i++, address++ ) {
+
+    b = readbyte_internal( address );
+    byte = &pattern->bytes[i];
+
+    switch( byte->type ) {
+
+    case LOADER_PATTERN_EXACT:
+      for( j = 0; j < byte->count; j++ )
+        if( b == byte->values[j] ) break;
+      if( j == byte->count ) return 0;
+      break;
+
+    case LOADER_PATTERN_ANY:
+      break;
+
+    case LOADER_PATTERN_JR:
+      if( b != (libspectrum_byte)( loop - ( address + 1 ) ) ) return 0;
+      break;
+
+    case LOADER_PATTERN_JP_LOW:
+      if( b != ( loop & 0xff ) ) return 0;
+      break;
+
+    case LOADER_PATTERN_JP_HIGH:
+      if( b != ( loop >> 8 ) ) return 0;
+      break;
+
+    }
+  }
+
+  return 1;
+}
+
+static int
+parse_signature( char *line, const char *filename, int line_number )
+{
+  char *name, *role, *entry, *end;
+  loader_signature_t signature;
+  loader_flash_t flash;
+
+  name = strtok( line, SIGNATURE_SEPARATORS );
+  if( !name || *name == '#' ) return 0;
+
+  if( !strcmp( name, "flash" ) ) {
+
+    name = strtok( NULL, SIGNATURE_SEPARATORS );
+    entry = strtok( NULL, SIGNATURE_SEPARATORS );
+    if( !name || !entry ) goto error;
+
+    flash.entry = strtoul( entry, &end, 16 );
+    if( *end || parse_pattern( &flash.pattern ) ) goto error;
+
+    flash.name = utils_safe_strdup( name );
+    g_array_append_val( loader_flashes, flash );
+
+    return 0;
+  }
+
+  role = strtok( NULL, SIGNATURE_SEPARATORS );
+  if( !role || strlen( role ) != 5 || role[3] != ':' ) goto error;
+
+  if( !strncmp( role, "inc", 3 ) ) {
+    signature.mode = ACCELERATION_MODE_INCREASING;
+  } else if( !strncmp( role, "dec", 3 ) ) {
+    signature.mode = ACCELERATION_MODE_DECREASING;
+  } else {
+    goto error;
+  }
+
+  signature.counter = counter_register( role[4] );
+  if( !signature.counter ) goto error;
+
+  if( parse_pattern( &signature.pattern ) ) goto error;
+
+  signature.name = utils_safe_strdup( name );
+  g_array_append_val( loader_signatures, signature );
+
+  return 0;
+
+ error:
+  ui_error( UI_ERROR_WARNING, "%s:%d: invalid loader signature", filename,
+            line_number );
+  return 1;
+}
+
+static void
+loader_signatures_free( void )
+{
+  guint i;
+
+  if( loader_signatures ) {
+    for( i = 0; i < loader_signatures->len; i++ )
+      libspectrum_free(
+        g_array_index( loader_signatures, loader_signature_t, i ).name );
+    g_array_free( loader_signatures, TRUE );
+    loader_signatures = NULL;
+  }
+
+  if( loader_flashes ) {
+    for( i = 0; i < loader_flashes->len; i++ )
+      libspectrum_free( g_array_index( loader_flashes, loader_flash_t,
+                                       i ).name );
+    g_array_free( loader_flashes, TRUE );
+    loader_flashes = NULL;
+  }
+
+  libspectrum_free( loader_signatures_file );
+  loader_signatures_file = NULL;
+
+  loader_cache_clear();
+}
+
+/* (Re)load the signature database if the file it should come from has
+   changed */
+static void
+loader_signatures_load( void )
+{
+  const char *filename = settings_current.loader_signatures;
+  char line[ 256 ], *copy;
+  int line_number = 0;
+  size_t i;
+  FILE *f;
+
+  if( loader_signatures_loaded ) {
+    if( !filename && !loader_signatures_file ) return;
+    if( filename && loader_signatures_file &&
+        !strcmp( filename, loader_signatures_file ) ) return;
+  }
+
+  loader_signatures_free();
+
+  loader_signatures =
+    g_array_new( FALSE, FALSE, sizeof( loader_signature_t ) );
+  loader_flashes = g_array_new( FALSE, FALSE, sizeof( loader_flash_t ) );
+
+  for( i = 0; i < ARRAY_SIZE( builtin_signatures ); i++ ) {
+    copy = utils_safe_strdup( builtin_signatures[i] );
+    parse_signature( copy, "built-in", i + 1 );
+    libspectrum_free( copy );
+  }
+
+  loader_signatures_loaded = 1;
+
+  if( !filename ) return;
+
+  loader_signatures_file = utils_safe_strdup( filename );
+
+  f = fopen( filename, "r" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open loader signatures '%s': %s",
+              filename, strerror( errno ) );
+    return;
+  }
+
+  while( fgets( line, sizeof( line ), f ) )
+    parse_signature( line, filename, ++line_number );
+
+  fclose( f );
+}
+
+static const loader_signature_t*
+acceleration_detector( libspectrum_word pc )
+{
+  const loader_signature_t *signature;
+  loader_cache_entry_t *cached = &loader_cache[ pc % LOADER_CACHE_SIZE ];
+  const libspectrum_byte *page =
+    memory_map_read[ pc >> MEMORY_PAGE_SIZE_LOGARITHM ].page;
+  libspectrum_byte code[4];
+  guint i;
+
+  for( i = 0; i < ARRAY_SIZE( code ); i++ )
+    code[i] = readbyte_internal( pc - ARRAY_SIZE( code ) + i );
+
+  if( cached->valid && cached->pc == pc && cached->page == page &&
+      !memcmp( cached->code, code, sizeof( code ) ) ) {
+    if( !cached->signature ||
+        pattern_match( &cached->signature->pattern, pc ) )
+      return cached->signature;
+  }
+
+  signature = NULL;
+  for( i = 0; i < loader_signatures->len; i++ ) {
+    if( pattern_match(
+          &g_array_index( loader_signatures, loader_signature_t, i ).pattern,
+          pc ) ) {
+      signature = &g_array_index( loader_signatures, loader_signature_t, i );
+      break;
+    }
+  }
+
+  cached->valid = 1;
+  cached->pc = pc;
+  cached->page = page;
+  memcpy( cached->code, code, sizeof( code ) );
+  cached->signature = signature;
+
+  return signature;
+}
+
+/* The signature of the loader currently being accelerated, if any */
+static const loader_signature_t *acceleration_signature;
+static libspectrum_word acceleration_pc;
+
+/* Loader detection and acceleration count the reads the Spectrum makes, so
+   what they do next depends on the machine's past; keep them with the
+   machine state */
+void
+loader_init( void )
+{
+  statesave_register( &successive_reads, sizeof( successive_reads ) );
+  statesave_register( &last_tstates_read, sizeof( last_tstates_read ) );
+  statesave_register( &last_b_read, sizeof( last_b_read ) );
+  statesave_register( &length_known1, sizeof( length_known1 ) );
+  statesave_register( &length_known2, sizeof( length_known2 ) );
+  statesave_register( &length_long1, sizeof( length_long1 ) );
+  statesave_register( &length_long2, sizeof( length_long2 ) );
+  statesave_register( &acceleration_signature,
+                      sizeof( acceleration_signature ) );
+  statesave_register( &acceleration_pc, sizeof( acceleration_pc ) );
+}
 
 void
 loader_frame( libspectrum_dword frame_length )
@@ -60,33 +507,43 @@ void
 loader_tape_play( void )
 {
   successive_reads = 0;
-  acceleration_mode = ACCELERATION_MODE_NONE;
+  acceleration_signature = NULL;
+  loader_cache_clear();
+
+  loader_signatures_load();
+  loader_flash_active = settings_current.flash_load && loader_flashes->len;
+
+  /* Make sure the main loop notices we may need to check for flash
+     loaders */
+  if( loader_flash_active ) event_add( tstates, event_type_null );
 }
 
 void
 loader_tape_stop( void )
 {
   successive_reads = 0;
-  acceleration_mode = ACCELERATION_MODE_NONE;
+  acceleration_signature = NULL;
+  loader_flash_active = 0;
 }
 
 static void
 do_acceleration( void )
 {
   if( length_known1 ) {
-    int set_b_high = length_long1;
-    set_b_high ^= ( acceleration_mode == ACCELERATION_MODE_DECREASING );
-    if( set_b_high ) {
-      z80.bc.b.h = 0xfe;
+    int set_high = length_long1;
+    set_high ^=
+      ( acceleration_signature->mode == ACCELERATION_MODE_DECREASING );
+    if( set_high ) {
+      *acceleration_signature->counter = 0xfe;
     } else {
-      z80.bc.b.h = 0x00;
+      *acceleration_signature->counter = 0x00;
     }
+    z80_flags_evaluate();
     z80.af.b.l |= 0x01;
     z80.pc.b.l = readbyte_internal( z80.sp.w ); z80.sp.w++;
     z80.pc.b.h = readbyte_internal( z80.sp.w ); z80.sp.w++;
 
-    event_remove_type( tape_edge_event );
-    tape_next_edge( tstates, 0, NULL );
+    tape_skip_to_next_edge();
 
     successive_reads = 0;
   }
@@ -95,217 +552,48 @@ do_acceleration( void )
   length_long1 = length_long2;
 }
 
-static acceleration_mode_t
-acceleration_detector( libspectrum_word pc )
-{
-  int state = 0, count = 0;
-  while( 1 ) {
-    libspectrum_byte b = readbyte_internal( pc ); pc++; count++;
-    switch( state ) {
-    case 0:
-      switch( b ) {
-      case 0x04: state = 1; break;	/* INC B - Many loaders */
-      default: state = 13; break;	/* Possible Digital Integration */
-      }
-      break;
-    case 1:
-      switch( b ) {
-      case 0xc8: state = 2; break;	/* RET Z */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 2:
-      switch( b ) {
-      case 0x3e: state = 3; break;	/* LD A,nn */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 3:
-      switch( b ) {
-      case 0x00:			/* Search Loader */
-      case 0x7f:			/* ROM loader and variants */
-	state = 4; break;		/* Data byte */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 4:
-      switch( b ) {
-      case 0xdb: state = 5; break;	/* IN A,(nn) */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 5:
-      switch( b ) {
-      case 0xfe: state = 6; break;	/* Data byte */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 6:
-      switch( b ) {
-      case 0x1f: state = 7; break;	/* RRA */
-      case 0xa9: state = 24; break;	/* XOR C - Search Loader */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 7:
-      switch( b ) {
-      case 0x00:			/* NOP - Bleepload */
-      case 0xa7:			/* AND A - Microsphere */
-      case 0xc8:			/* RET Z - Paul Owens */
-      case 0xd0:			/* RET NC - ROM loader */
-	state = 8; break;
-      case 0xa9: state = 9; break;	/* XOR C - Speedlock */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 8:
-      switch( b ) {
-      case 0xa9: state = 9; break;	/* XOR C */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 9:
-      switch( b ) {
-      case 0xe6: state = 10; break;	/* AND nn */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 10:
-      switch( b ) {
-      case 0x20: state = 11; break;	/* Data byte */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 11:
-      switch( b ) {
-      case 0x28: state = 12; break;	/* JR nn */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 12:
-      if( b == 0x100 - count ) {
-	return ACCELERATION_MODE_INCREASING;
-      } else {
-	return ACCELERATION_MODE_NONE;
-      }
-      break;
-
-      /* Digital Integration loader */
-
-    case 13:
-      state = 14; break;		/* Possible Digital Integration */
-    case 14:
-      switch( b ) {
-      case 0x05: state = 15; break;	/* DEC B - Digital Integration */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 15:
-      switch( b ) {
-      case 0xc8: state = 16; break;	/* RET Z */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 16:
-      switch( b ) {
-      case 0xdb: state = 17; break;	/* IN A,(nn) */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 17:
-      switch( b ) {
-      case 0xfe: state = 18; break;	/* Data byte */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 18:
-      switch( b ) {
-      case 0xa9: state = 19; break;	/* XOR C */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 19:
-      switch( b ) {
-      case 0xe6: state = 20; break;	/* AND nn */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 20:
-      switch( b ) {
-      case 0x40: state = 21; break;	/* Data byte */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 21:
-      switch( b ) {
-      case 0xca: state = 22; break;	/* JP Z,nnnn */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 22:				/* LSB of jump target */
-      if( b == ( z80.pc.w - 4 ) % 0x100 ) {
-	state = 23;
-      } else {
-	return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 23:				/* MSB of jump target */
-      if( b == ( z80.pc.w - 4 ) / 0x100 ) {
-	return ACCELERATION_MODE_DECREASING;
-      } else {
-	return ACCELERATION_MODE_NONE;
-      }
-
-      /* Search loader */
-
-    case 24:
-      switch( b ) {
-      case 0xe6: state = 25; break;	/* AND nn */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 25:
-      switch( b ) {
-      case 0x40: state = 26; break;	/* Data byte */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 26:
-      switch( b ) {
-      case 0xd8: state = 27; break;	/* RET C */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-    case 27:
-      switch( b ) {
-      case 0x00: state = 11; break;	/* NOP */
-      default: return ACCELERATION_MODE_NONE;
-      }
-      break;
-	
-    default:
-      /* Can't happen */
-      break;
-    }
-  }
-
-}      
-
 static void
 check_for_acceleration( void )
 {
   /* If the IN occured at a different location to the one we're
      accelerating, stop acceleration */
-  if( acceleration_mode && z80.pc.w != acceleration_pc )
-    acceleration_mode = ACCELERATION_MODE_NONE;
+  if( acceleration_signature && z80.pc.w != acceleration_pc )
+    acceleration_signature = NULL;
 
   /* If we're not accelerating, check if this is a loader */
-  if( !acceleration_mode ) {
-    acceleration_mode = acceleration_detector( z80.pc.w - 6 );
+  if( !acceleration_signature ) {
+    loader_signatures_load();
+    acceleration_signature = acceleration_detector( z80.pc.w );
     acceleration_pc = z80.pc.w;
   }
 
-  if( acceleration_mode ) do_acceleration();
+  if( acceleration_signature ) do_acceleration();
+}
+
+/* Called before each opcode while flash loading is active; if PC is at
+   the entry point of a known LD-BYTES style routine, load the current
+   tape block directly into memory and return from the routine */
+void
+loader_flash_check( void )
+{
+  const loader_flash_t *flash;
+  guint i;
+
+  for( i = 0; i < loader_flashes->len; i++ ) {
+
+    flash = &g_array_index( loader_flashes, loader_flash_t, i );
+    if( flash->entry != z80.pc.w ) continue;
+
+    if( !pattern_match( &flash->pattern, z80.pc.w ) ) continue;
+
+    if( tape_flash_load() ) return;
+
+    /* Return from the loader to its caller */
+    z80.pc.b.l = readbyte_internal( z80.sp.w ); z80.sp.w++;
+    z80.pc.b.h = readbyte_internal( z80.sp.w ); z80.sp.w++;
+
+    return;
+  }
 }
 
 void
@@ -364,3 +652,51 @@ loader_set_acceleration_flags( int flags )
     length_known2 = 0;
   }
 }
+
+static int
+detect_test_loader( const libspectrum_byte *code, size_t length,
+                    libspectrum_word pc )
+{
+  size_t i;
+  const loader_signature_t *signature;
+
+  for( i = 0; i < length; i++ ) writebyte_internal( 0x8000 + i, code[i] );
+
+  loader_cache_clear();
+  signature = acceleration_detector( pc );
+
+  return signature ? signature->mode : ACCELERATION_MODE_NONE;
+}
+
+int
+loader_unittest( void )
+{
+  /* The ROM's LD-SAMPLE loop */
+  const libspectrum_byte rom[] = {
+    0x04, 0xc8, 0x3e, 0x7f, 0xdb, 0xfe, 0x1f, 0xd0, 0xa9, 0xe6, 0x20, 0x28,
+    0xf3
+  };
+  /* The Digital Integration loop, jumping back to 0x8002 */
+  const libspectrum_byte digital_integration[] = {
+    0x00, 0x00, 0x05, 0xc8, 0xdb, 0xfe, 0xa9, 0xe6, 0x40, 0xca, 0x02, 0x80
+  };
+  libspectrum_byte not_a_loader[ sizeof( rom ) ];
+
+  loader_signatures_load();
+
+  TEST_ASSERT( detect_test_loader( rom, sizeof( rom ), 0x8006 ) ==
+               ACCELERATION_MODE_INCREASING );
+  TEST_ASSERT( detect_test_loader( digital_integration,
+                                   sizeof( digital_integration ), 0x8006 ) ==
+               ACCELERATION_MODE_DECREASING );
+
+  /* A jump to the wrong place isn't an edge loop */
+  memcpy( not_a_loader, rom, sizeof( rom ) );
+  not_a_loader[ sizeof( rom ) - 1 ] = 0xf4;
+  TEST_ASSERT( detect_test_loader( not_a_loader, sizeof( not_a_loader ),
+                                   0x8006 ) == ACCELERATION_MODE_NONE );
+
+  loader_cache_clear();
+
+  return 0;
+}
@@ -28,10 +28,16 @@
 
 #include <libspectrum.h>
 
+void loader_init( void );
 void loader_frame( libspectrum_dword frame_length );
 void loader_tape_play( void );
 void loader_tape_stop( void );
 void loader_detect_loader( void );
 void loader_set_acceleration_flags( int flags );
 
+extern int loader_flash_active;
+void loader_flash_check( void );
+
+int loader_unittest( void );
+
 #endif			/* #ifndef FUSE_LOADER_H */
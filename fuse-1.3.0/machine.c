@@ -46,6 +46,7 @@
 #include "settings.h"
 #include "snapshot.h"
 #include "sound.h"
+#include "statehash.h"
 #include "tape.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
@@ -228,7 +229,8 @@ machine_select_machine( fuse_machine_info *machine )
     height = DISPLAY_SCREEN_HEIGHT;
   }
 
-  if( uidisplay_init( width, height ) ) return 1;
+  if( !settings_current.headless && uidisplay_init( width, height ) )
+    return 1;
 
   sound_init( settings_current.sound_device );
 
@@ -345,6 +347,7 @@ machine_reset( int hard_reset )
   machine_set_variable_timings( machine_current );
 
   memory_reset();
+  statehash_invalidate();
 
   /* Do the machine-specific bits, including loading the ROMs */
   error = machine_current->reset(); if( error ) return error;
@@ -358,6 +361,7 @@ machine_reset( int hard_reset )
     ula_contention[ i ] = machine_current->ram.contend_delay( i );
     ula_contention_no_mreq[ i ] = machine_current->ram.contend_delay_no_mreq( i );
   }
+  ula_contention_update_window();
 
   /* Update the disk menu items */
   ui_menu_disk_update();
@@ -44,6 +44,8 @@
 #include "peripherals/ula.h"
 #include "settings.h"
 #include "spectrum.h"
+#include "statehash.h"
+#include "statesave.h"
 #include "ui/ui.h"
 #include "utils.h"
 
@@ -62,6 +64,18 @@ int memory_source_none; /* No memory attached here */
 memory_page memory_map_read[MEMORY_PAGES_IN_64K];
 memory_page memory_map_write[MEMORY_PAGES_IN_64K];
 
+/* Handlers for the banks which need more than a plain access because a
+   peripheral is watching them; NULL for plain RAM and ROM. Set up by
+   memory_update_handlers() whenever the paging changes */
+typedef libspectrum_byte (*memory_read_handler_fn)( memory_page *mapping,
+                                                    libspectrum_word address );
+typedef void (*memory_write_handler_fn)( memory_page *mapping,
+                                         libspectrum_word address,
+                                         libspectrum_byte b );
+
+static memory_read_handler_fn memory_read_handler[ MEMORY_PAGES_IN_64K ];
+static memory_write_handler_fn memory_write_handler[ MEMORY_PAGES_IN_64K ];
+
 /* Standard mappings for the 'normal' RAM */
 memory_page memory_map_ram[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
 
@@ -136,6 +150,12 @@ memory_init( void *context )
 
   module_register( &memory_module_info );
 
+  statesave_register( memory_map_read, sizeof( memory_map_read ) );
+  statesave_register( memory_map_write, sizeof( memory_map_write ) );
+  statesave_register( &memory_current_screen,
+                      sizeof( memory_current_screen ) );
+  statesave_register( &memory_screen_mask, sizeof( memory_screen_mask ) );
+
   return 0;
 }
 
@@ -214,6 +234,12 @@ memory_source_find( const char *description )
   return source;
 }
 
+int
+memory_source_count( void )
+{
+  return memory_sources->len;
+}
+
 /* Allocate some memory from the pool */
 libspectrum_byte*
 memory_pool_allocate( size_t length )
@@ -348,6 +374,111 @@ memory_map_romcs_2k( libspectrum_word address, memory_page source[] )
     memory_map_read[ start + i ] = memory_map_write[ start + i ] = source[ i ];
 }
 
+/* The Opus Discovery's I/O and the Spectranet's two W5100 windows */
+#define OPUS_BANK( bank ) ( (bank) >= 0x2800 >> MEMORY_PAGE_SIZE_LOGARITHM && \
+			    (bank) < 0x3800 >> MEMORY_PAGE_SIZE_LOGARITHM )
+#define W5100_A_BANK( bank ) ( (bank) >= 0x1000 >> MEMORY_PAGE_SIZE_LOGARITHM && \
+			       (bank) < 0x2000 >> MEMORY_PAGE_SIZE_LOGARITHM )
+#define W5100_B_BANK( bank ) ( (bank) >= 0x2000 >> MEMORY_PAGE_SIZE_LOGARITHM && \
+			       (bank) < 0x3000 >> MEMORY_PAGE_SIZE_LOGARITHM )
+
+static libspectrum_byte
+read_opus( memory_page *mapping GCC_UNUSED, libspectrum_word address )
+{
+  return opus_read( address );
+}
+
+static inline void
+write_plain( memory_page *mapping, libspectrum_word address,
+             libspectrum_byte b )
+{
+  if( mapping->writable ||
+      (mapping->source != memory_source_none &&
+       settings_current.writable_roms) ) {
+    libspectrum_word offset = address & MEMORY_PAGE_SIZE_MASK;
+    libspectrum_byte *memory = mapping->page;
+
+    memory_display_dirty( address, b );
+
+    if( mapping->source == memory_source_ram )
+      statehash_ram_written( mapping->page_num );
+
+    memory[ offset ] = b;
+  }
+}
+
+static void
+write_opus( memory_page *mapping GCC_UNUSED, libspectrum_word address,
+            libspectrum_byte b )
+{
+  opus_write( address, b );
+}
+
+/* While the Spectranet is paged in, all writes need to be parsed by the
+   flash ROM emulation */
+static void
+write_spectranet_flash( memory_page *mapping, libspectrum_word address,
+                        libspectrum_byte b )
+{
+  spectranet_flash_rom_write( address, b );
+
+  if( opus_active && OPUS_BANK( address >> MEMORY_PAGE_SIZE_LOGARITHM ) ) {
+    opus_write( address, b );
+  } else {
+    write_plain( mapping, address, b );
+  }
+}
+
+static void
+write_spectranet_w5100( memory_page *mapping, libspectrum_word address,
+                        libspectrum_byte b )
+{
+  spectranet_flash_rom_write( address, b );
+  spectranet_w5100_write( mapping, address, b );
+}
+
+/* Work out which banks need special handling for the current paging */
+void
+memory_update_handlers( void )
+{
+  size_t i;
+
+  for( i = 0; i < MEMORY_PAGES_IN_64K; i++ ) {
+    int w5100 = spectranet_paged &&
+      ( ( spectranet_w5100_paged_a && W5100_A_BANK( i ) ) ||
+        ( spectranet_w5100_paged_b && W5100_B_BANK( i ) ) );
+
+    if( opus_active && OPUS_BANK( i ) ) {
+      memory_read_handler[i] = read_opus;
+    } else if( w5100 ) {
+      memory_read_handler[i] = spectranet_w5100_read;
+    } else {
+      memory_read_handler[i] = NULL;
+    }
+
+    if( w5100 ) {
+      memory_write_handler[i] = write_spectranet_w5100;
+    } else if( spectranet_paged ) {
+      memory_write_handler[i] = write_spectranet_flash;
+    } else if( opus_active && OPUS_BANK( i ) ) {
+      memory_write_handler[i] = write_opus;
+    } else {
+      memory_write_handler[i] = NULL;
+    }
+  }
+}
+
+static inline libspectrum_byte
+readbyte_mapped( libspectrum_word bank, libspectrum_word address )
+{
+  memory_read_handler_fn handler = memory_read_handler[ bank ];
+  memory_page *mapping = &memory_map_read[ bank ];
+
+  if( handler ) return handler( mapping, address );
+
+  return mapping->page[ address & MEMORY_PAGE_SIZE_MASK ];
+}
+
 libspectrum_byte
 readbyte( libspectrum_word address )
 {
@@ -363,17 +494,17 @@ readbyte( libspectrum_word address )
   if( mapping->contended ) tstates += ula_contention[ tstates ];
   tstates += 3;
 
-  if( opus_active && address >= 0x2800 && address < 0x3800 )
-    return opus_read( address );
+  return readbyte_mapped( bank, address );
+}
 
-  if( spectranet_paged ) {
-    if( spectranet_w5100_paged_a && address >= 0x1000 && address < 0x2000 )
-      return spectranet_w5100_read( mapping, address );
-    if( spectranet_w5100_paged_b && address >= 0x2000 && address < 0x3000 )
-      return spectranet_w5100_read( mapping, address );
-  }
+/* As readbyte(), but for use by the Z80 core when it knows no contention
+   can apply. The debugger is never active when that core is running */
+libspectrum_byte
+readbyte_uncontended( libspectrum_word address )
+{
+  tstates += 3;
 
-  return mapping->page[ address & MEMORY_PAGE_SIZE_MASK ];
+  return readbyte_mapped( address >> MEMORY_PAGE_SIZE_LOGARITHM, address );
 }
 
 void
@@ -395,6 +526,14 @@ writebyte( libspectrum_word address, libspectrum_byte b )
   writebyte_internal( address, b );
 }
 
+void
+writebyte_uncontended( libspectrum_word address, libspectrum_byte b )
+{
+  tstates += 3;
+
+  writebyte_internal( address, b );
+}
+
 void
 memory_display_dirty_pentagon_16_col( libspectrum_word address,
                                       libspectrum_byte b )
@@ -450,32 +589,12 @@ writebyte_internal( libspectrum_word address, libspectrum_byte b )
 {
   libspectrum_word bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
   memory_page *mapping = &memory_map_write[ bank ];
-  
-  if( spectranet_paged ) {
-    /* all writes need to be parsed by the flash rom emulation */
-    spectranet_flash_rom_write(address, b);
-    
-    if( spectranet_w5100_paged_a && address >= 0x1000 && address < 0x2000 ) {
-      spectranet_w5100_write( mapping, address, b );
-      return;
-    }
-    if( spectranet_w5100_paged_b && address >= 0x2000 && address < 0x3000 ) {
-      spectranet_w5100_write( mapping, address, b );
-      return;
-    }
-  }
-
-  if( opus_active && address >= 0x2800 && address < 0x3800 ) {
-    opus_write( address, b );
-  } else if( mapping->writable ||
-             (mapping->source != memory_source_none &&
-              settings_current.writable_roms) ) {
-    libspectrum_word offset = address & MEMORY_PAGE_SIZE_MASK;
-    libspectrum_byte *memory = mapping->page;
-
-    memory_display_dirty( address, b );
+  memory_write_handler_fn handler = memory_write_handler[ bank ];
 
-    memory[ offset ] = b;
+  if( handler ) {
+    handler( mapping, address, b );
+  } else {
+    write_plain( mapping, address, b );
   }
 }
 
@@ -483,7 +602,10 @@ void
 memory_romcs_map( void )
 {
   /* Nothing changes if /ROMCS is not set */
-  if( !machine_current->ram.romcs ) return;
+  if( !machine_current->ram.romcs ) {
+    memory_update_handlers();
+    return;
+  }
 
   /* FIXME: what should we do if more than one of these devices is
      active? What happen in the real situation? e.g. if1+if2 with cartridge?
@@ -503,6 +625,8 @@ memory_romcs_map( void )
    */
 
   module_romcs();
+
+  memory_update_handlers();
 }
 
 static void
@@ -532,6 +656,8 @@ memory_from_snapshot( libspectrum_snap *snap )
     if( libspectrum_snap_pages( snap, i ) )
       memcpy( RAM[i], libspectrum_snap_pages( snap, i ), 0x4000 );
 
+  statehash_invalidate();
+
   if( libspectrum_snap_custom_rom( snap ) ) {
     for( i = 0; i < libspectrum_snap_custom_rom_pages( snap ) && i < 4; i++ ) {
       if( libspectrum_snap_roms( snap, i ) ) {
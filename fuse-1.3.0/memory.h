@@ -38,6 +38,9 @@ const char *memory_source_description( int source );
 /* Get the source for a given description */
 int memory_source_find( const char *description );
 
+/* How many sources have been registered */
+int memory_source_count( void );
+
 /* Pre-created memory sources */
 extern int memory_source_rom; /* System ROM */
 extern int memory_source_ram; /* System RAM */
@@ -178,6 +181,11 @@ libspectrum_byte readbyte_internal( libspectrum_word address );
 void writebyte( libspectrum_word address, libspectrum_byte b );
 void writebyte_internal( libspectrum_word address, libspectrum_byte b );
 
+void memory_update_handlers( void );
+
+libspectrum_byte readbyte_uncontended( libspectrum_word address );
+void writebyte_uncontended( libspectrum_word address, libspectrum_byte b );
+
 typedef void (*memory_display_dirty_fn)( libspectrum_word address,
                                          libspectrum_byte b );
 extern memory_display_dirty_fn memory_display_dirty;
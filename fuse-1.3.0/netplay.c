@@ -0,0 +1,860 @@
+/* netplay.c: Two machines kept in step over the network
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* Each machine runs the same emulation and sends the other its keyboard
+   and joystick state for every frame, `netplay_delay' frames in advance.
+   Where the other machine's input for a frame hasn't arrived yet, it is
+   predicted to be the same as the last input which did arrive; when the
+   real input turns out to be different, the machine state from the start
+   of that frame is restored and the frames since then are emulated again,
+   unseen, with the right input. Neither machine gets more than
+   `netplay_rollback' frames ahead of the input it has from the other.
+
+   The tape isn't part of the machine state, as libspectrum doesn't let us
+   save and restore its position part way through a block, so frames
+   emulated again would find it wherever the first run left it. Netplay
+   therefore only runs without a tape */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef BUILD_NETPLAY
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif				/* #ifdef BUILD_NETPLAY */
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "display.h"
+#include "event.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "keyboard.h"
+#include "netplay.h"
+#include "peripherals/joystick.h"
+#include "rzx.h"
+#include "settings.h"
+#include "sound.h"
+#include "statehash.h"
+#include "statesave.h"
+#include "tape.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+int netplay_active = 0;
+
+#ifdef BUILD_NETPLAY
+
+/* How many frames of input are kept; more than the two machines can ever
+   be apart given the limits below */
+#define NETPLAY_FRAMES 128
+
+#define NETPLAY_MAX_DELAY 15
+#define NETPLAY_MAX_ROLLBACK 30
+
+/* The eight keyboard half-rows, then the joystick values */
+#define NETPLAY_INPUT_LENGTH ( 8 + JOYSTICK_VALUE_COUNT )
+
+typedef libspectrum_byte netplay_input[ NETPLAY_INPUT_LENGTH ];
+
+/* The machines compare state hashes every this many frames */
+#define NETPLAY_HASH_INTERVAL 50
+#define NETPLAY_HASHES 8
+
+/* Timings, in seconds */
+#define NETPLAY_HELLO_INTERVAL 0.1	/* Between greetings */
+#define NETPLAY_HELLO_TIMEOUT 60.0	/* Waiting for the other machine */
+#define NETPLAY_RESEND_INTERVAL 0.05	/* Between resends while stalled */
+#define NETPLAY_TIMEOUT 10.0		/* Before giving up on the other
+					   machine */
+#define NETPLAY_SETTLE_TIMEOUT 2.0	/* Swapping the last input on exit */
+
+/* Every packet starts with "FN", the protocol version and the type */
+#define NETPLAY_VERSION 1
+
+typedef enum netplay_packet_type {
+  NETPLAY_PACKET_HELLO,		/* The hash of the starting state */
+  NETPLAY_PACKET_INPUT,		/* Acknowledgement, hash, then input */
+  NETPLAY_PACKET_QUIT,
+} netplay_packet_type;
+
+#define NETPLAY_HEADER_LENGTH 4
+#define NETPLAY_INPUT_HEADER_LENGTH ( NETPLAY_HEADER_LENGTH + 21 )
+#define NETPLAY_PACKET_LENGTH \
+  ( NETPLAY_INPUT_HEADER_LENGTH + NETPLAY_FRAMES * NETPLAY_INPUT_LENGTH )
+
+static int netplay_socket = -1;
+
+static long delay, rollback;
+
+/* The frame about to be emulated, counting from when netplay started */
+static long frame;
+
+/* Input indexed by frame number modulo NETPLAY_FRAMES. `remote_used' is
+   the other machine's input as applied, which may have been a guess */
+static netplay_input local_input[ NETPLAY_FRAMES ];
+static netplay_input remote_input[ NETPLAY_FRAMES ];
+static netplay_input remote_used[ NETPLAY_FRAMES ];
+static long remote_frame[ NETPLAY_FRAMES ];
+
+static long remote_confirmed;	/* All remote input up to here has arrived */
+static long verified;		/* Frames up to here had the right input */
+static long peer_ack;		/* The other machine has our input up to here */
+static int peer_hello, peer_input, peer_quit;
+static libspectrum_qword start_hash, peer_start_hash;
+
+/* The machine state at the start of each of the last few frames */
+static statesave_state **states = NULL;
+static long *state_frame = NULL;
+static long state_count = 0;
+
+static struct {
+  long frame;
+  libspectrum_qword hash;
+} hashes[ NETPLAY_HASHES ];
+
+static long peer_hash_frame, last_hash_checked;
+static libspectrum_qword peer_hash;
+
+static double last_heard, last_sent;
+
+/* Counts the frames run by run_frame() */
+static int resimulating = 0;
+static unsigned long frames_run;
+
+static unsigned long rollbacks, resimulated, desyncs;
+static int started = 0;
+
+static void netplay_stop( const char *reason );
+
+static libspectrum_byte*
+write_dword( libspectrum_byte *ptr, libspectrum_dword value )
+{
+  *ptr++ = value & 0xff; *ptr++ = ( value >> 8 ) & 0xff;
+  *ptr++ = ( value >> 16 ) & 0xff; *ptr++ = value >> 24;
+  return ptr;
+}
+
+static libspectrum_dword
+read_dword( const libspectrum_byte **ptr )
+{
+  libspectrum_dword value = (*ptr)[0] | ( (*ptr)[1] << 8 ) |
+    ( (*ptr)[2] << 16 ) | ( (libspectrum_dword)(*ptr)[3] << 24 );
+  *ptr += 4;
+  return value;
+}
+
+static libspectrum_byte*
+write_qword( libspectrum_byte *ptr, libspectrum_qword value )
+{
+  ptr = write_dword( ptr, value & 0xffffffff );
+  return write_dword( ptr, value >> 32 );
+}
+
+static libspectrum_qword
+read_qword( const libspectrum_byte **ptr )
+{
+  libspectrum_qword value = read_dword( ptr );
+  return value | ( (libspectrum_qword)read_dword( ptr ) << 32 );
+}
+
+static libspectrum_byte*
+write_header( libspectrum_byte *ptr, netplay_packet_type type )
+{
+  *ptr++ = 'F'; *ptr++ = 'N'; *ptr++ = NETPLAY_VERSION; *ptr++ = type;
+  return ptr;
+}
+
+static void
+send_packet( const libspectrum_byte *buffer, size_t length )
+{
+  /* Lost packets are made up for by the next one, so errors (including
+     the other machine not listening yet) don't matter */
+  send( netplay_socket, buffer, length, 0 );
+  last_sent = timer_get_time();
+}
+
+static void
+send_hello( void )
+{
+  libspectrum_byte buffer[ NETPLAY_HEADER_LENGTH + 8 ], *ptr;
+
+  ptr = write_header( buffer, NETPLAY_PACKET_HELLO );
+  ptr = write_qword( ptr, start_hash );
+
+  send_packet( buffer, ptr - buffer );
+}
+
+static void
+send_quit( void )
+{
+  libspectrum_byte buffer[ NETPLAY_HEADER_LENGTH ], *ptr;
+
+  ptr = write_header( buffer, NETPLAY_PACKET_QUIT );
+
+  send_packet( buffer, ptr - buffer );
+}
+
+/* Send all the input the other machine hasn't acknowledged, and the hash
+   of the latest state we know to be right */
+static void
+send_input( void )
+{
+  libspectrum_byte buffer[ NETPLAY_PACKET_LENGTH ], *ptr;
+  long last = frame + delay, first = peer_ack + 1, f, hash_frame;
+  int slot;
+
+  if( first < last - NETPLAY_FRAMES / 2 + 1 )
+    first = last - NETPLAY_FRAMES / 2 + 1;
+  if( first < 0 ) first = 0;
+  if( first > last ) first = last + 1;
+
+  hash_frame = ( ( verified + 1 ) / NETPLAY_HASH_INTERVAL ) *
+               NETPLAY_HASH_INTERVAL;
+  slot = ( hash_frame / NETPLAY_HASH_INTERVAL ) % NETPLAY_HASHES;
+
+  ptr = write_header( buffer, NETPLAY_PACKET_INPUT );
+  ptr = write_dword( ptr, remote_confirmed );
+  if( hashes[ slot ].frame == hash_frame ) {
+    ptr = write_dword( ptr, hash_frame );
+    ptr = write_qword( ptr, hashes[ slot ].hash );
+  } else {
+    ptr = write_dword( ptr, -1 );
+    ptr = write_qword( ptr, 0 );
+  }
+  ptr = write_dword( ptr, first );
+  *ptr++ = last - first + 1;
+
+  for( f = first; f <= last; f++ ) {
+    memcpy( ptr, local_input[ f % NETPLAY_FRAMES ], NETPLAY_INPUT_LENGTH );
+    ptr += NETPLAY_INPUT_LENGTH;
+  }
+
+  send_packet( buffer, ptr - buffer );
+}
+
+static void
+read_input( const libspectrum_byte *buffer, size_t length )
+{
+  const libspectrum_byte *ptr = buffer + NETPLAY_HEADER_LENGTH;
+  long ack, hash_frame, first, f;
+  libspectrum_qword hash;
+  size_t i, count;
+
+  if( length < NETPLAY_INPUT_HEADER_LENGTH ) return;
+
+  ack = (libspectrum_signed_dword)read_dword( &ptr );
+  hash_frame = (libspectrum_signed_dword)read_dword( &ptr );
+  hash = read_qword( &ptr );
+  first = (libspectrum_signed_dword)read_dword( &ptr );
+  count = *ptr++;
+
+  if( length < NETPLAY_INPUT_HEADER_LENGTH + count * NETPLAY_INPUT_LENGTH )
+    return;
+
+  peer_input = 1;
+  if( ack > peer_ack ) peer_ack = ack;
+
+  if( hash_frame > peer_hash_frame ) {
+    peer_hash_frame = hash_frame;
+    peer_hash = hash;
+  }
+
+  for( i = 0; i < count; i++, ptr += NETPLAY_INPUT_LENGTH ) {
+    f = first + i;
+    if( f <= remote_confirmed || f >= remote_confirmed + NETPLAY_FRAMES )
+      continue;
+    memcpy( remote_input[ f % NETPLAY_FRAMES ], ptr, NETPLAY_INPUT_LENGTH );
+    remote_frame[ f % NETPLAY_FRAMES ] = f;
+  }
+
+  while( remote_frame[ ( remote_confirmed + 1 ) % NETPLAY_FRAMES ] ==
+         remote_confirmed + 1 )
+    remote_confirmed++;
+}
+
+/* Deal with everything the other machine has sent */
+static void
+receive( void )
+{
+  libspectrum_byte buffer[ NETPLAY_PACKET_LENGTH ];
+  const libspectrum_byte *ptr;
+  ssize_t length;
+
+  while( 1 ) {
+
+    length = recv( netplay_socket, buffer, sizeof( buffer ), 0 );
+    if( length < 0 ) {
+      /* A refused connection just means nobody was listening when we last
+         sent something */
+      if( errno == EINTR || errno == ECONNREFUSED ) continue;
+      break;
+    }
+
+    if( length < NETPLAY_HEADER_LENGTH || buffer[0] != 'F' ||
+        buffer[1] != 'N' || buffer[2] != NETPLAY_VERSION )
+      continue;
+
+    last_heard = timer_get_time();
+
+    switch( buffer[3] ) {
+
+    case NETPLAY_PACKET_HELLO:
+      if( length < NETPLAY_HEADER_LENGTH + 8 ) break;
+      ptr = buffer + NETPLAY_HEADER_LENGTH;
+      peer_start_hash = read_qword( &ptr );
+      /* The other machine is still waiting to hear from us */
+      if( peer_hello && !peer_input ) send_hello();
+      peer_hello = 1;
+      break;
+
+    case NETPLAY_PACKET_INPUT:
+      read_input( buffer, length );
+      break;
+
+    case NETPLAY_PACKET_QUIT:
+      peer_quit = 1;
+      break;
+
+    }
+  }
+}
+
+/* Wait up to `seconds' for something to arrive */
+static void
+wait_for_packet( double seconds )
+{
+  fd_set fds;
+  struct timeval timeout;
+
+  FD_ZERO( &fds );
+  FD_SET( netplay_socket, &fds );
+
+  timeout.tv_sec = 0;
+  timeout.tv_usec = seconds * 1000000;
+
+  select( netplay_socket + 1, &fds, NULL, NULL, &timeout );
+}
+
+static void
+neutral_input( libspectrum_byte *input )
+{
+  memset( input, 0xff, 8 );
+  input[ 8 + JOYSTICK_VALUE_KEMPSTON ] = 0x00;
+  input[ 8 + JOYSTICK_VALUE_TIMEX_1 ] = 0x00;
+  input[ 8 + JOYSTICK_VALUE_TIMEX_2 ] = 0x00;
+  input[ 8 + JOYSTICK_VALUE_FULLER ] = 0xff;
+}
+
+static void
+capture_input( libspectrum_byte *input )
+{
+  memcpy( input, keyboard_host_values, 8 );
+  memcpy( input + 8, joystick_host_values, JOYSTICK_VALUE_COUNT );
+}
+
+/* Give the emulated machine both sets of input for frame `f' */
+static void
+apply_input( long f )
+{
+  const libspectrum_byte *local = local_input[ f % NETPLAY_FRAMES ];
+  libspectrum_byte *remote = remote_used[ f % NETPLAY_FRAMES ];
+  size_t i;
+
+  if( f <= remote_confirmed ) {
+    memcpy( remote, remote_input[ f % NETPLAY_FRAMES ],
+            NETPLAY_INPUT_LENGTH );
+  } else if( remote_confirmed >= 0 ) {
+    memcpy( remote, remote_input[ remote_confirmed % NETPLAY_FRAMES ],
+            NETPLAY_INPUT_LENGTH );
+  } else {
+    neutral_input( remote );
+  }
+
+  for( i = 0; i < 8; i++ )
+    keyboard_return_values[i] = local[i] & remote[i];
+
+  /* The Kempston and Timex interfaces are active high, the Fuller Box
+     active low */
+  for( i = 0; i < JOYSTICK_VALUE_COUNT; i++ )
+    joystick_values[i] = i == JOYSTICK_VALUE_FULLER ?
+                         local[ 8 + i ] & remote[ 8 + i ] :
+                         local[ 8 + i ] | remote[ 8 + i ];
+}
+
+static void
+save_state( long f )
+{
+  long slot = f % state_count;
+
+  if( statesave_save( states[ slot ] ) ) {
+    netplay_stop( "couldn't save the machine state" );
+    return;
+  }
+  state_frame[ slot ] = f;
+}
+
+static void
+record_hash( long f )
+{
+  int slot;
+
+  if( f % NETPLAY_HASH_INTERVAL ) return;
+
+  /* Kept up to date at the end of every frame, including those emulated
+     again */
+  slot = ( f / NETPLAY_HASH_INTERVAL ) % NETPLAY_HASHES;
+  hashes[ slot ].frame = f;
+  hashes[ slot ].hash = statehash_frame_hash;
+}
+
+/* Compare the other machine's latest hash with ours, once our state for
+   that frame is known to be right */
+static void
+check_hash( void )
+{
+  int slot;
+
+  if( peer_hash_frame <= last_hash_checked ||
+      peer_hash_frame > verified + 1 ) return;
+
+  slot = ( peer_hash_frame / NETPLAY_HASH_INTERVAL ) % NETPLAY_HASHES;
+  if( hashes[ slot ].frame != peer_hash_frame ) return;
+
+  last_hash_checked = peer_hash_frame;
+
+  if( hashes[ slot ].hash != peer_hash && !desyncs++ )
+    ui_error( UI_ERROR_WARNING,
+              "Netplay: the two machines differ at frame %ld", peer_hash_frame );
+}
+
+/* Run the emulation until the end of the current frame */
+static void
+run_frame( void )
+{
+  unsigned long start = frames_run;
+
+  while( frames_run == start ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+}
+
+/* Go back to the start of frame `first' and emulate forward to where we
+   were, unseen, with the input as it now stands */
+static void
+rollback_to( long first )
+{
+  long f, slot = first % state_count;
+
+  if( state_frame[ slot ] != first ||
+      statesave_restore( states[ slot ] ) ) {
+    netplay_stop( "couldn't restore the machine state" );
+    return;
+  }
+
+  rollbacks++;
+
+  fuse_emulation_hidden = 1;
+  resimulating = 1;
+
+  for( f = first; f < frame; f++ ) {
+    if( f != first ) {
+      save_state( f );
+      record_hash( f );
+    }
+    apply_input( f );
+    run_frame();
+    resimulated++;
+  }
+
+  resimulating = 0;
+  fuse_emulation_hidden = 0;
+
+  display_refresh_all();
+  sound_resync();
+}
+
+/* Check the frames emulated with guessed input against the input which has
+   since arrived */
+static void
+resync( void )
+{
+  long limit = remote_confirmed < frame - 1 ? remote_confirmed : frame - 1;
+  long f;
+
+  for( f = verified + 1; f <= limit; f++ ) {
+    if( memcmp( remote_used[ f % NETPLAY_FRAMES ],
+                remote_input[ f % NETPLAY_FRAMES ], NETPLAY_INPUT_LENGTH ) ) {
+      rollback_to( f );
+      break;
+    }
+  }
+
+  if( limit > verified ) verified = limit;
+}
+
+/* Wait while we're too far ahead of the other machine; returns non-zero
+   if netplay has stopped */
+static int
+wait_for_peer( void )
+{
+  while( frame - 1 - remote_confirmed >= rollback ) {
+
+    if( peer_quit ) {
+      netplay_stop( "the other machine has left" );
+      return 1;
+    }
+
+    if( timer_get_time() - last_heard > NETPLAY_TIMEOUT ) {
+      netplay_stop( "lost contact with the other machine" );
+      return 1;
+    }
+
+    if( timer_get_time() - last_sent > NETPLAY_RESEND_INTERVAL )
+      send_input();
+
+    wait_for_packet( 0.005 );
+
+    /* Keep the user interface alive, so Fuse can still be closed */
+    if( !settings_current.headless ) ui_event();
+    if( fuse_exiting ) return 1;
+
+    receive();
+    resync();
+    if( !netplay_active ) return 1;
+  }
+
+  return 0;
+}
+
+void
+netplay_frame( void )
+{
+  if( resimulating ) {
+    frames_run++;
+    return;
+  }
+
+  /* Opened, or made by saving with the tape traps */
+  if( tape_present() ) {
+    netplay_stop( "a tape is now in use" );
+    return;
+  }
+
+  frame++;
+  capture_input( local_input[ ( frame + delay ) % NETPLAY_FRAMES ] );
+  send_input();
+
+  receive();
+  resync();
+  if( !netplay_active || wait_for_peer() ) return;
+
+  /* Without the other machine, there's nothing more to go on than the
+     guesses */
+  if( peer_quit && frame > remote_confirmed ) {
+    netplay_stop( "the other machine has left" );
+    return;
+  }
+
+  record_hash( frame );
+  check_hash();
+
+  save_state( frame );
+  apply_input( frame );
+}
+
+static int
+open_socket( void )
+{
+  struct addrinfo hints, *peer, *local;
+  char *host, *port, local_port[ 16 ];
+  int error;
+
+  host = utils_safe_strdup( settings_current.netplay );
+  port = strrchr( host, ':' );
+  if( !port ) {
+    ui_error( UI_ERROR_ERROR, "Netplay: '%s' should be host:port", host );
+    libspectrum_free( host );
+    return 1;
+  }
+  *port++ = '\0';
+
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  error = getaddrinfo( host, port, &hints, &peer );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "Netplay: couldn't find '%s': %s", host,
+              gai_strerror( error ) );
+    libspectrum_free( host );
+    return 1;
+  }
+
+  /* Listen on the same port as the other machine unless told otherwise */
+  snprintf( local_port, sizeof( local_port ), "%d",
+            settings_current.netplay_port ? settings_current.netplay_port :
+                                            atoi( port ) );
+  libspectrum_free( host );
+
+  hints.ai_family = peer->ai_family;
+  hints.ai_flags = AI_PASSIVE;
+  error = getaddrinfo( NULL, local_port, &hints, &local );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "Netplay: bad port %s: %s", local_port,
+              gai_strerror( error ) );
+    freeaddrinfo( peer );
+    return 1;
+  }
+
+  netplay_socket = socket( peer->ai_family, SOCK_DGRAM, 0 );
+  if( netplay_socket == -1 ||
+      bind( netplay_socket, local->ai_addr, local->ai_addrlen ) ||
+      connect( netplay_socket, peer->ai_addr, peer->ai_addrlen ) ||
+      fcntl( netplay_socket, F_SETFL,
+             fcntl( netplay_socket, F_GETFL ) | O_NONBLOCK ) == -1 ) {
+    ui_error( UI_ERROR_ERROR, "Netplay: couldn't open port %s: %s",
+              local_port, strerror( errno ) );
+    if( netplay_socket != -1 ) close( netplay_socket );
+    netplay_socket = -1;
+    freeaddrinfo( local );
+    freeaddrinfo( peer );
+    return 1;
+  }
+
+  freeaddrinfo( local );
+  freeaddrinfo( peer );
+
+  return 0;
+}
+
+static void
+close_socket( void )
+{
+  long i;
+
+  if( netplay_socket != -1 ) close( netplay_socket );
+  netplay_socket = -1;
+
+  for( i = 0; i < state_count; i++ ) statesave_free( states[i] );
+  libspectrum_free( states ); states = NULL;
+  libspectrum_free( state_frame ); state_frame = NULL;
+  state_count = 0;
+}
+
+int
+netplay_start( void )
+{
+  double start;
+  long i;
+
+  if( rzx_recording || rzx_playback ) {
+    ui_error( UI_ERROR_ERROR,
+              "Netplay can't be used while recording or playing RZX files" );
+    return 1;
+  }
+
+  if( tape_present() ) {
+    ui_error( UI_ERROR_ERROR, "Netplay can't be used with a tape inserted" );
+    return 1;
+  }
+
+  delay = settings_current.netplay_delay;
+  if( delay < 0 ) delay = 0;
+  if( delay > NETPLAY_MAX_DELAY ) delay = NETPLAY_MAX_DELAY;
+
+  rollback = settings_current.netplay_rollback;
+  if( rollback < 1 ) rollback = 1;
+  if( rollback > NETPLAY_MAX_ROLLBACK ) rollback = NETPLAY_MAX_ROLLBACK;
+
+  frame = 0;
+  remote_confirmed = verified = peer_ack = -1;
+  peer_hello = peer_input = peer_quit = 0;
+  peer_hash_frame = last_hash_checked = -1;
+  rollbacks = resimulated = desyncs = 0;
+
+  for( i = 0; i < NETPLAY_FRAMES; i++ ) remote_frame[i] = -1;
+  for( i = 0; i < NETPLAY_HASHES; i++ ) hashes[i].frame = -1;
+
+  /* Nobody presses anything until the first delayed input arrives */
+  for( i = 0; i < delay; i++ ) neutral_input( local_input[i] );
+
+  if( open_socket() ) return 1;
+
+  start_hash = statehash_compute();
+
+  last_sent = 0;
+  start = last_heard = timer_get_time();
+  while( !peer_hello ) {
+    if( timer_get_time() - last_sent > NETPLAY_HELLO_INTERVAL ) send_hello();
+    if( timer_get_time() - start > NETPLAY_HELLO_TIMEOUT ) {
+      ui_error( UI_ERROR_ERROR, "Netplay: no reply from %s",
+                settings_current.netplay );
+      close_socket();
+      return 1;
+    }
+    wait_for_packet( 0.01 );
+    receive();
+  }
+  send_hello();
+
+  if( peer_start_hash != start_hash )
+    ui_error( UI_ERROR_WARNING,
+              "Netplay: the two machines aren't starting from the same "
+              "state, so won't stay in step" );
+
+  /* States for the frames which might still need to be emulated again,
+     plus the current one */
+  state_count = rollback + 2;
+  states = libspectrum_new( statesave_state*, state_count );
+  state_frame = libspectrum_new( long, state_count );
+  for( i = 0; i < state_count; i++ ) {
+    states[i] = statesave_alloc();
+    state_frame[i] = -1;
+  }
+
+  keyboard_latch( 1 );
+  joystick_latch( 1 );
+
+  statehash_set_active( 1 );
+
+  netplay_active = 1;
+  started = 1;
+
+  capture_input( local_input[ delay % NETPLAY_FRAMES ] );
+  send_input();
+
+  record_hash( 0 );
+  save_state( 0 );
+  apply_input( 0 );
+
+  return 0;
+}
+
+static void
+netplay_stop( const char *reason )
+{
+  if( !netplay_active ) return;
+
+  if( reason ) ui_error( UI_ERROR_INFO, "Netplay stopped: %s", reason );
+
+  send_quit();
+
+  netplay_active = 0;
+  statehash_set_active( 0 );
+  keyboard_latch( 0 );
+  joystick_latch( 0 );
+}
+
+/* Swap the last of the input so both machines finish in the same state */
+static void
+settle( void )
+{
+  double start = timer_get_time();
+
+  while( timer_get_time() - start < NETPLAY_SETTLE_TIMEOUT ) {
+    receive();
+    if( remote_confirmed >= frame - 1 &&
+        ( peer_ack >= frame - 1 || peer_quit ) ) break;
+    if( timer_get_time() - last_sent > NETPLAY_RESEND_INTERVAL )
+      send_input();
+    wait_for_packet( 0.005 );
+  }
+
+  resync();
+}
+
+static void
+netplay_end( void )
+{
+  libspectrum_qword hash;
+
+  if( netplay_active ) {
+    settle();
+
+    if( settings_current.headless ) {
+      hash = statehash_compute();
+      printf( "netplay: %ld frames, %lu rollbacks, %lu frames emulated "
+              "again, %lu hash mismatches, state hash %016" PRIx64 "%s\n",
+              frame, rollbacks, resimulated, desyncs, hash,
+              verified >= frame - 1 ? "" : " (unconfirmed)" );
+    }
+
+    netplay_stop( NULL );
+  }
+
+  if( started ) close_socket();
+}
+
+#else				/* #ifdef BUILD_NETPLAY */
+
+int
+netplay_start( void )
+{
+  ui_error( UI_ERROR_ERROR, "Netplay isn't supported on this platform" );
+  return 1;
+}
+
+void
+netplay_frame( void )
+{
+}
+
+static void
+netplay_end( void )
+{
+}
+
+#endif				/* #ifdef BUILD_NETPLAY */
+
+void
+netplay_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_DISPLAY,
+    STARTUP_MANAGER_MODULE_EVENT,
+    STARTUP_MANAGER_MODULE_MACHINE,
+    STARTUP_MANAGER_MODULE_MEMORY,
+    STARTUP_MANAGER_MODULE_SOUND,
+    STARTUP_MANAGER_MODULE_SPECTRUM,
+    STARTUP_MANAGER_MODULE_STATEHASH,
+    STARTUP_MANAGER_MODULE_TIMER,
+    STARTUP_MANAGER_MODULE_Z80,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_NETPLAY, dependencies,
+                            ARRAY_SIZE( dependencies ), NULL, NULL,
+                            netplay_end );
+}
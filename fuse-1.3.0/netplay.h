@@ -0,0 +1,38 @@
+/* netplay.h: Two machines kept in step over the network
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_NETPLAY_H
+#define FUSE_NETPLAY_H
+
+extern int netplay_active;
+
+void netplay_register_startup( void );
+
+/* Wait for the peer given by `settings_current.netplay' and start playing
+   from the current machine state, which should be the same on both sides */
+int netplay_start( void );
+
+/* Called at the end of every frame while netplay is active */
+void netplay_frame( void );
+
+#endif			/* #ifndef FUSE_NETPLAY_H */
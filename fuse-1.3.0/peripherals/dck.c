@@ -41,6 +41,7 @@
 #include "memory.h"
 #include "settings.h"
 #include "scld.h"
+#include "statehash.h"
 #include "ui/ui.h"
 #include "utils.h"
 #include "debugger/debugger.h"
@@ -180,6 +181,7 @@ dck_reset( void )
               memset( page->page, 0, MEMORY_PAGE_SIZE );
             }
           }
+          statehash_invalidate();
         } else {
           data = memory_pool_allocate( 0x2000 );
           if( dck->dck[num_block]->access[i] == LIBSPECTRUM_DCK_PAGE_RAM ) {
@@ -103,6 +103,29 @@ typedef struct buffer_t {		/* to store buffer data */
   size_t index;
 } buffer_t;
 
+/* Plain sector images (TRD, MGT, IMG...) are generated track by track
+   when a track is first used, instead of all at once when opened. The
+   image file stays mapped until every track has been generated */
+typedef enum disk_lazy_order_t {
+  DISK_LAZY_CYLINDERS,		/* cyl 0 side 0, cyl 0 side 1, cyl 1 ... */
+  DISK_LAZY_SIDES,		/* side 0 cyl 0, side 0 cyl 1, ... */
+} disk_lazy_order_t;
+
+typedef struct disk_lazy_t {
+  utils_file file;			/* the mapped image file */
+  size_t offset;			/* start of the first track */
+  disk_lazy_order_t order;
+  int sector_base, sectors, seclen, preindex, gap, interleave, autofill;
+  libspectrum_byte *pending;		/* 1 for each track not generated yet */
+  int pending_count;
+} disk_lazy_t;
+
+static int
+disk_lazy_pending( disk_t *d, int idx )
+{
+  return d->lazy && d->lazy->pending[ idx ];
+}
+
 void disk_update_tlens( disk_t *d );
 
 const char *
@@ -323,6 +346,8 @@ update_tracks_mode( disk_t *d )
   int mfm, fm, weak;
 
   for( i = 0; i < d->cylinders * d->sides; i++ ) {
+    if( disk_lazy_pending( d, i ) )		/* set when generated */
+      continue;
     DISK_SET_TRACK_IDX( d, i );
     mfm = 0, fm = 0, weak = 0;
     bpt = d->track[-3] + 256 * d->track[-2];
@@ -688,14 +713,133 @@ trackgen( disk_t *d, buffer_t *buffer, int head, int track,
   return gap4_add( d, gap );
 }
 
+static void
+disk_lazy_free( disk_t *d )
+{
+  disk_lazy_t *l = d->lazy;
+
+  if( l == NULL )
+    return;
+
+  utils_unmap_file( &l->file );
+  libspectrum_free( l->pending );
+  libspectrum_free( l );
+  d->lazy = NULL;
+}
+
+static int
+disk_lazy_generate( disk_t *d, int idx )
+{
+  disk_lazy_t *l = d->lazy;
+  disk_position_context_t context;
+  buffer_t buffer;
+  size_t track_len;
+  int head, cyl, error;
+
+  l->pending[ idx ] = 0;
+
+  head = idx % d->sides;
+  cyl = idx / d->sides;
+  track_len = l->sectors * l->seclen;
+
+  buffer.file = l->file;
+  buffer.index = l->offset + track_len *
+    ( l->order == DISK_LAZY_CYLINDERS ? idx : head * d->cylinders + cyl );
+  if( buffer.index > buffer.file.length )
+    buffer.index = buffer.file.length;
+
+  /* trackgen() moves the head, but whoever asked for the track doesn't
+     expect that */
+  position_context_save( d, &context );
+  error = trackgen( d, &buffer, head, cyl, l->sector_base, l->sectors,
+                    l->seclen, l->preindex, l->gap, l->interleave,
+                    l->autofill );
+  d->track[-3] = d->bpt & 0xff;
+  d->track[-2] = ( d->bpt >> 8 ) & 0xff;
+  d->track[-1] = 0x00;				/* MFM, no weak data */
+  position_context_restore( d, &context );
+
+  if( --l->pending_count == 0 )
+    disk_lazy_free( d );
+
+  return error;
+}
+
+void
+disk_lazy_track( disk_t *d, int idx )
+{
+  if( idx >= 0 && idx < d->sides * d->cylinders && d->lazy->pending[ idx ] )
+    disk_lazy_generate( d, idx );
+}
+
+/* generate all the tracks still pending */
+static void
+disk_lazy_all( disk_t *d )
+{
+  int i;
+
+  for( i = 0; d->lazy && i < d->sides * d->cylinders; i++ )
+    disk_lazy_track( d, i );
+}
+
+/* Set up the generation of a plain sector image on demand. The first
+   track is generated straight away, so a geometry that doesn't fit on a
+   track is still reported when the image is opened */
+static int
+disk_lazy_open( buffer_t *buffer, disk_t *d, size_t offset,
+                disk_lazy_order_t order, int sector_base, int sectors,
+                int seclen, int preindex, int gap, int interleave,
+                int autofill )
+{
+  disk_lazy_t *l;
+  int tracks = d->sides * d->cylinders;
+
+  if( autofill < 0 &&
+      buffer->file.length < offset + (size_t)tracks * sectors * seclen )
+    return d->status = DISK_GEOM;
+
+  l = libspectrum_new( disk_lazy_t, 1 );
+  l->file = buffer->file;
+  l->offset = offset;
+  l->order = order;
+  l->sector_base = sector_base;
+  l->sectors = sectors;
+  l->seclen = seclen;
+  l->preindex = preindex;
+  l->gap = gap;
+  l->interleave = interleave;
+  l->autofill = autofill;
+  l->pending = libspectrum_new( libspectrum_byte, tracks );
+  memset( l->pending, 1, tracks );
+  l->pending_count = tracks;
+
+  /* the file now belongs to the disk */
+  buffer->file.buffer = NULL;
+  buffer->file.length = 0;
+  buffer->file.mapped = 0;
+  d->lazy = l;
+
+  if( disk_lazy_generate( d, 0 ) ) {
+    disk_lazy_free( d );
+    return d->status = DISK_GEOM;
+  }
+
+  return d->status = DISK_OK;
+}
+
 /* close and destroy a disk structure and data */
 void
 disk_close( disk_t *d )
 {
+  disk_lazy_free( d );
   if( d->data != NULL ) {
     libspectrum_free( d->data );
     d->data = NULL;
   }
+  if( d->dirty_tracks != NULL ) {
+    libspectrum_free( d->dirty_tracks );
+    d->dirty_tracks = NULL;
+  }
   if( d->filename != NULL ) {
     libspectrum_free( d->filename );
     d->filename = NULL;
@@ -745,6 +889,8 @@ disk_alloc( disk_t *d )
   if( dlen == 0 ) return d->status = DISK_GEOM;
 
   d->data = libspectrum_new0( libspectrum_byte, dlen );
+  d->dirty_tracks = libspectrum_new0( libspectrum_byte,
+                                      d->sides * d->cylinders );
 
   return d->status = DISK_OK;
 }
@@ -762,6 +908,8 @@ disk_new( disk_t *d, int sides, int cylinders,
     return d->status = DISK_GEOM;
 
   d->type = type;
+  d->open_type = DISK_TYPE_NONE;
+  d->lazy = NULL;
   d->density = density == DISK_DENS_AUTO ? DISK_DD : density;
   d->sides = sides;
   d->cylinders = cylinders;
@@ -1111,7 +1259,7 @@ open_udi( buffer_t *buffer, disk_t *d )
 static int
 open_img_mgt_opd( buffer_t *buffer, disk_t *d )
 {
-  int i, j, sectors, seclen;
+  int sectors, seclen;
 
   buffer->index = 0;
 
@@ -1144,32 +1292,23 @@ open_img_mgt_opd( buffer_t *buffer, disk_t *d )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  if( d->type == DISK_IMG ) {	/* IMG out-out */
-    for( j = 0; j < d->sides; j++ ) {
-      for( i = 0; i < d->cylinders; i++ ) {
-	if( trackgen( d, buffer, j, i, 1, sectors, seclen,
-		      NO_PREINDEX, GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL ) )
-	  return d->status = DISK_GEOM;
-      }
-    }
-  } else {			/* MGT / OPD alt */
-    for( i = 0; i < d->cylinders; i++ ) {
-      for( j = 0; j < d->sides; j++ ) {
-        if( trackgen( d, buffer, j, i, d->type == DISK_MGT ? 1 : 0, sectors, seclen,
-		      NO_PREINDEX, GAP_MGT_PLUSD,
-		      d->type == DISK_MGT ? NO_INTERLEAVE : INTERLEAVE_OPUS, NO_AUTOFILL ) )
-	  return d->status = DISK_GEOM;
-      }
-    }
-  }
-
-  return d->status = DISK_OK;
+  if( d->type == DISK_IMG )	/* IMG out-out */
+    return disk_lazy_open( buffer, d, 0, DISK_LAZY_SIDES, 1, sectors, seclen,
+			   NO_PREINDEX, GAP_MGT_PLUSD, NO_INTERLEAVE,
+			   NO_AUTOFILL );
+
+  /* MGT / OPD alt */
+  return disk_lazy_open( buffer, d, 0, DISK_LAZY_CYLINDERS,
+			 d->type == DISK_MGT ? 1 : 0, sectors, seclen,
+			 NO_PREINDEX, GAP_MGT_PLUSD,
+			 d->type == DISK_MGT ? NO_INTERLEAVE : INTERLEAVE_OPUS,
+			 NO_AUTOFILL );
 }
 
 static int
 open_d40_d80( buffer_t *buffer, disk_t *d )
 {
-  int i, j, sectors, seclen;
+  int sectors, seclen;
 
   if( buffavail( buffer ) < 180 )
     return d->status = DISK_OPEN;
@@ -1191,21 +1330,15 @@ open_d40_d80( buffer_t *buffer, disk_t *d )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  for( i = 0; i < d->cylinders; i++ ) {
-      for( j = 0; j < d->sides; j++ ) {
-        if( trackgen( d, buffer, j, i, 1, sectors, seclen,
-		      NO_PREINDEX, GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL ) )
-	  return d->status = DISK_GEOM;
-      }
-  }
-
-  return d->status = DISK_OK;
+  return disk_lazy_open( buffer, d, 0, DISK_LAZY_CYLINDERS, 1, sectors, seclen,
+			 NO_PREINDEX, GAP_MGT_PLUSD, NO_INTERLEAVE,
+			 NO_AUTOFILL );
 }
 
 static int
 open_sad( buffer_t *buffer, disk_t *d, int preindex )
 {
-  int i, j, sectors, seclen;
+  int sectors, seclen;
 
   d->sides = buff[18];
   d->cylinders = buff[19];
@@ -1219,15 +1352,8 @@ open_sad( buffer_t *buffer, disk_t *d, int preindex )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  for( j = 0; j < d->sides; j++ ) {
-    for( i = 0; i < d->cylinders; i++ ) {
-      if( trackgen( d, buffer, j, i, 1, sectors, seclen, preindex, 
-		    GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL ) )
-	return d->status = DISK_GEOM;
-    }
-  }
-
-  return d->status = DISK_OK;
+  return disk_lazy_open( buffer, d, 22, DISK_LAZY_SIDES, 1, sectors, seclen,
+			 preindex, GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL );
 }
 
 /* 1 RANDOMIZE USR 15619: REM : RUN "        " */
@@ -1299,6 +1425,7 @@ trdos_insert_basic_file( disk_t *d, trdos_spec_t *spec,
     d->i += len_pre_dam;
     data_add( d, NULL, head, 256, NO_DDAM, GAP_TRDOS, CRC_OK, NO_AUTOFILL,
               NULL );
+    DISK_SET_DIRTY( d );
 
     /* Next sector */
     s = ( s + 1 ) % 16;
@@ -1331,6 +1458,7 @@ trdos_insert_basic_file( disk_t *d, trdos_spec_t *spec,
 
   d->i += len_pre_dam;
   data_add( d, NULL, head, 256, NO_DDAM, GAP_TRDOS, CRC_OK, NO_AUTOFILL, NULL );
+  DISK_SET_DIRTY( d );
 
   /* Write specification sector */
   spec->file_count       += 1;
@@ -1398,7 +1526,7 @@ trdos_insert_boot_loader( disk_t *d )
 static int
 open_trd( buffer_t *buffer, disk_t *d )
 {
-  int i, j, sectors, seclen;
+  int i, sectors, seclen;
   disk_position_context_t context;
 
   if( buffseek( buffer, 8*256, SEEK_CUR ) == -1 )
@@ -1426,14 +1554,9 @@ open_trd( buffer_t *buffer, disk_t *d )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  buffer->index = 0;
-  for( i = 0; i < d->cylinders; i++ ) {
-    for( j = 0; j < d->sides; j++ ) {
-      if( trackgen( d, buffer, j, i, 1, sectors, seclen,
-                    NO_PREINDEX, GAP_TRDOS, INTERLEAVE_2, 0x00 ) )
-        return d->status = DISK_GEOM;
-    }
-  }
+  if( disk_lazy_open( buffer, d, 0, DISK_LAZY_CYLINDERS, 1, sectors, seclen,
+                      NO_PREINDEX, GAP_TRDOS, INTERLEAVE_2, 0x00 ) )
+    return d->status;
   
   if( settings_current.auto_load ) {
     position_context_save( d, &context );
@@ -2062,6 +2185,8 @@ disk_update_tlens( disk_t *d )
   int i;
 
   for( i = 0; i < d->sides * d->cylinders; i++ ) {	/* check tracks */
+    if( disk_lazy_pending( d, i ) )		/* set when generated */
+      continue;
     DISK_SET_TRACK_IDX( d, i );
     if( d->track[-3] + 256 * d->track[-2] == 0 ) {
       d->track[-3] = d->bpt & 0xff;
@@ -2089,14 +2214,17 @@ disk_open2( disk_t *d, const char *filename, int preindex )
     d->wrprot = 0;
 #endif			/* #ifdef GEKKO */
 
-  if( utils_read_file( filename, &buffer.file ) )
+  if( utils_map_file( filename, &buffer.file ) )
     return d->status = DISK_OPEN;
 
   buffer.index = 0;
 
   error = libspectrum_identify_file_raw( &type, filename,
 					 buffer.file.buffer, buffer.file.length );
-  if( error ) return d->status = DISK_OPEN;
+  if( error ) {
+    utils_unmap_file( &buffer.file );
+    return d->status = DISK_OPEN;
+  }
   d->type = DISK_TYPE_NONE;
   switch ( type ) {
   case LIBSPECTRUM_ID_DISK_UDI:
@@ -2142,20 +2270,26 @@ disk_open2( disk_t *d, const char *filename, int preindex )
     open_d40_d80( &buffer, d );
     break;
   default:
-    utils_close_file( &buffer.file );
+    utils_unmap_file( &buffer.file );
     return d->status = DISK_OPEN;
   }
   if( d->status != DISK_OK ) {
+    disk_lazy_free( d );
     if( d->data != NULL )
       libspectrum_free( d->data );
-    utils_close_file( &buffer.file );
+    if( d->dirty_tracks != NULL ) {
+      libspectrum_free( d->dirty_tracks );
+      d->dirty_tracks = NULL;
+    }
+    utils_unmap_file( &buffer.file );
     return d->status;
   }
-  utils_close_file( &buffer.file );
+  utils_unmap_file( &buffer.file );
   d->dirty = 0;
   disk_update_tlens( d );
   update_tracks_mode( d );
   d->filename = utils_safe_strdup( filename );
+  d->open_type = d->type;
   return d->status = DISK_OK;
 }
 
@@ -2184,6 +2318,8 @@ disk_merge_sides( disk_t *d, disk_t *d1, disk_t *d2, int autofill )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
+  disk_lazy_all( d1 );
+  disk_lazy_all( d2 );
   clen = DISK_CLEN( d->bpt );
   d->track = d->data;
   d1->track = d1->data;
@@ -2226,6 +2362,9 @@ disk_open( disk_t *d, const char *filename, int preindex, int merge_disks )
   disk_t d1, d2;
 
   d->filename = NULL;
+  d->lazy = NULL;
+  d->dirty_tracks = NULL;
+  d->open_type = DISK_TYPE_NONE;
   if( filename == NULL || *filename == '\0' )
     return d->status = DISK_OPEN;
 
@@ -2263,8 +2402,8 @@ disk_open( disk_t *d, const char *filename, int preindex, int merge_disks )
   }
   if( g != 4 )
     return d->status = disk_open2( d, filename, preindex );
-  d1.data = NULL; d1.flag = d->flag;
-  d2.data = NULL; d2.flag = d->flag;
+  memset( &d1, 0, sizeof( d1 ) ); d1.flag = d->flag;
+  memset( &d2, 0, sizeof( d2 ) ); d2.flag = d->flag;
   filename2 = utils_safe_strdup( filename );
   *(filename2 + pos) = c;
 
@@ -2819,6 +2958,90 @@ write_log( FILE *file, disk_t *d )
   return d->status = DISK_OK;
 }
 
+/* Write the changed tracks of a plain sector image back over the file it
+   was opened from, in place and in the format it was opened as (the UI
+   picks the format for a full write from the extension, which maps a raw
+   .dsk to CPC). Returns 1 if the whole image has to be written instead */
+static int
+write_dirty_tracks( disk_t *d, const char *filename )
+{
+  FILE *file;
+  off_t offset, length, track_len;
+  int i, head, cyl, sbase, sectors, seclen, mfm, tsbase, tsectors, tseclen;
+  disk_lazy_order_t order = DISK_LAZY_CYLINDERS;
+
+  if( d->dirty_tracks == NULL || d->filename == NULL ||
+      strcmp( filename, d->filename ) )
+    return 1;
+
+  if( guess_track_geom( d, 0, 0, &sbase, &sectors, &seclen, &mfm ) ||
+      sbase == -1 )
+    return 1;
+
+  offset = 0;
+  switch( d->open_type ) {
+  case DISK_TRD:
+    if( sbase != 1 || seclen != 1 || sectors != 16 ) return 1;
+    break;
+  case DISK_IMG:
+    order = DISK_LAZY_SIDES;
+    /* fall through */
+  case DISK_MGT:
+    if( sbase != 1 || seclen != 2 || sectors != 10 ) return 1;
+    break;
+  case DISK_OPD:
+    if( sbase != 0 || seclen != 1 || sectors != 18 ) return 1;
+    break;
+  case DISK_SAD:
+    order = DISK_LAZY_SIDES;
+    offset = 22;
+    /* fall through */
+  case DISK_D40:
+  case DISK_D80:
+    if( sbase != 1 ) return 1;
+    break;
+  default:
+    return 1;
+  }
+
+  if( ( file = fopen( filename, "r+b" ) ) == NULL )
+    return 1;
+
+  /* the file must hold exactly this geometry */
+  track_len = sectors * ( 0x80 << seclen );
+  if( fseeko( file, 0, SEEK_END ) ||
+      ( length = ftello( file ) ) != offset +
+        (off_t)d->sides * d->cylinders * track_len ) {
+    fclose( file );
+    return 1;
+  }
+
+  for( i = 0; i < d->sides * d->cylinders; i++ ) {
+    if( !d->dirty_tracks[i] )
+      continue;
+    head = i % d->sides;
+    cyl = i / d->sides;
+    if( guess_track_geom( d, head, cyl, &tsbase, &tsectors, &tseclen, &mfm ) ||
+        tsbase != sbase || tsectors != sectors || tseclen != seclen ) {
+      fclose( file );		/* reformatted, write the whole image */
+      return 1;
+    }
+    if( fseeko( file, offset + track_len * ( order == DISK_LAZY_CYLINDERS ?
+                                             i : head * d->cylinders + cyl ),
+                SEEK_SET ) ||
+        savetrack( d, file, head, cyl, sbase, sectors, seclen ) ) {
+      fclose( file );
+      return 1;
+    }
+  }
+
+  if( fclose( file ) == -1 )
+    return 1;
+
+  memset( d->dirty_tracks, 0, d->sides * d->cylinders );
+  return 0;
+}
+
 int
 disk_write( disk_t *d, const char *filename )
 {
@@ -2828,9 +3051,6 @@ disk_write( disk_t *d, const char *filename )
   libspectrum_byte *t, *c, *f, *w;
   int idx;
 
-  if( ( file = fopen( filename, "wb" ) ) == NULL )
-    return d->status = DISK_WRFILE;
-
   namelen = strlen( filename );
   if( namelen < 4 )
     ext = "";
@@ -2875,6 +3095,27 @@ disk_write( disk_t *d, const char *filename )
   w = d->weak;
   idx = d->i;
 
+  if( !write_dirty_tracks( d, filename ) ) {
+    d->track = t;
+    d->clocks = c;
+    d->fm = f;
+    d->weak = w;
+    d->i = idx;
+    return d->status = DISK_OK;
+  }
+
+  /* the image may be written back over the file it was opened from */
+  disk_lazy_all( d );
+
+  if( ( file = fopen( filename, "wb" ) ) == NULL ) {
+    d->track = t;
+    d->clocks = c;
+    d->fm = f;
+    d->weak = w;
+    d->i = idx;
+    return d->status = DISK_WRFILE;
+  }
+
   update_tracks_mode( d );
   switch( d->type ) {
   case DISK_UDI:
@@ -2928,5 +3169,7 @@ disk_write( disk_t *d, const char *filename )
   if( fclose( file ) == -1 )
     return d->status = DISK_WRFILE;
 
+  if( d->dirty_tracks != NULL )
+    memset( d->dirty_tracks, 0, d->sides * d->cylinders );
   return d->status = DISK_OK;
 }
@@ -95,6 +95,7 @@ typedef struct disk_t {
   int bpt;		/* bytes per track */
   int wrprot;		/* disk write protect */
   int dirty;		/* disk changed */
+  libspectrum_byte *dirty_tracks;	/* tracks changed since opened or saved */
   int have_weak;	/* disk contain weak sectors */
   unsigned int flag;
   disk_error_t status;		/* last error code */
@@ -107,7 +108,9 @@ typedef struct disk_t {
   libspectrum_byte *weak;	/* weak marks bits/weak data */
   int i;			/* index for track and clocks */
   disk_type_t type;		/* DISK_UDI, ... */
+  disk_type_t open_type;	/* format of the file it was opened from */
   disk_dens_t density;		/* DISK_SD DISK_DD, or DISK_HD */
+  struct disk_lazy_t *lazy;	/* tracks not yet generated from the image */
 } disk_t;
 
 /* every track data:
@@ -122,6 +125,7 @@ TRACK_LEN TYPE TRACK......DATA CLOCK..MARKS MF..MARKS WEAK..MARKS
 #define DISK_CLEN( bpt ) ( ( bpt ) / 8 + ( ( bpt ) % 8 ? 1 : 0 ) )
 
 #define DISK_SET_TRACK_IDX( d, idx ) \
+   if( d->lazy ) disk_lazy_track( d, idx ); \
    d->track = d->data + 3 + ( idx ) * d->tlen; \
    d->clocks = d->track  + d->bpt; \
    d->fm     = d->clocks + DISK_CLEN( d->bpt ); \
@@ -130,6 +134,11 @@ TRACK_LEN TYPE TRACK......DATA CLOCK..MARKS MF..MARKS WEAK..MARKS
 #define DISK_SET_TRACK( d, head, cyl ) \
    DISK_SET_TRACK_IDX( (d), (d)->sides * cyl + head )
 
+/* mark the current track as changed */
+#define DISK_SET_DIRTY( d ) \
+   (d)->dirty = 1; \
+   (d)->dirty_tracks[ ( (d)->track - (d)->data - 3 ) / (d)->tlen ] = 1
+
 typedef struct disk_position_context_t {
   libspectrum_byte *track;   /* current track data bytes */
   libspectrum_byte *clocks;  /* clock marks bits */
@@ -139,6 +148,8 @@ typedef struct disk_position_context_t {
 } disk_position_context_t;
 
 const char *disk_strerror( int error );
+/* generate a track of a lazily opened disk image, if not done yet */
+void disk_lazy_track( disk_t *d, int idx );
 /* create an unformatted disk sides -> (1/2) cylinders -> track/side,
    dens -> 'density' related to unformatted length of a track (SD = 3125,
    DD = 6250, HD = 12500, type -> if write this disk we want to convert
@@ -158,7 +169,8 @@ int disk_merge_sides( disk_t *d, disk_t *d1, disk_t *d2, int autofill );
 /* write a disk image file (from the disk buffer). the d->type
    gives the format of file. if it DISK_TYPE_AUTO, disk_write
    try to guess from the file name (extension). if fail save as
-   UDI.
+   UDI. a plain sector image written over the file it was opened
+   from only has the changed tracks written.
 */
 int disk_write( disk_t *d, const char *filename );
 /* format disk to plus3 accept for formatting
@@ -125,6 +125,9 @@ fdd_set_data( fdd_t *d, int fact )
   if( !d->loaded )
     return;
 
+  d->c_indexed = 0;
+  d->c_plain_start = d->c_plain_end = 0;
+
   if( d->unreadable || ( d->disk.sides == 1 && head == 1 ) ||
       d->c_cylinder >= d->disk.cylinders ) {
     d->disk.track = NULL;
@@ -343,6 +346,71 @@ fdd_step( fdd_t *d, fdd_dir_t direction )
   if( d->loaded && d->selected ) d->dskchg = 1;
 }
 
+/* find the marked bytes of the current track */
+static void
+fdd_index_track( fdd_t *d )
+{
+  int i, bit, fm, marks;
+
+  d->c_indexed = 1;
+  d->c_marks_count = -1;
+
+  /* a track mixing FM and MFM bytes needs the bitmap on every read */
+  fm = bitmap_test( d->disk.fm, 0 ) ? 0xff : 0x00;
+  for( i = 0; i < d->c_bpt / 8; i++ )
+    if( d->disk.fm[i] != fm )
+      return;
+  for( i = d->c_bpt & ~7; i < d->c_bpt; i++ )
+    if( ( bitmap_test( d->disk.fm, i ) ? 0xff : 0x00 ) != fm )
+      return;
+
+  d->c_fm = fm & 0x01;
+  d->c_marks_count = 0;
+  for( i = 0; i < DISK_CLEN( d->c_bpt ); i++ ) {
+    marks = d->disk.clocks[i] | d->disk.weak[i];
+    for( bit = 0; marks && bit < 8; bit++, marks >>= 1 ) {
+      if( !( marks & 0x01 ) || i * 8 + bit >= d->c_bpt )
+        continue;
+      if( d->c_marks_count == FDD_MARKS_MAX ) {
+        d->c_marks_count = -1;
+        return;
+      }
+      d->c_marks[ d->c_marks_count++ ] = i * 8 + bit;
+    }
+  }
+}
+
+/* position of the first marked byte at or after pos, or the end of track */
+static int
+fdd_next_mark( fdd_t *d, int pos )
+{
+  int lo = 0, hi = d->c_marks_count, mid;
+
+  while( lo < hi ) {
+    mid = ( lo + hi ) / 2;
+    if( d->c_marks[ mid ] < pos )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < d->c_marks_count ? d->c_marks[ lo ] : d->c_bpt;
+}
+
+/* find the run of plain data bytes starting at pos */
+static void
+fdd_set_plain( fdd_t *d, int pos )
+{
+  if( !d->c_indexed )
+    fdd_index_track( d );
+
+  if( d->c_marks_count < 0 ) {
+    d->c_plain_start = d->c_plain_end = 0;
+    return;
+  }
+  d->c_plain_start = pos;
+  d->c_plain_end = fdd_next_mark( d, pos );
+}
+
 /* read/write next byte from/to sector */
 static int
 fdd_read_write_data( fdd_t *d, fdd_write_t write )
@@ -387,7 +455,13 @@ fdd_read_write_data( fdd_t *d, fdd_write_t write )
 #else
     bitmap_reset( d->disk.weak, d->disk.i );
 #endif
-    d->disk.dirty = 1;
+    DISK_SET_DIRTY( &d->disk );
+    d->c_indexed = 0;
+    d->c_plain_start = d->c_plain_end = 0;
+  } else if( d->disk.i >= d->c_plain_start &&
+             d->disk.i < d->c_plain_end ) {	/* read plain data */
+    d->data = d->disk.track[ d->disk.i ];
+    d->marks = d->c_fm;
   } else {	/* read */
     d->data = d->disk.track[ d->disk.i ];
     if( bitmap_test( d->disk.clocks, d->disk.i ) )
@@ -400,6 +474,7 @@ fdd_read_write_data( fdd_t *d, fdd_write_t write )
       /* mess up data byte */
       d->data &= rand() % 0xff, d->data |= rand() % 0xff;
     }
+    fdd_set_plain( d, d->disk.i + 1 );
   }
   d->disk.i++;
   d->index = d->disk.i >= d->c_bpt ? 1 : 0;
@@ -421,6 +496,35 @@ fdd_write_data( fdd_t *d )
   return fdd_read_write_data( d, FDD_WRITE );
 }
 
+int
+fdd_skip_to_mark( fdd_t *d )
+{
+  int next, skip;
+
+  if( !d->selected || !d->ready || !d->loadhead || d->disk.track == NULL )
+    return 0;
+
+  if( d->disk.i >= d->c_bpt )
+    d->disk.i = 0;
+  if( !d->c_indexed )
+    fdd_index_track( d );
+  if( d->c_marks_count < 0 )
+    return 0;
+
+  /* the byte under the index hole is left to fdd_read_data(), so the
+     controller still sees the index pulse */
+  next = fdd_next_mark( d, d->disk.i );
+  if( next > d->c_bpt - 1 )
+    next = d->c_bpt - 1;
+  skip = next - d->disk.i;
+  if( skip <= 0 )
+    return 0;
+
+  d->disk.i = next;
+  d->index = 0;
+  return skip;
+}
+
 void fdd_flip( fdd_t *d, int upsidedown )
 {
   if( !d->loaded )
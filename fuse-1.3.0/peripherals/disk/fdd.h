@@ -72,6 +72,8 @@ typedef enum fdd_dir_t {
   FDD_STEP_IN = 1,
 } fdd_dir_t;
 
+#define FDD_MARKS_MAX 512	/* marked bytes indexed per track */
+
 typedef struct fdd_t {
   fdd_type_t type;	/* fdd type: Shugart or IBMPC */
   int auto_geom;	/* change geometry according to loading disk */
@@ -109,6 +111,17 @@ typedef struct fdd_t {
   int motoron;		/* motor on */
   int loadhead;		/* head loaded */
   int index_pulse;	/* 'second' index hole, for index status */
+
+/* Index of the current track: the positions of every byte recorded with
+   a clock mark or weak data, in ascending order. Only those bytes can
+   start an address mark or need the bitmaps on read; the runs of plain
+   data between them are read straight from the track */
+  int c_indexed;	/* index is up to date with the track */
+  int c_marks_count;	/* number of marks, -1 if the track can't be indexed */
+  int c_marks[ FDD_MARKS_MAX ];
+  int c_fm;		/* FM bit shared by every byte of the track */
+  int c_plain_start;	/* current run of plain data bytes */
+  int c_plain_end;
 } fdd_t;
 
 typedef struct fdd_params_t {
@@ -151,6 +164,11 @@ int fdd_read_data( fdd_t *d );
    d->idx is set if we reach the 'index hole'.
 */
 int fdd_write_data( fdd_t *d );
+/* Skip the plain data bytes up to the next byte recorded with a clock mark
+   or weak data, as if they had been read and ignored, but never past the
+   index hole. Returns the number of bytes skipped.
+*/
+int fdd_skip_to_mark( fdd_t *d );
 /* set write protect status on loaded disk */
 void fdd_wrprot( fdd_t *d, int wrprot );
 /* to reach index hole */
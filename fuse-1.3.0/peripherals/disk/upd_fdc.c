@@ -187,6 +187,7 @@ read_id( upd_fdc *f )
   f->id_mark = UPD_FDC_AM_NONE;
   i = f->rev;
   while( i == f->rev && d->ready ) {
+    fdd_skip_to_mark( d );		/* gap bytes can't start a mark */
     fdd_read_data( d ); if( d->index ) f->rev--;
     crc_preset( f );
     if( f->mf ) {	/* double density (MFM) */
@@ -226,6 +226,7 @@ read_id( wd_fdc *f )
     return 1;
 
   while( i == f->rev ) { /* **FIXME d->motoron? */
+    fdd_skip_to_mark( d );		/* gap bytes can't start a mark */
     crc_preset( f );
     if( f->dden ) {	/* double density (MFM) */
       fdd_read_data( d );
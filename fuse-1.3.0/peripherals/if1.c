@@ -26,6 +26,7 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -43,6 +44,8 @@
 #include "module.h"
 #include "periph.h"
 #include "settings.h"
+#include "sound.h"
+#include "timer/timer.h"
 #include "utils.h"
 #include "ui/ui.h"
 #include "unittests/unittests.h"
@@ -75,6 +78,7 @@ typedef struct microdrive_t {
   int transfered;
   int max_bytes;
   libspectrum_byte pream[512];	/* preamble/sync area written */
+  libspectrum_byte dirty[256];	/* blocks changed since the last save */
   libspectrum_byte last;
   libspectrum_byte gap;
   libspectrum_byte sync;
@@ -175,6 +179,7 @@ static if1_ula_t if1_ula;
 
 static void microdrives_reset( void );
 static void microdrives_restart( void );
+static void microdrives_set_status( int running );
 static void increment_head( int m );
 
 #define MDR_IN(m) microdrive[m - 1].inserted
@@ -415,6 +420,8 @@ if1_reset( int hard_reset GCC_UNUSED )
   }
 
   machine_current->ram.romcs = 0;
+
+  microdrives_set_status( 0 );
   
   if1_ula.cts = 2;		/* force to emit first out if raw */
   if1_ula.comms_clk = 0;
@@ -528,9 +535,9 @@ microdrives_reset( void )
     microdrive[m].sync     = 15;
     microdrive[m].transfered = 0;
   }
+  microdrives_set_status( 0 );
   ui_statusbar_update( UI_STATUSBAR_ITEM_MICRODRIVE,
 		       UI_STATUSBAR_STATE_INACTIVE );
-  if1_mdr_status = 0;
 /*
   if1_ula.comms_data = 0;
   if1_ula.count_in = 0;
@@ -831,6 +838,7 @@ port_mdr_out( libspectrum_byte val )
  
 	libspectrum_microdrive_set_data( mdr->cartridge, mdr->head_pos,
  					 val );
+	mdr->dirty[ mdr->head_pos / LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ] = 1;
  	increment_head( m );
 	mdr->modified = 1;
       }
@@ -852,20 +860,10 @@ port_ctr_out( libspectrum_byte val )
     }
     microdrive[0].motor_on = (val & 0x01) ? 0 : 1;
 
-    if( microdrive[0].motor_on || microdrive[1].motor_on || 
-	microdrive[2].motor_on || microdrive[3].motor_on ||
-	microdrive[4].motor_on || microdrive[5].motor_on ||
-	microdrive[6].motor_on || microdrive[7].motor_on ) {
-      if( !if1_mdr_status ) {
-	ui_statusbar_update( UI_STATUSBAR_ITEM_MICRODRIVE,
-	                     UI_STATUSBAR_STATE_ACTIVE );
-	if1_mdr_status = 1;
-      }
-    } else if ( if1_mdr_status ) {
-      ui_statusbar_update( UI_STATUSBAR_ITEM_MICRODRIVE,
-			   UI_STATUSBAR_STATE_INACTIVE );
-      if1_mdr_status = 0;
-    }
+    microdrives_set_status( microdrive[0].motor_on || microdrive[1].motor_on ||
+			    microdrive[2].motor_on || microdrive[3].motor_on ||
+			    microdrive[4].motor_on || microdrive[5].motor_on ||
+			    microdrive[6].motor_on || microdrive[7].motor_on );
   }
   if( val & 0x01 ) {	/* comms_data == 1 */
     /* Interface 1 service manual p.:1.4 par.: 1.5.1
@@ -1048,13 +1046,21 @@ increment_head( int m )
 static void
 microdrives_restart( void )
 {
-  int m;
+  int m, offset;
 
   for( m = 0; m < 8; m++ ) {
-    while( ( microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) != 0  &&
-           ( microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) != LIBSPECTRUM_MICRODRIVE_HEAD_LEN )
-      increment_head( m ); /* put head in the start of a block */
-	
+    /* put head in the start of the next header or record */
+    offset = microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN;
+    if( offset != 0 && offset < LIBSPECTRUM_MICRODRIVE_HEAD_LEN ) {
+      microdrive[m].head_pos += LIBSPECTRUM_MICRODRIVE_HEAD_LEN - offset;
+    } else if( offset > LIBSPECTRUM_MICRODRIVE_HEAD_LEN ) {
+      microdrive[m].head_pos += LIBSPECTRUM_MICRODRIVE_BLOCK_LEN - offset;
+      if( microdrive[m].head_pos >=
+          libspectrum_microdrive_cartridge_len( microdrive[m].cartridge ) *
+          LIBSPECTRUM_MICRODRIVE_BLOCK_LEN )
+        microdrive[m].head_pos = 0;
+    }
+
     microdrive[m].transfered = 0; /* reset current number of bytes written */
 
     if( ( microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) == 0 ) {
@@ -1065,6 +1071,33 @@ microdrives_restart( void )
   }	
 }
 
+static void
+microdrives_set_status( int running )
+{
+  if( running == if1_mdr_status ) return;
+
+  if1_mdr_status = running;
+  ui_statusbar_update( UI_STATUSBAR_ITEM_MICRODRIVE,
+		       running ? UI_STATUSBAR_STATE_ACTIVE :
+				 UI_STATUSBAR_STATE_INACTIVE );
+
+  /* As with the tape, no sound while fastloading */
+  if( settings_current.mdr_fastload ) {
+    if( running ) {
+      sound_pause();
+    } else {
+      sound_unpause();
+      timer_estimate_reset();
+    }
+  }
+}
+
+int
+if1_mdr_running( void )
+{
+  return if1_available && if1_mdr_status;
+}
+
 void
 if1_mdr_writeprotect( int drive, int wrprot )
 {
@@ -1103,6 +1136,8 @@ if1_mdr_new( microdrive_t *mdr )
   /* but don't write-protect */
   libspectrum_microdrive_set_write_protect( mdr->cartridge, 0 );
 
+  memset( mdr->dirty, 1, sizeof( mdr->dirty ) );
+
   mdr->inserted = 1;
   mdr->modified = 1;
 
@@ -1166,6 +1201,7 @@ if1_mdr_insert( int which, const char *filename )
   mdr->inserted = 1;
   mdr->modified = 0;
   mdr->filename = utils_safe_strdup( filename );
+  memset( mdr->dirty, 0, sizeof( mdr->dirty ) );
   /* we assume formatted cartridges */
   for( i = libspectrum_microdrive_cartridge_len( mdr->cartridge );
 	i > 0; i-- )
@@ -1238,19 +1274,78 @@ if1_mdr_save( int which, int saveas )
   return 0;
 }
 
+/* Write just the changed blocks and the write protect flag back over the
+   file the cartridge came from; returns non-zero if the whole image must
+   be written instead */
+static int
+if1_mdr_write_dirty( microdrive_t *mdr, const char *filename )
+{
+  libspectrum_byte block[ LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ];
+  libspectrum_byte wrprot;
+  long length;
+  int len, b, i;
+  FILE *f;
+
+  if( !mdr->filename || strcmp( filename, mdr->filename ) ) return 1;
+
+  f = fopen( filename, "r+b" );
+  if( !f ) return 1;
+
+  len = libspectrum_microdrive_cartridge_len( mdr->cartridge );
+  length = (long)len * LIBSPECTRUM_MICRODRIVE_BLOCK_LEN;
+
+  /* The .mdr format is the blocks followed by the write protect byte */
+  if( fseek( f, 0, SEEK_END ) || ftell( f ) != length + 1 ) {
+    fclose( f );
+    return 1;
+  }
+
+  for( b = 0; b < len; b++ ) {
+    if( !mdr->dirty[b] ) continue;
+
+    for( i = 0; i < LIBSPECTRUM_MICRODRIVE_BLOCK_LEN; i++ )
+      block[i] = libspectrum_microdrive_data(
+                   mdr->cartridge, b * LIBSPECTRUM_MICRODRIVE_BLOCK_LEN + i );
+
+    if( fseek( f, (long)b * LIBSPECTRUM_MICRODRIVE_BLOCK_LEN, SEEK_SET ) ||
+        fwrite( block, 1, LIBSPECTRUM_MICRODRIVE_BLOCK_LEN, f ) !=
+          LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) {
+      fclose( f );
+      return 1;
+    }
+  }
+
+  wrprot = libspectrum_microdrive_write_protect( mdr->cartridge ) ? 1 : 0;
+  if( fseek( f, length, SEEK_SET ) || fwrite( &wrprot, 1, 1, f ) != 1 ) {
+    fclose( f );
+    return 1;
+  }
+
+  if( fclose( f ) ) return 1;
+
+  return 0;
+}
+
 int
 if1_mdr_write( int which, const char *filename )
 {
   microdrive_t *mdr = &microdrive[which];  
   
+  if( filename == NULL ) filename = mdr->filename;	/* Write over the original file */
+
+  if( !if1_mdr_write_dirty( mdr, filename ) ) {
+    memset( mdr->dirty, 0, sizeof( mdr->dirty ) );
+    return 0;
+  }
+
   libspectrum_microdrive_mdr_write( mdr->cartridge, &mdr->file.buffer,
 			            &mdr->file.length );
 
-  if( filename == NULL ) filename = mdr->filename;	/* Write over the original file */
-
   if( utils_write_file( filename, mdr->file.buffer, mdr->file.length ) )
     return 1;
 
+  memset( mdr->dirty, 0, sizeof( mdr->dirty ) );
+
   if( mdr->filename && strcmp( filename, mdr->filename ) ) {
     libspectrum_free( mdr->filename );
     mdr->filename = utils_safe_strdup( filename );
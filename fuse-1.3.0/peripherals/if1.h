@@ -44,6 +44,7 @@ int if1_mdr_write( int drive, const char *filename );
 int if1_mdr_eject( int drive );
 int if1_mdr_save( int drive, int saveas );
 void if1_mdr_writeprotect( int drive, int wrprot );
+int if1_mdr_running( void );
 void if1_plug( const char *filename, int what );
 void if1_unplug( int what );
 
@@ -26,6 +26,8 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "fuse.h"
@@ -61,11 +63,12 @@ static const keyboard_key_name sinclair1_key[5] =
 static const keyboard_key_name sinclair2_key[5] =
   { KEYBOARD_1, KEYBOARD_2, KEYBOARD_4, KEYBOARD_3, KEYBOARD_5 };
 
-/* The current values for the joysticks we can emulate */
-static libspectrum_byte kempston_value;
-static libspectrum_byte timex1_value;
-static libspectrum_byte timex2_value;
-static libspectrum_byte fuller_value;
+/* The current values for the joysticks we can emulate, as seen by the
+   emulated machine and as set from the host. These are the same except
+   while input is latched; see keyboard_host_values */
+libspectrum_byte joystick_values[ JOYSTICK_VALUE_COUNT ];
+libspectrum_byte joystick_host_values[ JOYSTICK_VALUE_COUNT ];
+static int joystick_latched = 0;
 
 /* The names of the joysticks we can emulate. Order must correspond to
    that of joystick.h:joystick_type_t */
@@ -128,8 +131,11 @@ void
 fuse_joystick_init (void)
 {
   joysticks_supported = ui_joystick_init();
-  kempston_value = timex1_value = timex2_value = 0x00;
-  fuller_value = 0xff;
+  joystick_host_values[ JOYSTICK_VALUE_KEMPSTON ] = 0x00;
+  joystick_host_values[ JOYSTICK_VALUE_TIMEX_1 ] = 0x00;
+  joystick_host_values[ JOYSTICK_VALUE_TIMEX_2 ] = 0x00;
+  joystick_host_values[ JOYSTICK_VALUE_FULLER ] = 0xff;
+  memcpy( joystick_values, joystick_host_values, sizeof( joystick_values ) );
 
   module_register( &joystick_module_info );
   periph_register( PERIPH_TYPE_KEMPSTON, &kempston_strict_periph );
@@ -142,6 +148,27 @@ fuse_joystick_end (void)
   ui_joystick_end();
 }
 
+static void
+set_value( joystick_value_t which, libspectrum_byte mask, int set )
+{
+  if( set ) {
+    joystick_host_values[ which ] |=  mask;
+  } else {
+    joystick_host_values[ which ] &= ~mask;
+  }
+
+  if( !joystick_latched )
+    joystick_values[ which ] = joystick_host_values[ which ];
+}
+
+void
+joystick_latch( int latch )
+{
+  joystick_latched = latch;
+  if( !latch )
+    memcpy( joystick_values, joystick_host_values, sizeof( joystick_values ) );
+}
+
 int
 joystick_press( int which, joystick_button button, int press )
 {
@@ -169,11 +196,7 @@ joystick_press( int which, joystick_button button, int press )
     return 1;
 
   case JOYSTICK_TYPE_KEMPSTON:
-    if( press ) {
-      kempston_value |=  kempston_mask[ button ];
-    } else {
-      kempston_value &= ~kempston_mask[ button ];
-    }
+    set_value( JOYSTICK_VALUE_KEMPSTON, kempston_mask[ button ], press );
     return 1;
 
   case JOYSTICK_TYPE_SINCLAIR_1:
@@ -193,27 +216,16 @@ joystick_press( int which, joystick_button button, int press )
     return 1;
 
   case JOYSTICK_TYPE_TIMEX_1:
-    if( press ) {
-      timex1_value |=  timex_mask[ button ];
-    } else {
-      timex1_value &= ~timex_mask[ button ];
-    }
+    set_value( JOYSTICK_VALUE_TIMEX_1, timex_mask[ button ], press );
     return 1;
 
   case JOYSTICK_TYPE_TIMEX_2:
-    if( press ) {
-      timex2_value |=  timex_mask[ button ];
-    } else {
-      timex2_value &= ~timex_mask[ button ];
-    }
+    set_value( JOYSTICK_VALUE_TIMEX_2, timex_mask[ button ], press );
     return 1;
 
   case JOYSTICK_TYPE_FULLER:
-    if( press ) {
-      fuller_value &= ~timex_mask[ button ];
-    } else {
-      fuller_value |=  timex_mask[ button ];
-    }
+    /* The Fuller Box is active low */
+    set_value( JOYSTICK_VALUE_FULLER, timex_mask[ button ], !press );
     return 1;
 
   case JOYSTICK_TYPE_NONE: return 0;
@@ -230,20 +242,21 @@ libspectrum_byte
 joystick_kempston_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff; /* TODO: check this */
-  return kempston_value;
+  return joystick_values[ JOYSTICK_VALUE_KEMPSTON ];
 }
 
 libspectrum_byte
 joystick_timex_read( libspectrum_word port GCC_UNUSED, libspectrum_byte which )
 {
-  return which ? timex2_value : timex1_value;
+  return joystick_values[ which ? JOYSTICK_VALUE_TIMEX_2
+                                 : JOYSTICK_VALUE_TIMEX_1 ];
 }
 
 libspectrum_byte
 joystick_fuller_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff; /* TODO: check this */
-  return fuller_value;
+  return joystick_values[ JOYSTICK_VALUE_FULLER ];
 }
 
 static void
@@ -74,6 +74,26 @@ typedef enum joystick_button {
    pressed */
 int joystick_press( int which, joystick_button button, int press );
 
+/* The joystick interfaces which are not read through the keyboard */
+typedef enum joystick_value_t {
+
+  JOYSTICK_VALUE_KEMPSTON = 0,
+  JOYSTICK_VALUE_TIMEX_1,
+  JOYSTICK_VALUE_TIMEX_2,
+  JOYSTICK_VALUE_FULLER,
+
+  JOYSTICK_VALUE_COUNT
+
+} joystick_value_t;
+
+/* What the emulated machine sees, and the state of the host's joysticks */
+extern libspectrum_byte joystick_values[ JOYSTICK_VALUE_COUNT ];
+extern libspectrum_byte joystick_host_values[ JOYSTICK_VALUE_COUNT ];
+
+/* Stop (or restart) the host joysticks reaching the emulated machine
+   directly, as keyboard_latch() */
+void joystick_latch( int latch );
+
 /* Interface-specific read functions */
 libspectrum_byte joystick_kempston_read ( libspectrum_word port,
 					  libspectrum_byte *attached );
@@ -28,13 +28,30 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <pthread.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include "fuse.h"
+#include "timer/timer.h"
 #include "ui/ui.h"
+#include "unittests/unittests.h"
 #include "w5100.h"
 #include "w5100_internals.h"
 
@@ -85,6 +102,88 @@ nic_w5100_reset( nic_w5100_t *self )
     nic_w5100_socket_reset( &self->socket[i] );
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+
+/* epoll_event.data for the self-pipe; the sockets use their ids */
+#define W5100_EPOLL_SELFPIPE 4
+
+static void*
+w5100_io_thread( void *arg )
+{
+  nic_w5100_t *self = arg;
+  struct epoll_event events[5];
+  int i, active;
+
+  while( !self->stop_io_thread ) {
+
+    /* Sockets opened, closed or accepted since we last waited are picked up
+       here; unlike select(), nothing needs rebuilding for the others */
+    for( i = 0; i < 4; i++ )
+      nic_w5100_socket_epoll_update( &self->socket[i], self->epoll_fd );
+
+    nic_w5100_debug( "w5100: io thread epoll_wait\n" );
+
+    active = epoll_wait( self->epoll_fd, events, 5, -1 );
+
+    nic_w5100_debug( "w5100: io thread wake; %d active\n", active );
+
+    if( active == -1 ) {
+      if( compat_socket_get_error() != EINTR )
+        nic_w5100_debug( "w5100: epoll_wait returned unexpected errno %d: %s\n",
+                         compat_socket_get_error(),
+                         compat_socket_get_strerror() );
+      continue;
+    }
+
+    for( i = 0; i < active; i++ ) {
+      libspectrum_dword id = events[i].data.u64 & 0xffffffff;
+
+      if( id == W5100_EPOLL_SELFPIPE ) {
+        nic_w5100_debug( "w5100: discarding selfpipe data\n" );
+        compat_socket_selfpipe_discard_data( self->selfpipe );
+      }
+      else {
+        nic_w5100_socket_epoll_event( &self->socket[id], events[i].events,
+                                      events[i].data.u64 >> 32 );
+      }
+    }
+
+    /* Commands from the emulator wake us through the self-pipe, so this
+       also retries reads which were waiting for buffer space and starts any
+       newly requested sends */
+    for( i = 0; i < 4; i++ )
+      nic_w5100_socket_epoll_process( &self->socket[i] );
+  }
+
+  return NULL;
+}
+
+static void
+w5100_epoll_init( nic_w5100_t *self )
+{
+  struct epoll_event event;
+
+  self->epoll_fd = epoll_create( 5 );
+  if( self->epoll_fd == -1 ) {
+    ui_error( UI_ERROR_ERROR, "w5100: error %d creating epoll set",
+              compat_socket_get_error() );
+    fuse_abort();
+  }
+
+  /* Level-triggered, as we drain only one byte per wakeup */
+  event.events = EPOLLIN;
+  event.data.u64 = W5100_EPOLL_SELFPIPE;
+  if( epoll_ctl( self->epoll_fd, EPOLL_CTL_ADD,
+                 compat_socket_selfpipe_get_read_fd( self->selfpipe ),
+                 &event ) == -1 ) {
+    ui_error( UI_ERROR_ERROR, "w5100: error %d adding selfpipe to epoll set",
+              compat_socket_get_error() );
+    fuse_abort();
+  }
+}
+
+#else				/* #ifdef HAVE_SYS_EPOLL_H */
+
 static void*
 w5100_io_thread( void *arg )
 {
@@ -141,6 +240,8 @@ w5100_io_thread( void *arg )
   return NULL;
 }
 
+#endif				/* #ifdef HAVE_SYS_EPOLL_H */
+
 nic_w5100_t*
 nic_w5100_alloc( void )
 {
@@ -157,8 +258,15 @@ nic_w5100_alloc( void )
   for( i = 0; i < 4; i++ )
     nic_w5100_socket_init( &self->socket[i], i );
 
+  self->loopback = 0;
+  self->loopback_received = self->loopback_sent = 0;
+
   nic_w5100_reset( self );
 
+#ifdef HAVE_SYS_EPOLL_H
+  w5100_epoll_init( self );
+#endif
+
   self->stop_io_thread = 0;
 
   error = pthread_create( &self->thread, NULL, w5100_io_thread, self );
@@ -184,6 +292,10 @@ nic_w5100_free( nic_w5100_t *self )
     for( i = 0; i < 4; i++ )
       nic_w5100_socket_end( &self->socket[i] );
 
+#ifdef HAVE_SYS_EPOLL_H
+    close( self->epoll_fd );
+#endif
+
     compat_socket_selfpipe_free( self->selfpipe );
 
     compat_socket_networking_end();
@@ -360,6 +472,381 @@ nic_w5100_to_snapshot( nic_w5100_t *self )
   return data;
 }
 
+void
+nic_w5100_set_loopback( nic_w5100_t *self, int loopback )
+{
+  self->loopback = loopback;
+}
+
+void
+nic_w5100_loopback_stats( nic_w5100_t *self, libspectrum_qword *received,
+                          libspectrum_qword *sent )
+{
+  *received = self->loopback_received;
+  *sent = self->loopback_sent;
+}
+
+/* Unit tests. Most run against the loopback backend so they need no
+   network and never wait: push data through socket 0 to the echo service
+   and back, in chunks which don't divide the buffer size so both rings
+   wrap, then try the other services. One more bounces UDP datagrams off a
+   host socket on 127.0.0.1 to exercise the I/O thread, giving up after a
+   second without a reply */
+
+#define W5100_UNITTEST_TOTAL 0x3f000 /* A whole number of chunks */
+#define W5100_UNITTEST_CHUNK 0x300
+#define W5100_UNITTEST_WAIT 1.0	/* seconds */
+
+/* Where socket `which''s register `reg' and buffers are */
+#define W5100_UNITTEST_SOCKET( which, reg ) ( 0x400 + 0x100 * (which) + (reg) )
+#define W5100_UNITTEST_TX( which, ptr ) \
+  ( 0x4000 + 0x800 * (which) + ( (ptr) & 0x7ff ) )
+#define W5100_UNITTEST_RX( which, ptr ) \
+  ( 0x6000 + 0x800 * (which) + ( (ptr) & 0x7ff ) )
+
+static libspectrum_word
+w5100_unittest_read_word( nic_w5100_t *self, int which, int reg )
+{
+  libspectrum_word address = W5100_UNITTEST_SOCKET( which, reg );
+
+  return ( nic_w5100_read( self, address ) << 8 ) |
+         nic_w5100_read( self, address + 1 );
+}
+
+static void
+w5100_unittest_write_word( nic_w5100_t *self, int which, int reg,
+                           libspectrum_word value )
+{
+  libspectrum_word address = W5100_UNITTEST_SOCKET( which, reg );
+
+  nic_w5100_write( self, address, value >> 8 );
+  nic_w5100_write( self, address + 1, value & 0xff );
+}
+
+static libspectrum_byte
+w5100_unittest_read_reg( nic_w5100_t *self, int which, int reg )
+{
+  return nic_w5100_read( self, W5100_UNITTEST_SOCKET( which, reg ) );
+}
+
+static void
+w5100_unittest_command( nic_w5100_t *self, int which,
+                        enum w5100_socket_command command )
+{
+  nic_w5100_write( self, W5100_UNITTEST_SOCKET( which, W5100_SOCKET_CR ),
+                   command );
+}
+
+/* Open socket which in the given mode and, for TCP, connect it; ip and
+   port are in network byte order */
+static void
+w5100_unittest_open( nic_w5100_t *self, int which, w5100_socket_mode mode,
+                     const libspectrum_byte *ip, const libspectrum_byte *port )
+{
+  int i;
+
+  nic_w5100_write( self, W5100_UNITTEST_SOCKET( which, W5100_SOCKET_MR ),
+                   mode == W5100_SOCKET_MODE_TCP ? 0x21 : mode );
+  w5100_unittest_command( self, which, W5100_SOCKET_COMMAND_OPEN );
+  for( i = 0; i < 4; i++ )
+    nic_w5100_write( self,
+                     W5100_UNITTEST_SOCKET( which, W5100_SOCKET_DIPR0 + i ),
+                     ip[i] );
+  for( i = 0; i < 2; i++ )
+    nic_w5100_write( self,
+                     W5100_UNITTEST_SOCKET( which, W5100_SOCKET_DPORT0 + i ),
+                     port[i] );
+  if( mode == W5100_SOCKET_MODE_TCP )
+    w5100_unittest_command( self, which, W5100_SOCKET_COMMAND_CONNECT );
+}
+
+/* The loopback echo service replies as soon as data is sent, so every
+   chunk must have come back, perhaps in parts, without waiting */
+static int
+w5100_unittest_echo( nic_w5100_t *self )
+{
+  libspectrum_word tx_wr = 0, rx_rd = 0, rsr;
+  size_t done, i;
+  double start, elapsed;
+
+  start = timer_get_time();
+
+  for( done = 0; done < W5100_UNITTEST_TOTAL; done += W5100_UNITTEST_CHUNK ) {
+    size_t received = 0;
+
+    for( i = 0; i < W5100_UNITTEST_CHUNK; i++ )
+      nic_w5100_write( self, W5100_UNITTEST_TX( 0, tx_wr + i ),
+                       ( done + i ) * 7 );
+    tx_wr += W5100_UNITTEST_CHUNK;
+    w5100_unittest_write_word( self, 0, W5100_SOCKET_TX_WR0, tx_wr );
+    w5100_unittest_command( self, 0, W5100_SOCKET_COMMAND_SEND );
+
+    while( received < W5100_UNITTEST_CHUNK ) {
+      rsr = w5100_unittest_read_word( self, 0, W5100_SOCKET_RX_RSR0 );
+      TEST_ASSERT( rsr && received + rsr <= W5100_UNITTEST_CHUNK );
+      for( i = 0; i < rsr; i++ )
+        TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 0, rx_rd + i ) )
+                     == (libspectrum_byte)( ( done + received + i ) * 7 ) );
+      received += rsr;
+      rx_rd += rsr;
+      w5100_unittest_write_word( self, 0, W5100_SOCKET_RX_RD0, rx_rd );
+      w5100_unittest_command( self, 0, W5100_SOCKET_COMMAND_RECV );
+    }
+  }
+
+  TEST_ASSERT( w5100_unittest_read_word( self, 0, W5100_SOCKET_TX_FSR0 ) ==
+               0x800 );
+
+  elapsed = timer_get_time() - start;
+  nic_w5100_debug( "w5100: echoed %d bytes in %.3f seconds (%.0f bytes/s)\n",
+                   W5100_UNITTEST_TOTAL, elapsed,
+                   elapsed > 0 ? W5100_UNITTEST_TOTAL / elapsed : 0.0 );
+
+  return 0;
+}
+
+/* Wait until socket which has at least length bytes to receive */
+static int
+w5100_unittest_host_wait_rx( nic_w5100_t *self, int which,
+                             libspectrum_word length )
+{
+  double start = timer_get_time();
+
+  while( w5100_unittest_read_word( self, which, W5100_SOCKET_RX_RSR0 ) <
+         length ) {
+    if( timer_get_time() - start > W5100_UNITTEST_WAIT ) return 1;
+    timer_sleep( 0 );
+  }
+
+  return 0;
+}
+
+/* Send datagrams from socket 0 to a host socket which sends each back */
+static int
+w5100_unittest_host_echo( nic_w5100_t *self, compat_socket_t peer,
+                          const struct sockaddr_in *peer_address )
+{
+  libspectrum_byte buffer[ W5100_UNITTEST_CHUNK + 1 ];
+  libspectrum_word tx_wr = 0, rx_rd = 0;
+  struct sockaddr_in from;
+  socklen_t from_length;
+  struct timeval timeout;
+  fd_set readfds;
+  size_t done, i;
+  double start, elapsed;
+
+  start = timer_get_time();
+
+  for( done = 0; done < W5100_UNITTEST_TOTAL; done += W5100_UNITTEST_CHUNK ) {
+    ssize_t length;
+
+    for( i = 0; i < W5100_UNITTEST_CHUNK; i++ )
+      nic_w5100_write( self, W5100_UNITTEST_TX( 0, tx_wr + i ),
+                       ( done + i ) * 7 );
+    tx_wr += W5100_UNITTEST_CHUNK;
+    w5100_unittest_write_word( self, 0, W5100_SOCKET_TX_WR0, tx_wr );
+    w5100_unittest_command( self, 0, W5100_SOCKET_COMMAND_SEND );
+
+    /* Host side: echo the datagram back to where it came from */
+    FD_ZERO( &readfds );
+    FD_SET( peer, &readfds );
+    timeout.tv_sec = W5100_UNITTEST_WAIT; timeout.tv_usec = 0;
+    TEST_ASSERT( select( peer + 1, &readfds, NULL, NULL, &timeout ) == 1 );
+    from_length = sizeof( from );
+    length = recvfrom( peer, (char*)buffer, sizeof( buffer ), 0,
+                       (struct sockaddr*)&from, &from_length );
+    TEST_ASSERT( length == W5100_UNITTEST_CHUNK );
+    TEST_ASSERT( sendto( peer, (const char*)buffer, length, 0,
+                         (struct sockaddr*)&from, from_length ) == length );
+
+    /* Emulated side: the datagram, after its header */
+    TEST_ASSERT( !w5100_unittest_host_wait_rx( self, 0,
+                                               W5100_UNITTEST_CHUNK + 8 ) );
+    for( i = 0; i < 4; i++ )
+      TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 0, rx_rd + i ) ) ==
+                   ( (libspectrum_byte*)&peer_address->sin_addr.s_addr )[i] );
+    for( i = 0; i < 2; i++ )
+      TEST_ASSERT( nic_w5100_read( self,
+                                   W5100_UNITTEST_RX( 0, rx_rd + 4 + i ) ) ==
+                   ( (libspectrum_byte*)&peer_address->sin_port )[i] );
+    TEST_ASSERT( ( nic_w5100_read( self, W5100_UNITTEST_RX( 0, rx_rd + 6 ) )
+                   << 8 |
+                   nic_w5100_read( self, W5100_UNITTEST_RX( 0, rx_rd + 7 ) ) )
+                 == W5100_UNITTEST_CHUNK );
+    for( i = 0; i < W5100_UNITTEST_CHUNK; i++ )
+      TEST_ASSERT( nic_w5100_read( self,
+                                   W5100_UNITTEST_RX( 0, rx_rd + 8 + i ) ) ==
+                   (libspectrum_byte)( ( done + i ) * 7 ) );
+    rx_rd += W5100_UNITTEST_CHUNK + 8;
+    w5100_unittest_write_word( self, 0, W5100_SOCKET_RX_RD0, rx_rd );
+    w5100_unittest_command( self, 0, W5100_SOCKET_COMMAND_RECV );
+  }
+
+  TEST_ASSERT( w5100_unittest_read_word( self, 0, W5100_SOCKET_TX_FSR0 ) ==
+               0x800 );
+
+  elapsed = timer_get_time() - start;
+  nic_w5100_debug( "w5100: echoed %d bytes through the host in %.3f seconds "
+                   "(%.0f bytes/s)\n", W5100_UNITTEST_TOTAL, elapsed,
+                   elapsed > 0 ? W5100_UNITTEST_TOTAL / elapsed : 0.0 );
+
+  return 0;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/* A datagram the host refuses to send (no broadcasts without asking) is
+   dropped with a timeout, rather than holding up the socket for good */
+static int
+w5100_unittest_host_refused( nic_w5100_t *self )
+{
+  const libspectrum_byte broadcast[4] = { 255, 255, 255, 255 },
+    discard[2] = { 0, 9 };
+  double start;
+
+  w5100_unittest_open( self, 1, W5100_SOCKET_MODE_UDP, broadcast, discard );
+  nic_w5100_write( self, W5100_UNITTEST_TX( 1, 0 ), 0xaa );
+  w5100_unittest_write_word( self, 1, W5100_SOCKET_TX_WR0, 1 );
+  w5100_unittest_command( self, 1, W5100_SOCKET_COMMAND_SEND );
+
+  start = timer_get_time();
+  while( !( w5100_unittest_read_reg( self, 1, W5100_SOCKET_IR ) &
+            W5100_SOCKET_IR_TIMEOUT ) ) {
+    TEST_ASSERT( timer_get_time() - start < W5100_UNITTEST_WAIT );
+    timer_sleep( 0 );
+  }
+  TEST_ASSERT( w5100_unittest_read_word( self, 1, W5100_SOCKET_TX_FSR0 ) ==
+               0x800 );
+
+  w5100_unittest_command( self, 1, W5100_SOCKET_COMMAND_CLOSE );
+
+  return 0;
+}
+
+#endif				/* #ifdef HAVE_SYS_EPOLL_H */
+
+static int
+w5100_unittest_host( void )
+{
+  const libspectrum_byte ip[4] = { 127, 0, 0, 1 };
+  nic_w5100_t *self;
+  compat_socket_t peer;
+  struct sockaddr_in sa;
+  socklen_t sa_length = sizeof( sa );
+  int i, r;
+
+  /* Without a loopback interface there is nothing to test against */
+  peer = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  if( peer == compat_socket_invalid ||
+      bind( peer, (struct sockaddr*)&sa, sizeof( sa ) ) == -1 ||
+      getsockname( peer, (struct sockaddr*)&sa, &sa_length ) == -1 ) {
+    printf( "%s: no host loopback interface; skipping the W5100 socket "
+            "test\n", fuse_progname );
+    if( peer != compat_socket_invalid ) compat_socket_close( peer );
+    return 0;
+  }
+
+  self = nic_w5100_alloc();
+  nic_w5100_reset( self );
+
+  for( i = 0; i < 4; i++ )
+    nic_w5100_write( self, W5100_SIPR0 + i, ip[i] );
+
+  w5100_unittest_open( self, 0, W5100_SOCKET_MODE_UDP,
+                       (libspectrum_byte*)&sa.sin_addr.s_addr,
+                       (libspectrum_byte*)&sa.sin_port );
+
+  r = w5100_unittest_host_echo( self, peer, &sa );
+#ifdef HAVE_SYS_EPOLL_H
+  if( !r ) r = w5100_unittest_host_refused( self );
+#endif
+
+  w5100_unittest_command( self, 0, W5100_SOCKET_COMMAND_CLOSE );
+  compat_socket_close( peer );
+  nic_w5100_free( self );
+
+  return r;
+}
+
+static int
+w5100_unittest_loopback_services( nic_w5100_t *self )
+{
+  const libspectrum_byte ip[4] = { 10, 0, 0, 1 };
+  const libspectrum_byte echo[2] = { 0, 7 }, chargen[2] = { 0, 19 },
+    nowhere[2] = { 0x12, 0x34 };
+  libspectrum_qword received, sent;
+
+  /* Echo, with the whole transfer accounted for */
+  w5100_unittest_open( self, 0, W5100_SOCKET_MODE_TCP, ip, echo );
+  TEST_ASSERT( w5100_unittest_read_reg( self, 0, W5100_SOCKET_SR ) ==
+               W5100_SOCKET_STATE_ESTABLISHED );
+  if( w5100_unittest_echo( self ) ) return 1;
+  nic_w5100_loopback_stats( self, &received, &sent );
+  TEST_ASSERT( received == W5100_UNITTEST_TOTAL );
+  TEST_ASSERT( sent == W5100_UNITTEST_TOTAL );
+
+  /* Chargen fills the receive buffer as soon as we connect */
+  w5100_unittest_open( self, 1, W5100_SOCKET_MODE_TCP, ip, chargen );
+  TEST_ASSERT( w5100_unittest_read_word( self, 1, W5100_SOCKET_RX_RSR0 ) ==
+               0x800 );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 1, 0 ) ) == ' ' );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 1, 74 ) ) == '!' );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 1, 73 ) ) == '\n' );
+
+  /* A UDP datagram comes back from the echo service with a header */
+  w5100_unittest_open( self, 2, W5100_SOCKET_MODE_UDP, ip, echo );
+  nic_w5100_write( self, W5100_UNITTEST_TX( 2, 0 ), 0xaa );
+  nic_w5100_write( self, W5100_UNITTEST_TX( 2, 1 ), 0x55 );
+  w5100_unittest_write_word( self, 2, W5100_SOCKET_TX_WR0, 2 );
+  w5100_unittest_command( self, 2, W5100_SOCKET_COMMAND_SEND );
+  TEST_ASSERT( w5100_unittest_read_word( self, 2, W5100_SOCKET_RX_RSR0 ) ==
+               10 );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 2, 0 ) ) == 10 );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 2, 5 ) ) == 7 );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 2, 7 ) ) == 2 );
+  TEST_ASSERT( nic_w5100_read( self, W5100_UNITTEST_RX( 2, 9 ) ) == 0x55 );
+
+  /* Nobody is listening on other ports */
+  w5100_unittest_open( self, 3, W5100_SOCKET_MODE_TCP, ip, nowhere );
+  TEST_ASSERT( w5100_unittest_read_reg( self, 3, W5100_SOCKET_SR ) ==
+               W5100_SOCKET_STATE_CLOSED );
+  TEST_ASSERT( w5100_unittest_read_reg( self, 3, W5100_SOCKET_IR ) &
+               W5100_SOCKET_IR_TIMEOUT );
+
+  return 0;
+}
+
+static int
+w5100_unittest_loopback( void )
+{
+  nic_w5100_t *self;
+  int r;
+
+  self = nic_w5100_alloc();
+  nic_w5100_set_loopback( self, 1 );
+  nic_w5100_reset( self );
+
+  r = w5100_unittest_loopback_services( self );
+
+  nic_w5100_free( self );
+
+  return r;
+}
+
+int
+nic_w5100_unittest( void )
+{
+  int r = 0;
+
+  r += w5100_unittest_loopback();
+  r += w5100_unittest_host();
+
+  return r;
+}
+
 void
 nic_w5100_debug( const char *format, ... )
 {
@@ -44,4 +44,12 @@ void nic_w5100_write( nic_w5100_t *self, libspectrum_word reg, libspectrum_byte
 void nic_w5100_from_snapshot( nic_w5100_t *self, libspectrum_byte *data );
 libspectrum_byte* nic_w5100_to_snapshot( nic_w5100_t *self );
 
+/* Connect sockets to virtual services inside the emulator rather than to
+   the host's network; takes effect at the next reset */
+void nic_w5100_set_loopback( nic_w5100_t *self, int loopback );
+void nic_w5100_loopback_stats( nic_w5100_t *self, libspectrum_qword *received,
+                               libspectrum_qword *sent );
+
+int nic_w5100_unittest( void );
+
 #endif                          /* #ifndef FUSE_W5100_H */
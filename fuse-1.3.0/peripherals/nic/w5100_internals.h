@@ -55,6 +55,27 @@ typedef enum w5100_socket_state {
   W5100_SOCKET_STATE_UDP = 0x22,
 } w5100_socket_state;
 
+enum w5100_socket_command {
+  W5100_SOCKET_COMMAND_OPEN = 1 << 0,
+  W5100_SOCKET_COMMAND_LISTEN = 1 << 1,
+  W5100_SOCKET_COMMAND_CONNECT = 1 << 2,
+  W5100_SOCKET_COMMAND_DISCON = 1 << 3,
+  W5100_SOCKET_COMMAND_CLOSE = 1 << 4,
+  W5100_SOCKET_COMMAND_SEND = 1 << 5,
+  W5100_SOCKET_COMMAND_RECV = 1 << 6,
+};
+
+/* Bits in Sn_IR */
+enum w5100_socket_interrupts {
+  W5100_SOCKET_IR_CON = 1 << 0,
+  W5100_SOCKET_IR_DISCON = 1 << 1,
+  W5100_SOCKET_IR_RECV = 1 << 2,
+  W5100_SOCKET_IR_TIMEOUT = 1 << 3,
+  W5100_SOCKET_IR_SEND_OK = 1 << 4,
+};
+
+struct w5100_loopback_service_t;
+
 enum w5100_socket_registers {
   W5100_SOCKET_MR = 0x00,
   W5100_SOCKET_CR,
@@ -106,7 +127,8 @@ typedef struct nic_w5100_socket_t {
   libspectrum_word tx_rr;   /* Transmit read pointer */
   libspectrum_word tx_wr;   /* Transmit write pointer */
 
-  libspectrum_word rx_rsr;  /* Received size */
+  libspectrum_word rx_wr;   /* Received write pointer; Sn_RX_RSR is the
+                               distance from here back to old_rx_rd */
   libspectrum_word rx_rd;   /* Received read pointer */
 
   libspectrum_word old_rx_rd; /* Used in RECV command processing */
@@ -130,7 +152,28 @@ typedef struct nic_w5100_socket_t {
      longer be used */
   int ok_for_io;
 
-  pthread_mutex_t lock;     /* Mutex for this socket */
+  /* Incremented whenever fd is replaced or changes role (listen, connect),
+     so the I/O thread knows to re-register it and can discard readiness
+     reported for the old descriptor */
+  unsigned int fd_generation;
+
+#ifdef HAVE_SYS_EPOLL_H
+  unsigned int epoll_generation; /* fd_generation when last registered */
+  int readable;             /* Edge-triggered readiness not yet drained */
+  int writable;
+#endif
+
+  /* Loopback backend: the virtual service this socket is connected to, and
+     any data it has ready for the Spectrum which hasn't yet fitted into
+     rx_buffer */
+  const struct w5100_loopback_service_t *service;
+  libspectrum_byte loopback_buffer[0x800];
+  int loopback_length;
+  libspectrum_dword loopback_position; /* For use by the service */
+
+  /* Serialises commands from the emulator with I/O on fd. Register reads
+     from the emulator do not take this; see w5100_atomic_get() */
+  pthread_mutex_t lock;
 
 } nic_w5100_socket_t;
 
@@ -145,12 +188,31 @@ struct nic_w5100_t {
   pthread_t thread;         /* Thread for doing I/O */
   sig_atomic_t stop_io_thread; /* Flag to stop I/O thread */
   compat_socket_selfpipe_t *selfpipe; /* Device for waking I/O thread */
+#ifdef HAVE_SYS_EPOLL_H
+  int epoll_fd;             /* Readiness notification for the I/O thread */
+#endif
+
+  int loopback;             /* Connect to virtual services, not the host */
+  libspectrum_qword loopback_received; /* Bytes delivered to the Spectrum */
+  libspectrum_qword loopback_sent;     /* Bytes taken from the Spectrum */
 };
 
+/* Fields written by the I/O thread (ir, state, tx_rr and rx_wr) are read by
+   the emulator without taking the socket lock, so both sides access them
+   atomically; the release store of rx_wr publishes the received data */
+#define w5100_atomic_get( x ) __atomic_load_n( &(x), __ATOMIC_ACQUIRE )
+#define w5100_atomic_set( x, v ) __atomic_store_n( &(x), (v), __ATOMIC_RELEASE )
+#define w5100_atomic_or( x, v ) __atomic_fetch_or( &(x), (v), __ATOMIC_RELEASE )
+
 void nic_w5100_socket_init( nic_w5100_socket_t *socket, int which );
 void nic_w5100_socket_end( nic_w5100_socket_t *socket );
 
 void nic_w5100_socket_reset( nic_w5100_socket_t *socket );
+void nic_w5100_socket_clean( nic_w5100_socket_t *socket );
+
+int nic_w5100_socket_rx_free( nic_w5100_socket_t *socket );
+void nic_w5100_socket_rx_copy( nic_w5100_socket_t *socket, int offset,
+                               const libspectrum_byte *data, int length );
 
 libspectrum_byte nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg );
 void nic_w5100_socket_write( nic_w5100_t *self, libspectrum_word reg, libspectrum_byte b );
@@ -163,6 +225,16 @@ void nic_w5100_socket_add_to_sets( nic_w5100_socket_t *socket, fd_set *readfds,
 void nic_w5100_socket_process_io( nic_w5100_socket_t *socket, fd_set readfds,
   fd_set writefds );
 
+#ifdef HAVE_SYS_EPOLL_H
+void nic_w5100_socket_epoll_update( nic_w5100_socket_t *socket, int epoll_fd );
+void nic_w5100_socket_epoll_event( nic_w5100_socket_t *socket,
+  libspectrum_dword events, unsigned int generation );
+void nic_w5100_socket_epoll_process( nic_w5100_socket_t *socket );
+#endif
+
+void nic_w5100_loopback_command( nic_w5100_t *self, nic_w5100_socket_t *socket,
+                                 libspectrum_byte command );
+
 /* Debug routines */
 
 /* Define this to spew debugging info to stdout */
@@ -0,0 +1,336 @@
+/* w5100_loopback.c: Wiznet W5100 emulation - virtual network backend
+   
+   Instead of host sockets, connects the W5100's sockets to a small set of
+   services running inside the emulator. Everything happens synchronously
+   with the commands the Spectrum issues, so runs are deterministic (and so
+   replay under RZX) and go as fast as the emulation does.
+
+   Copyright (c) 2016 Philip Kendall
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+   
+   Author contact information:
+   
+   E-mail: philip-fuse@shadowmagic.org.uk
+ 
+*/
+
+#include <config.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#include "fuse.h"
+#include "ui/ui.h"
+#include "w5100.h"
+#include "w5100_internals.h"
+
+/* A service on the virtual network, found by its port number whatever
+   destination IP address the Spectrum uses. Services keep any per
+   connection state in the socket's loopback_* fields */
+typedef struct w5100_loopback_service_t {
+
+  libspectrum_word port;
+  const char *name;
+
+  /* Offered length bytes the Spectrum has sent; returns how many were
+     accepted. Anything not accepted is offered again later */
+  int (*receive)( nic_w5100_socket_t *socket, const libspectrum_byte *data,
+                  int length );
+
+  /* Fill in up to length bytes for the Spectrum; returns how many */
+  int (*transmit)( nic_w5100_socket_t *socket, libspectrum_byte *data,
+                   int length );
+
+} w5100_loopback_service_t;
+
+/* Services queue their output in the socket's loopback buffer */
+
+static int
+loopback_queue( nic_w5100_socket_t *socket, const libspectrum_byte *data,
+                int length )
+{
+  int space = sizeof( socket->loopback_buffer ) - socket->loopback_length;
+
+  if( length > space ) length = space;
+
+  memcpy( &socket->loopback_buffer[ socket->loopback_length ], data, length );
+  socket->loopback_length += length;
+
+  return length;
+}
+
+static int
+loopback_dequeue( nic_w5100_socket_t *socket, libspectrum_byte *data,
+                  int length )
+{
+  if( length > socket->loopback_length ) length = socket->loopback_length;
+
+  memcpy( data, socket->loopback_buffer, length );
+  memmove( socket->loopback_buffer, &socket->loopback_buffer[ length ],
+           socket->loopback_length - length );
+  socket->loopback_length -= length;
+
+  return length;
+}
+
+static int
+discard_receive( nic_w5100_socket_t *socket GCC_UNUSED,
+                 const libspectrum_byte *data GCC_UNUSED, int length )
+{
+  return length;
+}
+
+static int
+discard_transmit( nic_w5100_socket_t *socket GCC_UNUSED,
+                  libspectrum_byte *data GCC_UNUSED, int length GCC_UNUSED )
+{
+  return 0;
+}
+
+/* RFC 864: lines of 72 printable characters, each starting one character
+   further on. A UDP request gets one line back */
+static int
+chargen_transmit( nic_w5100_socket_t *socket, libspectrum_byte *data,
+                  int length )
+{
+  int i;
+
+  if( socket->state == W5100_SOCKET_STATE_UDP && length > 74 ) length = 74;
+
+  for( i = 0; i < length; i++ ) {
+    libspectrum_dword line = socket->loopback_position / 74,
+                      column = socket->loopback_position % 74;
+
+    if( column < 72 )
+      data[i] = ' ' + ( line + column ) % 95;
+    else
+      data[i] = column == 72 ? '\r' : '\n';
+
+    socket->loopback_position++;
+  }
+
+  return length;
+}
+
+static const w5100_loopback_service_t services[] = {
+  {  7, "echo",    loopback_queue,  loopback_dequeue },
+  {  9, "discard", discard_receive, discard_transmit },
+  { 19, "chargen", discard_receive, chargen_transmit },
+};
+
+static const w5100_loopback_service_t*
+find_service( nic_w5100_socket_t *socket )
+{
+  libspectrum_word port = ( socket->dport[0] << 8 ) | socket->dport[1];
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( services ); i++ )
+    if( services[i].port == port ) return &services[i];
+
+  return NULL;
+}
+
+/* Copy length bytes from the transmit buffer, starting at Sn_TX_RR */
+static void
+tx_copy( nic_w5100_socket_t *socket, libspectrum_byte *data, int length )
+{
+  int offset = socket->tx_rr & 0x7ff;
+
+  if( offset + length <= 0x800 ) {
+    memcpy( data, &socket->tx_buffer[ offset ], length );
+  }
+  else {
+    int first_chunk = 0x800 - offset;
+    memcpy( data, &socket->tx_buffer[ offset ], first_chunk );
+    memcpy( data + first_chunk, socket->tx_buffer, length - first_chunk );
+  }
+}
+
+static void
+rx_append( nic_w5100_t *self, nic_w5100_socket_t *socket,
+           const libspectrum_byte *data, int length )
+{
+  nic_w5100_socket_rx_copy( socket, socket->rx_wr & 0x7ff, data, length );
+  w5100_atomic_set( socket->rx_wr, socket->rx_wr + length );
+  w5100_atomic_or( socket->ir, W5100_SOCKET_IR_RECV );
+  self->loopback_received += length;
+}
+
+/* Move data between an established TCP socket and its service until
+   neither side can make progress */
+static void
+loopback_pump( nic_w5100_t *self, nic_w5100_socket_t *socket )
+{
+  libspectrum_byte data[0x800];
+  int progress;
+
+  if( socket->state != W5100_SOCKET_STATE_ESTABLISHED || !socket->service )
+    return;
+
+  do {
+    libspectrum_word pending =
+      (libspectrum_word)socket->last_send - socket->tx_rr;
+    int length;
+
+    progress = 0;
+
+    if( pending ) {
+      tx_copy( socket, data, pending );
+      length = socket->service->receive( socket, data, pending );
+      if( length ) {
+        w5100_atomic_set( socket->tx_rr, socket->tx_rr + length );
+        self->loopback_sent += length;
+        if( length == pending )
+          w5100_atomic_or( socket->ir, W5100_SOCKET_IR_SEND_OK );
+        progress = 1;
+      }
+    }
+
+    length = nic_w5100_socket_rx_free( socket );
+    if( length ) {
+      length = socket->service->transmit( socket, data, length );
+      if( length ) {
+        rx_append( self, socket, data, length );
+        progress = 1;
+      }
+    }
+  } while( progress );
+}
+
+/* Hand one datagram to the service on its destination port, and deliver
+   any reply immediately. As on a real network, a datagram for a port
+   nobody is listening on, or a reply with no room to land, is lost */
+static void
+loopback_send_datagram( nic_w5100_t *self, nic_w5100_socket_t *socket )
+{
+  libspectrum_byte data[0x808];
+  libspectrum_word length = socket->tx_wr - socket->tx_rr;
+  const w5100_loopback_service_t *service = find_service( socket );
+  int reply_length, space;
+
+  tx_copy( socket, data, length );
+  w5100_atomic_set( socket->tx_rr, socket->tx_wr );
+  socket->last_send = socket->tx_wr;
+  self->loopback_sent += length;
+  w5100_atomic_or( socket->ir, W5100_SOCKET_IR_SEND_OK );
+
+  nic_w5100_debug( "w5100: socket %d sent 0x%03x byte datagram to %s\n",
+                   socket->id, length, service ? service->name : "nobody" );
+
+  if( !service ) return;
+
+  socket->loopback_length = 0;
+  service->receive( socket, data, length );
+
+  space = nic_w5100_socket_rx_free( socket ) - 8;
+  if( space <= 0 ) return;
+
+  reply_length = service->transmit( socket, data + 8, space );
+  socket->loopback_length = 0;
+  if( !reply_length ) return;
+
+  /* The W5100's UDP header: the service's address, port and the length */
+  memcpy( data, socket->dip, 4 );
+  memcpy( data + 4, socket->dport, 2 );
+  data[6] = reply_length >> 8;
+  data[7] = reply_length & 0xff;
+
+  rx_append( self, socket, data, reply_length + 8 );
+}
+
+void
+nic_w5100_loopback_command( nic_w5100_t *self, nic_w5100_socket_t *socket,
+                            libspectrum_byte command )
+{
+  switch( command ) {
+
+  case W5100_SOCKET_COMMAND_OPEN:
+    if( ( socket->mode == W5100_SOCKET_MODE_UDP ||
+          socket->mode == W5100_SOCKET_MODE_TCP ) &&
+        socket->state == W5100_SOCKET_STATE_CLOSED ) {
+      nic_w5100_socket_clean( socket );
+      socket->state = socket->mode == W5100_SOCKET_MODE_TCP ?
+        W5100_SOCKET_STATE_INIT : W5100_SOCKET_STATE_UDP;
+      nic_w5100_debug( "w5100: opened loopback socket %d\n", socket->id );
+    }
+    break;
+
+  case W5100_SOCKET_COMMAND_LISTEN:
+    /* Nothing on the virtual network initiates connections, so this will
+       wait for ever */
+    if( socket->state == W5100_SOCKET_STATE_INIT )
+      socket->state = W5100_SOCKET_STATE_LISTEN;
+    break;
+
+  case W5100_SOCKET_COMMAND_CONNECT:
+    if( socket->state == W5100_SOCKET_STATE_INIT ) {
+      socket->service = find_service( socket );
+      if( !socket->service ) {
+        nic_w5100_debug( "w5100: no loopback service for socket %d\n",
+                         socket->id );
+        socket->ir |= W5100_SOCKET_IR_TIMEOUT;
+        socket->state = W5100_SOCKET_STATE_CLOSED;
+        break;
+      }
+      nic_w5100_debug( "w5100: connected socket %d to loopback %s\n",
+                       socket->id, socket->service->name );
+      socket->loopback_length = 0;
+      socket->loopback_position = 0;
+      socket->ir |= W5100_SOCKET_IR_CON;
+      socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+      loopback_pump( self, socket );
+    }
+    break;
+
+  case W5100_SOCKET_COMMAND_DISCON:
+    if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ||
+        socket->state == W5100_SOCKET_STATE_CLOSE_WAIT ) {
+      socket->ir |= W5100_SOCKET_IR_DISCON;
+      socket->state = W5100_SOCKET_STATE_CLOSED;
+      socket->service = NULL;
+    }
+    break;
+
+  case W5100_SOCKET_COMMAND_CLOSE:
+    socket->state = W5100_SOCKET_STATE_CLOSED;
+    socket->service = NULL;
+    break;
+
+  case W5100_SOCKET_COMMAND_SEND:
+    if( socket->state == W5100_SOCKET_STATE_UDP ) {
+      loopback_send_datagram( self, socket );
+    }
+    else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
+      socket->last_send = socket->tx_wr;
+      loopback_pump( self, socket );
+    }
+    break;
+
+  case W5100_SOCKET_COMMAND_RECV:
+    if( socket->state == W5100_SOCKET_STATE_UDP ||
+        socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
+      socket->old_rx_rd = socket->rx_rd;
+      loopback_pump( self, socket );
+      if( socket->rx_wr != socket->old_rx_rd )
+        socket->ir |= W5100_SOCKET_IR_RECV;
+    }
+    break;
+
+  default:
+    ui_error( UI_ERROR_WARNING, "w5100: unknown command 0x%02x sent to socket %d\n", command, socket->id );
+    break;
+  }
+}
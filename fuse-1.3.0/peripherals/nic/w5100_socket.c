@@ -28,6 +28,7 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <pthread.h>
 #include <string.h>
 #include <sys/types.h>
@@ -40,6 +41,11 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
 #endif
 
 #include "fuse.h"
@@ -47,16 +53,6 @@
 #include "w5100.h"
 #include "w5100_internals.h"
 
-enum w5100_socket_command {
-  W5100_SOCKET_COMMAND_OPEN = 1 << 0,
-  W5100_SOCKET_COMMAND_LISTEN = 1 << 1,
-  W5100_SOCKET_COMMAND_CONNECT = 1 << 2,
-  W5100_SOCKET_COMMAND_DISCON = 1 << 3,
-  W5100_SOCKET_COMMAND_CLOSE = 1 << 4,
-  W5100_SOCKET_COMMAND_SEND = 1 << 5,
-  W5100_SOCKET_COMMAND_RECV = 1 << 6,
-};
-
 static void
 w5100_socket_init_common( nic_w5100_socket_t *socket )
 {
@@ -71,6 +67,11 @@ void
 nic_w5100_socket_init( nic_w5100_socket_t *socket, int which )
 {
   socket->id = which;
+  socket->fd_generation = 0;
+#ifdef HAVE_SYS_EPOLL_H
+  socket->epoll_generation = 0;
+  socket->readable = socket->writable = 0;
+#endif
   w5100_socket_init_common( socket );
   pthread_mutex_init( &socket->lock, NULL );
 }
@@ -104,26 +105,38 @@ w5100_socket_release_lock( nic_w5100_socket_t *socket )
   }
 }
 
-static void
-w5100_socket_clean( nic_w5100_socket_t *socket )
+void
+nic_w5100_socket_clean( nic_w5100_socket_t *socket )
 {
   socket->ir = 0;
   memset( socket->port, 0, sizeof( socket->port ) );
   memset( socket->dip, 0, sizeof( socket->dip ) );
   memset( socket->dport, 0, sizeof( socket->dport ) );
   socket->tx_rr = socket->tx_wr = 0;
-  socket->rx_rsr = 0;
+  socket->rx_wr = 0;
   socket->old_rx_rd = socket->rx_rd = 0;
 
   socket->last_send = 0;
   socket->datagram_count = 0;
 
+  socket->service = NULL;
+  socket->loopback_length = 0;
+  socket->loopback_position = 0;
+
   if( socket->fd != compat_socket_invalid ) {
     compat_socket_close( socket->fd );
     w5100_socket_init_common( socket );
+    socket->fd_generation++;
   }
 }
 
+/* The number of bytes free in the receive buffer */
+int
+nic_w5100_socket_rx_free( nic_w5100_socket_t *socket )
+{
+  return 0x800 - (libspectrum_word)( socket->rx_wr - socket->old_rx_rd );
+}
+
 void
 nic_w5100_socket_reset( nic_w5100_socket_t *socket )
 {
@@ -133,7 +146,7 @@ nic_w5100_socket_reset( nic_w5100_socket_t *socket )
   socket->flags = 0;
   socket->state = W5100_SOCKET_STATE_CLOSED;
 
-  w5100_socket_clean( socket );
+  nic_w5100_socket_clean( socket );
 
   w5100_socket_release_lock( socket );
 }
@@ -192,7 +205,7 @@ w5100_socket_open( nic_w5100_socket_t *socket_obj )
     int one = 1;
 #endif
 
-    w5100_socket_clean( socket_obj );
+    nic_w5100_socket_clean( socket_obj );
 
     socket_obj->fd = socket( AF_INET, type, protocol );
     if( socket_obj->fd == compat_socket_invalid ) {
@@ -203,6 +216,8 @@ w5100_socket_open( nic_w5100_socket_t *socket_obj )
       return;
     }
 
+    socket_obj->fd_generation++;
+
 #ifndef WIN32
     /* Windows warning: this could forcibly bind sockets already in use */
     if( setsockopt( socket_obj->fd, SOL_SOCKET, SO_REUSEADDR, &one,
@@ -266,6 +281,7 @@ w5100_socket_listen( nic_w5100_t *self, nic_w5100_socket_t *socket )
     }
 
     socket->state = W5100_SOCKET_STATE_LISTEN;
+    socket->fd_generation++;
 
     nic_w5100_debug( "w5100: listening on socket %d\n", socket->id );
 
@@ -301,6 +317,9 @@ w5100_socket_connect( nic_w5100_t *self, nic_w5100_socket_t *socket )
 
     socket->ir |= 1 << 0;
     socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+    socket->fd_generation++;
+
+    compat_socket_selfpipe_wake( self->selfpipe );
   }
 }
 
@@ -325,6 +344,7 @@ w5100_socket_close( nic_w5100_t *self, nic_w5100_socket_t *socket )
     socket->fd = compat_socket_invalid;
     socket->socket_bound = 0;
     socket->ok_for_io = 0;
+    socket->fd_generation++;
     socket->state = W5100_SOCKET_STATE_CLOSED;
     compat_socket_selfpipe_wake( self->selfpipe );
     nic_w5100_debug( "w5100: closed socket %d\n", socket->id );
@@ -357,9 +377,8 @@ w5100_socket_recv( nic_w5100_t *self, nic_w5100_socket_t *socket )
 {
   if( socket->state == W5100_SOCKET_STATE_UDP ||
     socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
-    socket->rx_rsr -= socket->rx_rd - socket->old_rx_rd;
     socket->old_rx_rd = socket->rx_rd;
-    if( socket->rx_rsr != 0 )
+    if( w5100_atomic_get( socket->rx_wr ) != socket->old_rx_rd )
       socket->ir |= 1 << 2;
     compat_socket_selfpipe_wake( self->selfpipe );
   }
@@ -370,6 +389,11 @@ w5100_write_socket_cr( nic_w5100_t *self, nic_w5100_socket_t *socket, libspectru
 {
   nic_w5100_debug( "w5100: writing 0x%02x to S%d_CR\n", b, socket->id );
 
+  if( self->loopback ) {
+    nic_w5100_loopback_command( self, socket, b );
+    return;
+  }
+
   switch( b ) {
     case W5100_SOCKET_COMMAND_OPEN:
       w5100_socket_open( socket );
@@ -404,7 +428,8 @@ w5100_write_socket_port( nic_w5100_t *self, nic_w5100_socket_t *socket, int whic
   nic_w5100_debug( "w5100: writing 0x%02x to S%d_PORT%d\n", b, socket->id, which );
   socket->port[which] = b;
   if( ++socket->bind_count == 2 ) {
-    if( socket->state == W5100_SOCKET_STATE_UDP && !socket->socket_bound ) {
+    if( socket->state == W5100_SOCKET_STATE_UDP && !socket->socket_bound &&
+        !self->loopback ) {
       if( w5100_socket_bind_port( self, socket ) ) {
         socket->bind_count = 0;
         return;
@@ -421,22 +446,22 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
   nic_w5100_socket_t *socket = &self->socket[(reg >> 8) - 4];
   int socket_reg = reg & 0xff;
   int reg_offset;
-  libspectrum_word fsr;
+  libspectrum_word fsr, rsr;
   libspectrum_byte b;
 
-  w5100_socket_acquire_lock( socket );
-
+  /* No lock here: the Z80 polls these registers constantly, and everything
+     the I/O thread changes is read atomically */
   switch( socket_reg ) {
     case W5100_SOCKET_MR:
       b = socket->mode;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_MR\n", b, socket->id );
       break;
     case W5100_SOCKET_IR:
-      b = socket->ir;
+      b = w5100_atomic_get( socket->ir );
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_IR\n", b, socket->id );
       break;
     case W5100_SOCKET_SR:
-      b = socket->state;
+      b = w5100_atomic_get( socket->state );
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_SR\n", b, socket->id );
       break;
     case W5100_SOCKET_PORT0: case W5100_SOCKET_PORT1:
@@ -445,13 +470,13 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       break;
     case W5100_SOCKET_TX_FSR0: case W5100_SOCKET_TX_FSR1:
       reg_offset = socket_reg - W5100_SOCKET_TX_FSR0;
-      fsr = 0x0800 - (socket->tx_wr - socket->tx_rr);
+      fsr = 0x0800 - (socket->tx_wr - w5100_atomic_get( socket->tx_rr ));
       b = ( fsr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_TX_FSR%d\n", b, socket->id, reg_offset );
       break;
     case W5100_SOCKET_TX_RR0: case W5100_SOCKET_TX_RR1:
       reg_offset = socket_reg - W5100_SOCKET_TX_RR0;
-      b = ( socket->tx_rr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
+      b = ( w5100_atomic_get( socket->tx_rr ) >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_TX_RR%d\n", b, socket->id, reg_offset );
       break;
     case W5100_SOCKET_TX_WR0: case W5100_SOCKET_TX_WR1:
@@ -461,7 +486,8 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       break;
     case W5100_SOCKET_RX_RSR0: case W5100_SOCKET_RX_RSR1:
       reg_offset = socket_reg - W5100_SOCKET_RX_RSR0;
-      b = ( socket->rx_rsr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
+      rsr = w5100_atomic_get( socket->rx_wr ) - socket->old_rx_rd;
+      b = ( rsr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_RX_RSR%d\n", b, socket->id, reg_offset );
       break;
     case W5100_SOCKET_RX_RD0: case W5100_SOCKET_RX_RD1:
@@ -475,8 +501,6 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       break;
   }
 
-  w5100_socket_release_lock( socket );
-
   return b;
 }
 
@@ -567,11 +591,11 @@ nic_w5100_socket_add_to_sets( nic_w5100_socket_t *socket, fd_set *readfds,
        9 bytes free in our buffer (8 byte UDP header and 1 byte of actual
        data). */
     int udp_read = socket->state == W5100_SOCKET_STATE_UDP &&
-      0x800 - socket->rx_rsr >= 9;
+      nic_w5100_socket_rx_free( socket ) >= 9;
     /* We can process a TCP read if we're in the established state and have
        any room in our buffer (no header necessary for TCP). */
     int tcp_read = socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
-      0x800 - socket->rx_rsr >= 1;
+      nic_w5100_socket_rx_free( socket ) >= 1;
 
     int tcp_listen = socket->state == W5100_SOCKET_STATE_LISTEN;
 
@@ -618,14 +642,135 @@ w5100_socket_process_accept( nic_w5100_socket_t *socket )
     nic_w5100_debug( "w5100: error attempting to close fd %d for socket %d\n", socket->fd, socket->id );
 
   socket->fd = new_fd;
-  socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+  socket->fd_generation++;
+  w5100_atomic_set( socket->state, W5100_SOCKET_STATE_ESTABLISHED );
 }
 
-static void
-w5100_socket_process_read( nic_w5100_socket_t *socket )
+/* Copy data into the receive buffer at offset, wrapping round its end */
+void
+nic_w5100_socket_rx_copy( nic_w5100_socket_t *socket, int offset,
+                          const libspectrum_byte *data, int length )
+{
+  if( offset + length <= 0x800 ) {
+    memcpy( &socket->rx_buffer[ offset ], data, length );
+  }
+  else {
+    int first_chunk = 0x800 - offset;
+    memcpy( &socket->rx_buffer[ offset ], data, first_chunk );
+    memcpy( socket->rx_buffer, data + first_chunk, length - first_chunk );
+  }
+}
+
+/* Receive up to length bytes straight into the receive buffer at offset.
+   The buffer is a ring, so describe it to the host as (at most) two
+   regions rather than bouncing the data through a linear buffer */
+static ssize_t
+w5100_socket_recv_ring( nic_w5100_socket_t *socket, int offset, int length,
+                        struct sockaddr_in *sa, int flags )
+{
+#ifndef WIN32
+  struct iovec iov[2];
+  struct msghdr msg;
+  int first_chunk = 0x800 - offset;
+
+  memset( &msg, 0, sizeof( msg ) );
+
+  iov[0].iov_base = &socket->rx_buffer[ offset ];
+  if( length > first_chunk ) {
+    iov[0].iov_len = first_chunk;
+    iov[1].iov_base = socket->rx_buffer;
+    iov[1].iov_len = length - first_chunk;
+    msg.msg_iovlen = 2;
+  }
+  else {
+    iov[0].iov_len = length;
+    msg.msg_iovlen = 1;
+  }
+  msg.msg_iov = iov;
+
+  if( sa ) {
+    msg.msg_name = sa;
+    msg.msg_namelen = sizeof( *sa );
+  }
+
+  return recvmsg( socket->fd, &msg, flags );
+#else
+  libspectrum_byte buffer[0x800];
+  ssize_t bytes_read;
+
+  if( sa ) {
+    socklen_t sa_length = sizeof( *sa );
+    bytes_read = recvfrom( socket->fd, (char*)buffer, length, flags,
+                           (struct sockaddr*)sa, &sa_length );
+  }
+  else
+    bytes_read = recv( socket->fd, (char*)buffer, length, flags );
+
+  if( bytes_read > 0 )
+    nic_w5100_socket_rx_copy( socket, offset, buffer, bytes_read );
+
+  return bytes_read;
+#endif
+}
+
+/* Send length bytes from the transmit buffer at offset, as one datagram if
+   sa is given */
+static ssize_t
+w5100_socket_send_ring( nic_w5100_socket_t *socket, int offset, int length,
+                        struct sockaddr_in *sa, int flags )
 {
+#ifndef WIN32
+  struct iovec iov[2];
+  struct msghdr msg;
+  int first_chunk = 0x800 - offset;
+
+  memset( &msg, 0, sizeof( msg ) );
+
+  iov[0].iov_base = &socket->tx_buffer[ offset ];
+  if( length > first_chunk ) {
+    iov[0].iov_len = first_chunk;
+    iov[1].iov_base = socket->tx_buffer;
+    iov[1].iov_len = length - first_chunk;
+    msg.msg_iovlen = 2;
+  }
+  else {
+    iov[0].iov_len = length;
+    msg.msg_iovlen = 1;
+  }
+  msg.msg_iov = iov;
+
+  if( sa ) {
+    msg.msg_name = sa;
+    msg.msg_namelen = sizeof( *sa );
+  }
+
+  return sendmsg( socket->fd, &msg, flags );
+#else
   libspectrum_byte buffer[0x800];
-  int bytes_free = 0x800 - socket->rx_rsr;
+  const libspectrum_byte *data = &socket->tx_buffer[ offset ];
+
+  /* If the data wraps round the write buffer, we need to coalesce it into
+     one chunk */
+  if( offset + length > 0x800 ) {
+    int first_chunk = 0x800 - offset;
+    memcpy( buffer, data, first_chunk );
+    memcpy( buffer + first_chunk, socket->tx_buffer, length - first_chunk );
+    data = buffer;
+  }
+
+  if( sa )
+    return sendto( socket->fd, (const char*)data, length, flags,
+                   (struct sockaddr*)sa, sizeof( *sa ) );
+
+  return send( socket->fd, (const char*)data, length, flags );
+#endif
+}
+
+static ssize_t
+w5100_socket_process_read( nic_w5100_socket_t *socket, int flags )
+{
+  int bytes_free = nic_w5100_socket_rx_free( socket );
+  int offset = socket->rx_wr & 0x7ff;
   ssize_t bytes_read;
   struct sockaddr_in sa;
 
@@ -634,43 +779,36 @@ w5100_socket_process_read( nic_w5100_socket_t *socket )
 
   nic_w5100_debug( "w5100: reading from socket %d\n", socket->id );
 
-  if( udp ) {
-    socklen_t sa_length = sizeof(sa);
-    bytes_read = recvfrom( socket->fd, (char*)buffer + 8, bytes_free - 8, 0,
-      (struct sockaddr*)&sa, &sa_length );
-  }
+  /* UDP data goes after the space for the W5100's 8 byte header, which we
+     can fill in only once we know the datagram's length */
+  if( udp )
+    bytes_read = w5100_socket_recv_ring( socket, ( offset + 8 ) & 0x7ff,
+                                         bytes_free - 8, &sa, flags );
   else
-    bytes_read = recv( socket->fd, (char*)buffer, bytes_free, 0 );
+    bytes_read = w5100_socket_recv_ring( socket, offset, bytes_free, NULL,
+                                         flags );
 
   nic_w5100_debug( "w5100: read 0x%03x bytes from %s socket %d\n", (int)bytes_read, description, socket->id );
 
   if( bytes_read > 0 || (udp && bytes_read == 0) ) {
-    int offset = (socket->old_rx_rd + socket->rx_rsr) & 0x7ff;
-    libspectrum_byte *dest = &socket->rx_buffer[offset];
+    libspectrum_word length = bytes_read;
 
     if( udp ) {
       /* Add the W5100's UDP header */
-      memcpy( buffer, &sa.sin_addr.s_addr, 4 );
-      memcpy( buffer + 4, &sa.sin_port, 2 );
-      buffer[6] = (bytes_read >> 8) & 0xff;
-      buffer[7] = bytes_read & 0xff;
-      bytes_read += 8;
+      libspectrum_byte header[8];
+      memcpy( header, &sa.sin_addr.s_addr, 4 );
+      memcpy( header + 4, &sa.sin_port, 2 );
+      header[6] = (bytes_read >> 8) & 0xff;
+      header[7] = bytes_read & 0xff;
+      nic_w5100_socket_rx_copy( socket, offset, header, 8 );
+      length += 8;
     }
 
-    socket->rx_rsr += bytes_read;
-    socket->ir |= 1 << 2;
-
-    if( offset + bytes_read <= 0x800 ) {
-      memcpy( dest, buffer, bytes_read );
-    }
-    else {
-      int first_chunk = 0x800 - offset;
-      memcpy( dest, buffer, first_chunk );
-      memcpy( socket->rx_buffer, buffer + first_chunk, bytes_read - first_chunk );
-    }
+    w5100_atomic_set( socket->rx_wr, socket->rx_wr + length );
+    w5100_atomic_or( socket->ir, 1 << 2 );
   }
   else if( bytes_read == 0 ) {  /* TCP */
-    socket->state = W5100_SOCKET_STATE_CLOSE_WAIT;
+    w5100_atomic_set( socket->state, W5100_SOCKET_STATE_CLOSE_WAIT );
     nic_w5100_debug( "w5100: EOF on %s socket %d; errno %d: %s\n",
                      description, socket->id, compat_socket_get_error(),
                      compat_socket_get_strerror() );
@@ -680,35 +818,26 @@ w5100_socket_process_read( nic_w5100_socket_t *socket )
                      compat_socket_get_error(), description, socket->id,
                      compat_socket_get_strerror() );
   }
+
+  return bytes_read;
 }
 
-static void
-w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
+static ssize_t
+w5100_socket_process_udp_write( nic_w5100_socket_t *socket, int flags )
 {
   ssize_t bytes_sent;
   int offset = socket->tx_rr & 0x7ff;
   libspectrum_word length = socket->datagram_lengths[0];
-  libspectrum_byte *data = &socket->tx_buffer[ offset ];
   struct sockaddr_in sa;
-  libspectrum_byte buffer[0x800];
 
   nic_w5100_debug( "w5100: writing to UDP socket %d\n", socket->id );
 
-  /* If the data wraps round the write buffer, we need to coalesce it into
-     one chunk for the call to sendto() */
-  if( offset + length > 0x800 ) {
-    int first_chunk = 0x800 - offset;
-    memcpy( buffer, data, first_chunk );
-    memcpy( buffer + first_chunk, socket->tx_buffer, length - first_chunk );
-    data = buffer;
-  }
-
   memset( &sa, 0, sizeof(sa) );
   sa.sin_family = AF_INET;
   memcpy( &sa.sin_port, socket->dport, 2 );
   memcpy( &sa.sin_addr.s_addr, socket->dip, 4 );
 
-  bytes_sent = sendto( socket->fd, (const char*)data, length, 0, (struct sockaddr*)&sa, sizeof(sa) );
+  bytes_sent = w5100_socket_send_ring( socket, offset, length, &sa, flags );
   nic_w5100_debug( "w5100: sent 0x%03x bytes of 0x%03x to UDP socket %d\n",
                    (int)bytes_sent, length, socket->id );
 
@@ -717,10 +846,10 @@ w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
       memmove( socket->datagram_lengths, &socket->datagram_lengths[1],
         0x1f * sizeof(int) );
 
-    socket->tx_rr += bytes_sent;
+    w5100_atomic_set( socket->tx_rr, socket->tx_rr + bytes_sent );
     if( socket->datagram_count == 0 ) {
       socket->write_pending = 0;
-      socket->ir |= 1 << 4;
+      w5100_atomic_or( socket->ir, 1 << 4 );
     }
   }
   else if( bytes_sent != -1 )
@@ -729,37 +858,48 @@ w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
     nic_w5100_debug( "w5100: error %d writing to UDP socket %d: %s\n",
                      compat_socket_get_error(), socket->id,
                      compat_socket_get_strerror() );
+
+  return bytes_sent;
 }
 
-static void
-w5100_socket_process_tcp_write( nic_w5100_socket_t *socket )
+static ssize_t
+w5100_socket_process_tcp_write( nic_w5100_socket_t *socket, int flags )
 {
   ssize_t bytes_sent;
   int offset = socket->tx_rr & 0x7ff;
   libspectrum_word length = socket->tx_wr - socket->tx_rr;
-  libspectrum_byte *data = &socket->tx_buffer[ offset ];
 
   nic_w5100_debug( "w5100: writing to TCP socket %d\n", socket->id );
 
-  /* If the data wraps round the write buffer, write it in two chunks */
-  if( offset + length > 0x800 )
-    length = 0x800 - offset;
-
-  bytes_sent = send( socket->fd, (const char*)data, length, 0 );
+  bytes_sent = w5100_socket_send_ring( socket, offset, length, NULL, flags );
   nic_w5100_debug( "w5100: sent 0x%03x bytes of 0x%03x to TCP socket %d\n",
                    (int)bytes_sent, length, socket->id );
 
   if( bytes_sent != -1 ) {
-    socket->tx_rr += bytes_sent;
+    w5100_atomic_set( socket->tx_rr, socket->tx_rr + bytes_sent );
     if( socket->tx_rr == socket->tx_wr ) {
       socket->write_pending = 0;
-      socket->ir |= 1 << 4;
+      w5100_atomic_or( socket->ir, 1 << 4 );
     }
   }
   else
     nic_w5100_debug( "w5100: error %d writing to TCP socket %d: %s\n",
                      compat_socket_get_error(), socket->id,
                      compat_socket_get_strerror() );
+
+  return bytes_sent;
+}
+
+/* Returns -1 on error, 0 if the socket can't currently write */
+static ssize_t
+w5100_socket_process_write( nic_w5100_socket_t *socket, int flags )
+{
+  if( socket->state == W5100_SOCKET_STATE_UDP )
+    return w5100_socket_process_udp_write( socket, flags );
+  else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED )
+    return w5100_socket_process_tcp_write( socket, flags );
+
+  return 0;
 }
 
 void
@@ -775,18 +915,148 @@ nic_w5100_socket_process_io( nic_w5100_socket_t *socket, fd_set readfds,
       if( socket->state == W5100_SOCKET_STATE_LISTEN )
         w5100_socket_process_accept( socket );
       else
-        w5100_socket_process_read( socket );
+        w5100_socket_process_read( socket, 0 );
+    }
+
+    if( FD_ISSET( socket->fd, &writefds ) )
+      w5100_socket_process_write( socket, 0 );
+  }
+
+  w5100_socket_release_lock( socket );
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/* (Re-)register the socket's descriptor with the I/O thread's epoll set if
+   it has changed since we last looked */
+void
+nic_w5100_socket_epoll_update( nic_w5100_socket_t *socket, int epoll_fd )
+{
+  struct epoll_event event;
+
+  w5100_socket_acquire_lock( socket );
+
+  if( socket->epoll_generation != socket->fd_generation ) {
+
+    /* A replaced descriptor left the set when it was closed. Re-adding the
+       current one makes the kernel report its readiness afresh, which we
+       need as we're edge-triggered and the socket may have changed role */
+    socket->epoll_generation = socket->fd_generation;
+    socket->readable = socket->writable = 0;
+
+    if( socket->fd != compat_socket_invalid ) {
+      event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+      event.data.u64 =
+        ( (libspectrum_qword)socket->fd_generation << 32 ) | socket->id;
+
+      epoll_ctl( epoll_fd, EPOLL_CTL_DEL, socket->fd, &event );
+      if( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, socket->fd, &event ) == -1 )
+        nic_w5100_debug( "w5100: error %d adding fd %d for socket %d to epoll set: %s\n",
+                         compat_socket_get_error(), socket->fd, socket->id,
+                         compat_socket_get_strerror() );
     }
+  }
 
-    if( FD_ISSET( socket->fd, &writefds ) ) {
-      if( socket->state == W5100_SOCKET_STATE_UDP ) {
-        w5100_socket_process_udp_write( socket );
+  w5100_socket_release_lock( socket );
+}
+
+/* Note readiness reported for the socket, ignoring any which belongs to a
+   descriptor registered before the socket last changed */
+void
+nic_w5100_socket_epoll_event( nic_w5100_socket_t *socket,
+  libspectrum_dword events, unsigned int generation )
+{
+  w5100_socket_acquire_lock( socket );
+
+  if( generation == socket->fd_generation ) {
+    /* Errors and hangups are picked up by the next recv() or send() */
+    if( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) )
+      socket->readable = 1;
+    if( events & ( EPOLLOUT | EPOLLERR ) )
+      socket->writable = 1;
+  }
+
+  w5100_socket_release_lock( socket );
+}
+
+/* The host has refused the pending data for good (say the destination is
+   unreachable) rather than because the socket would block, so no further
+   writability edge will come for it. Drop it and report a timeout, as the
+   W5100 does when it gives up on a send */
+static void
+w5100_socket_discard_write( nic_w5100_socket_t *socket )
+{
+  if( socket->state == W5100_SOCKET_STATE_UDP ) {
+    libspectrum_word length = socket->datagram_lengths[0];
+
+    if( --socket->datagram_count )
+      memmove( socket->datagram_lengths, &socket->datagram_lengths[1],
+        0x1f * sizeof(int) );
+
+    w5100_atomic_set( socket->tx_rr, socket->tx_rr + length );
+    if( socket->datagram_count ) return;
+  }
+  else
+    w5100_atomic_set( socket->tx_rr, socket->tx_wr );
+
+  socket->write_pending = 0;
+  w5100_atomic_or( socket->ir, W5100_SOCKET_IR_TIMEOUT );
+}
+
+/* Move as much data as we can. Readiness is edge-triggered, so it is only
+   forgotten once the host tells us the socket would block; a full receive
+   buffer leaves it noted for when the RECV command frees some space */
+void
+nic_w5100_socket_epoll_process( nic_w5100_socket_t *socket )
+{
+  w5100_socket_acquire_lock( socket );
+
+  if( socket->fd != compat_socket_invalid &&
+      socket->epoll_generation == socket->fd_generation ) {
+
+    if( socket->readable ) {
+      if( socket->state == W5100_SOCKET_STATE_LISTEN ) {
+        socket->readable = 0;
+        w5100_socket_process_accept( socket );
       }
-      else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
-        w5100_socket_process_tcp_write( socket );
+      else {
+        while( socket->readable ) {
+          int min_free;
+          ssize_t bytes_read;
+
+          if( socket->state == W5100_SOCKET_STATE_UDP )
+            min_free = 9;
+          else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED )
+            min_free = 1;
+          else
+            break;
+
+          if( nic_w5100_socket_rx_free( socket ) < min_free ) break;
+
+          bytes_read = w5100_socket_process_read( socket, MSG_DONTWAIT );
+          if( bytes_read == -1 || ( bytes_read == 0 &&
+              socket->state != W5100_SOCKET_STATE_UDP ) )
+            socket->readable = 0;
+        }
+      }
+    }
+
+    while( socket->writable && socket->write_pending ) {
+      ssize_t bytes_sent = w5100_socket_process_write( socket, MSG_DONTWAIT );
+      if( bytes_sent == 0 ) break;
+      if( bytes_sent == -1 ) {
+        int error = compat_socket_get_error();
+
+        /* Only a socket which would block gets another edge */
+        if( error == EAGAIN || error == EWOULDBLOCK )
+          socket->writable = 0;
+        else
+          w5100_socket_discard_write( socket );
       }
     }
   }
 
   w5100_socket_release_lock( socket );
 }
+
+#endif				/* #ifdef HAVE_SYS_EPOLL_H */
@@ -42,6 +42,7 @@
 #include "periph.h"
 #include "scld.h"
 #include "spectrum.h"
+#include "statesave.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
 
@@ -89,6 +90,10 @@ scld_init( void *context )
   module_register( &scld_module_info );
   periph_register( PERIPH_TYPE_SCLD, &scld_periph );
 
+  statesave_register( &scld_last_dec, sizeof( scld_last_dec ) );
+  statesave_register( &scld_last_hsr, sizeof( scld_last_hsr ) );
+  statesave_register( timex_home, sizeof( timex_home ) );
+
   return 0;
 }
 
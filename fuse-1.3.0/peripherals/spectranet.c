@@ -26,11 +26,14 @@
 
 #include <config.h>
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "compat.h"
 #include "debugger/debugger.h"
 #include "flash/am29f010.h"
+#include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
 #include "memory.h"
@@ -92,6 +95,12 @@ static int spectranet_source;
 static const char * const event_type_string = "spectranet";
 static int page_event, unpage_event;
 
+/* How long the loopback network has been in use, for reporting its
+   throughput when we exit */
+static int loopback_active = 0;
+static libspectrum_qword loopback_frames = 0;
+static double loopback_seconds = 0;
+
 void
 spectranet_page( int via_io )
 {
@@ -152,6 +161,8 @@ spectranet_map_page( int dest, int source )
     case 1: spectranet_w5100_paged_a = w5100_page; break;
     case 2: spectranet_w5100_paged_b = w5100_page; break;
   }
+
+  memory_update_handlers();
 }
 
 static void
@@ -187,9 +198,38 @@ spectranet_reset( int hard_reset )
     machine_current->memory_map();
   }
 
+  loopback_active = settings_current.spectranet_loopback;
+  nic_w5100_set_loopback( w5100, loopback_active );
   nic_w5100_reset( w5100 );
 }
 
+void
+spectranet_frame( libspectrum_dword frame_length )
+{
+  if( !loopback_active ) return;
+
+  loopback_frames++;
+  loopback_seconds +=
+    (double)frame_length / machine_current->timings.processor_speed;
+}
+
+static void
+spectranet_loopback_report( void )
+{
+  libspectrum_qword received, sent;
+
+  if( !settings_current.spectranet_loopback_profile || !loopback_frames )
+    return;
+
+  nic_w5100_loopback_stats( w5100, &received, &sent );
+
+  fprintf( stderr, "%s: Spectranet loopback: %" PRIu64 " bytes received "
+           "and %" PRIu64 " sent in %" PRIu64 " frames (%.1f bytes/frame, "
+           "%.0f bytes/s)\n", fuse_progname, received, sent, loopback_frames,
+           (double)( received + sent ) / loopback_frames,
+           loopback_seconds > 0 ? ( received + sent ) / loopback_seconds : 0 );
+}
+
 static void
 spectranet_memory_map( void )
 {
@@ -460,6 +500,7 @@ spectranet_init( void *context )
 static void
 spectranet_end( void )
 {
+  spectranet_loopback_report();
   nic_w5100_free( w5100 );
   flash_am29f010_free( flash_rom );
 }
@@ -548,6 +589,11 @@ spectranet_nmi_flipflop( void )
   return 0;
 }
 
+void
+spectranet_frame( libspectrum_dword frame_length GCC_UNUSED )
+{
+}
+
 libspectrum_byte
 spectranet_w5100_read( memory_page *page GCC_UNUSED,
                        libspectrum_word address GCC_UNUSED )
@@ -34,6 +34,8 @@ void spectranet_retn( void );
 
 int spectranet_nmi_flipflop( void );
 
+void spectranet_frame( libspectrum_dword frame_length );
+
 libspectrum_byte spectranet_w5100_read( memory_page *page, libspectrum_word address );
 void spectranet_w5100_write( memory_page *page, libspectrum_word address, libspectrum_byte b );
 void spectranet_flash_rom_write( libspectrum_word address, libspectrum_byte b );
@@ -42,6 +42,7 @@
 #include "settings.h"
 #include "sound.h"
 #include "spectrum.h"
+#include "statesave.h"
 #include "tape.h"
 #include "ula.h"
 
@@ -50,6 +51,8 @@ static libspectrum_byte last_byte;
 libspectrum_byte ula_contention[ ULA_CONTENTION_SIZE ];
 libspectrum_byte ula_contention_no_mreq[ ULA_CONTENTION_SIZE ];
 
+libspectrum_dword ula_contention_start, ula_contention_end;
+
 /* What to return if no other input pressed; depends on the last byte
    output to the ULA; see CSS FAQ | Technical Information | Port #FE
    for full details */
@@ -163,6 +166,8 @@ ula_init( void *context )
 
   ula_default_value = 0xff;
 
+  statesave_register( &last_byte, sizeof( last_byte ) );
+
   return 0;
 }
 
@@ -185,6 +190,8 @@ ula_read( libspectrum_word port, libspectrum_byte *attached )
 
   *attached = 0xff;
 
+  if( tape_playing ) tape_update( tstates );
+
   loader_detect_loader();
 
   r &= keyboard_read( port >> 8 );
@@ -200,6 +207,7 @@ ula_write( libspectrum_word port GCC_UNUSED, libspectrum_byte b )
   last_byte = b;
 
   display_set_lores_border( b & 0x07 );
+  if( tape_playing ) tape_update( tstates );
   sound_beeper( tstates,
                 (!!(b & 0x10) << 1) + ( (!(b & 0x8)) | tape_microphone ) );
 
@@ -255,6 +263,23 @@ ula_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_issue2( snap, settings_current.issue2 );
 }  
 
+/* Find the part of the frame in which the contention arrays are
+   non-zero; called whenever they are recalculated */
+void
+ula_contention_update_window( void )
+{
+  libspectrum_dword i;
+
+  ula_contention_start = ula_contention_end = 0;
+
+  for( i = 0; i < ULA_CONTENTION_SIZE; i++ ) {
+    if( ula_contention[ i ] || ula_contention_no_mreq[ i ] ) {
+      if( ula_contention_end == 0 ) ula_contention_start = i;
+      ula_contention_end = i + 1;
+    }
+  }
+}
+
 void
 ula_contend_port_early( libspectrum_word port )
 {
@@ -34,6 +34,12 @@ extern libspectrum_byte ula_contention[ ULA_CONTENTION_SIZE ];
 /* And how much when it is inactive */
 extern libspectrum_byte ula_contention_no_mreq[ ULA_CONTENTION_SIZE ];
 
+/* The range of tstates [start,end) outside which both of the above are
+   zero, so no memory access can be contended */
+extern libspectrum_dword ula_contention_start, ula_contention_end;
+
+void ula_contention_update_window( void );
+
 void ula_register_startup( void );
 
 libspectrum_byte ula_last_byte( void );
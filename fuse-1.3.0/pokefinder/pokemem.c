@@ -33,6 +33,7 @@
 #include "memory.h"
 #include "pokemem.h"
 #include "spectrum.h"
+#include "statehash.h"
 #include "utils.h"
 
 enum {
@@ -413,6 +414,7 @@ pokemem_poke_activate( gpointer data, gpointer user_data )
     address &= 0x3fff;
     poke->restore = RAM[ bank ][ address ];
     RAM[ bank ][ address ] = value;
+    statehash_ram_written( bank );
   }
 }
 
@@ -441,6 +443,7 @@ pokemem_poke_deactivate( gpointer data, gpointer user_data GCC_UNUSED )
     writebyte_internal( address, value );
   } else {
     RAM[ bank ][ address & 0x3fff ] = value;
+    statehash_ram_written( bank );
   }
 
 }
@@ -25,6 +25,7 @@
 
 #include <config.h>
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -33,16 +34,101 @@
 #include "event.h"
 #include "infrastructure/startup_manager.h"
 #include "fuse.h"
+#include "memory.h"
 #include "module.h"
 #include "profile.h"
+#include "settings.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
 
 int profile_active = 0;
 
-static int total_tstates[ 0x10000 ];
+/* How deep a call stack we track; calls beyond this are still costed
+   as exclusive time, but don't get their own call graph edge */
+#define PROFILE_STACK_DEPTH 256
+
+/* The function index used for code executed outside any tracked call */
+#define PROFILE_TOP_LEVEL 0
+
+/* Per-instruction costs for one MEMORY_PAGE_SIZE chunk of a memory source */
+typedef struct profile_block_t {
+
+  int source;
+  int page_num;
+  libspectrum_word offset;	/* Offset of this chunk into the page */
+
+  libspectrum_qword tstates[ MEMORY_PAGE_SIZE ];
+
+  /* The function each instruction was first executed in, or -1 if it has
+     never been executed */
+  int function[ MEMORY_PAGE_SIZE ];
+
+} profile_block_t;
+
+/* A call graph edge from one function to another */
+typedef struct profile_call_t {
+
+  int callee;
+  libspectrum_word site;	/* Offset of the calling instruction */
+  libspectrum_dword count;
+  libspectrum_qword inclusive;
+
+} profile_call_t;
+
+typedef struct profile_function_t {
+
+  int source;			/* -1 for the top level pseudo-function */
+  int page_num;
+  libspectrum_word offset;	/* Entry point within the page */
+
+  GArray *calls;		/* profile_call_t edges out of this function */
+
+} profile_function_t;
+
+typedef struct profile_frame_t {
+
+  int function;
+  int caller;
+  guint call;			/* Index into the caller's edge list */
+  libspectrum_word sp;		/* SP just after the return address was
+				   pushed */
+  libspectrum_qword entry;	/* profile_clock() at entry */
+
+} profile_frame_t;
+
+/* Cache of which block is mapped into each slot of the Z80 address space,
+   so the common case doesn't need a hash lookup */
+typedef struct profile_slot_t {
+
+  const libspectrum_byte *page;
+  int source;
+  int page_num;
+  libspectrum_word offset;
+  profile_block_t *block;
+
+} profile_slot_t;
+
+static GHashTable *profile_blocks;
+static GHashTable *profile_function_index;
+static GArray *profile_functions;
+static profile_slot_t profile_slots[ MEMORY_PAGES_IN_64K ];
+
+static profile_frame_t profile_stack[ PROFILE_STACK_DEPTH ];
+static size_t profile_depth;
+
+/* Total tstates seen since profiling started, unaffected by the frame
+   wraparound of tstates, is profile_clock_base + tstates */
+static libspectrum_qword profile_clock_base;
+
+/* Costs are sampled: once at least profile_period tstates have passed, the
+   time since the last sample is charged to the instruction which was
+   running. A period of 1 samples every instruction, so is exact */
+static libspectrum_dword profile_period;
+static libspectrum_dword profile_next_sample;
+static libspectrum_qword profile_last_sample;
+
 static libspectrum_word profile_last_pc;
-static libspectrum_dword profile_last_tstates;
+static libspectrum_word profile_last_sp;
 
 static void profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED );
 
@@ -64,26 +150,279 @@ profile_init( void *context )
   return 0;
 }
 
+static void
+free_function( profile_function_t *function )
+{
+  g_array_free( function->calls, TRUE );
+}
+
+static void
+profile_free( void )
+{
+  guint i;
+
+  if( profile_blocks ) {
+    g_hash_table_destroy( profile_blocks );
+    profile_blocks = NULL;
+  }
+
+  if( profile_function_index ) {
+    g_hash_table_destroy( profile_function_index );
+    profile_function_index = NULL;
+  }
+
+  if( profile_functions ) {
+    for( i = 0; i < profile_functions->len; i++ )
+      free_function( &g_array_index( profile_functions, profile_function_t,
+                                     i ) );
+    g_array_free( profile_functions, TRUE );
+    profile_functions = NULL;
+  }
+
+  memset( profile_slots, 0, sizeof( profile_slots ) );
+  profile_depth = 0;
+}
+
+static void
+profile_end( void )
+{
+  profile_free();
+}
+
 void
 profile_register_startup( void )
 {
   startup_manager_module dependencies[] = { STARTUP_MANAGER_MODULE_SETUID };
   startup_manager_register( STARTUP_MANAGER_MODULE_PROFILE, dependencies,
                             ARRAY_SIZE( dependencies ), profile_init, NULL,
-                            NULL );
+                            profile_end );
+}
+
+/* Pack a (source, page, offset) triple into a hash key */
+static libspectrum_dword
+profile_key( int source, int page_num, libspectrum_word offset )
+{
+  return ( (libspectrum_dword)source << 25 ) |
+         ( (libspectrum_dword)( page_num & 0x1ff ) << 16 ) | offset;
+}
+
+static profile_block_t*
+block_find( libspectrum_word pc )
+{
+  size_t slot_num = pc >> MEMORY_PAGE_SIZE_LOGARITHM;
+  memory_page *mapping = &memory_map_read[ slot_num ];
+  profile_slot_t *slot = &profile_slots[ slot_num ];
+  profile_block_t *block;
+  libspectrum_dword key;
+  int i;
+
+  if( slot->block && slot->page == mapping->page &&
+      slot->source == mapping->source && slot->page_num == mapping->page_num &&
+      slot->offset == mapping->offset )
+    return slot->block;
+
+  key = profile_key( mapping->source, mapping->page_num, mapping->offset );
+  block = g_hash_table_lookup( profile_blocks, GUINT_TO_POINTER( key ) );
+
+  if( !block ) {
+    block = libspectrum_new( profile_block_t, 1 );
+    block->source = mapping->source;
+    block->page_num = mapping->page_num;
+    block->offset = mapping->offset;
+    memset( block->tstates, 0, sizeof( block->tstates ) );
+    for( i = 0; i < MEMORY_PAGE_SIZE; i++ ) block->function[ i ] = -1;
+
+    g_hash_table_insert( profile_blocks, GUINT_TO_POINTER( key ), block );
+  }
+
+  slot->page = mapping->page;
+  slot->source = mapping->source;
+  slot->page_num = mapping->page_num;
+  slot->offset = mapping->offset;
+  slot->block = block;
+
+  return block;
+}
+
+static int
+function_add( int source, int page_num, libspectrum_word offset )
+{
+  profile_function_t function;
+
+  function.source = source;
+  function.page_num = page_num;
+  function.offset = offset;
+  function.calls = g_array_new( FALSE, FALSE, sizeof( profile_call_t ) );
+
+  g_array_append_val( profile_functions, function );
+
+  return profile_functions->len - 1;
+}
+
+static int
+function_find( libspectrum_word pc )
+{
+  memory_page *mapping =
+    &memory_map_read[ pc >> MEMORY_PAGE_SIZE_LOGARITHM ];
+  libspectrum_word offset = mapping->offset + ( pc & MEMORY_PAGE_SIZE_MASK );
+  libspectrum_dword key =
+    profile_key( mapping->source, mapping->page_num, offset );
+  gpointer index;
+  int function;
+
+  if( g_hash_table_lookup_extended( profile_function_index,
+                                    GUINT_TO_POINTER( key ), NULL, &index ) )
+    return GPOINTER_TO_INT( index );
+
+  function = function_add( mapping->source, mapping->page_num, offset );
+  g_hash_table_insert( profile_function_index, GUINT_TO_POINTER( key ),
+                       GINT_TO_POINTER( function ) );
+
+  return function;
+}
+
+static int
+current_function( void )
+{
+  return profile_depth ? profile_stack[ profile_depth - 1 ].function
+                       : PROFILE_TOP_LEVEL;
+}
+
+static libspectrum_qword
+profile_clock( libspectrum_dword now )
+{
+  return profile_clock_base + now;
+}
+
+/* Enter a function at 'pc' from the call site 'site' */
+static void
+frame_push( libspectrum_word pc, libspectrum_word sp, libspectrum_word site )
+{
+  profile_function_t *caller;
+  profile_frame_t *frame;
+  profile_call_t *call, new_call;
+  int callee;
+  guint i;
+
+  if( profile_depth == PROFILE_STACK_DEPTH ) return;
+
+  callee = function_find( pc );
+  frame = &profile_stack[ profile_depth ];
+  frame->caller = current_function();
+
+  caller = &g_array_index( profile_functions, profile_function_t,
+                           frame->caller );
+
+  for( i = 0; i < caller->calls->len; i++ ) {
+    call = &g_array_index( caller->calls, profile_call_t, i );
+    if( call->callee == callee && call->site == site ) break;
+  }
+
+  if( i == caller->calls->len ) {
+    new_call.callee = callee;
+    new_call.site = site;
+    new_call.count = 0;
+    new_call.inclusive = 0;
+    g_array_append_val( caller->calls, new_call );
+  }
+
+  g_array_index( caller->calls, profile_call_t, i ).count++;
+
+  frame->function = callee;
+  frame->call = i;
+  frame->sp = sp;
+  frame->entry = profile_clock( tstates );
+
+  profile_depth++;
+}
+
+static void
+frame_pop( void )
+{
+  profile_frame_t *frame = &profile_stack[ --profile_depth ];
+  profile_function_t *caller =
+    &g_array_index( profile_functions, profile_function_t, frame->caller );
+
+  g_array_index( caller->calls, profile_call_t, frame->call ).inclusive +=
+    profile_clock( tstates ) - frame->entry;
+}
+
+/* Charge the time since the last sample to the instruction at
+   profile_last_pc. Its block is found through the memory map as it is now,
+   so an instruction which pages itself out has its last sample charged to
+   whatever replaced it */
+static void
+profile_sample( libspectrum_dword now )
+{
+  profile_block_t *block = block_find( profile_last_pc );
+  libspectrum_word index = profile_last_pc & MEMORY_PAGE_SIZE_MASK;
+  libspectrum_qword clock = profile_clock( now );
+
+  block->tstates[ index ] += clock - profile_last_sample;
+  if( block->function[ index ] == -1 )
+    block->function[ index ] = current_function();
+
+  profile_last_sample = clock;
+  profile_next_sample = now + profile_period;
+}
+
+/* The instruction at profile_last_pc left the stack pointer at 'sp', with
+   execution continuing at 'pc' */
+static void
+profile_stack_moved( libspectrum_word sp, libspectrum_word pc )
+{
+  libspectrum_byte opcode;
+  memory_page *mapping;
+
+  /* CALL nn, CALL cc,nn and RST n push a return address */
+  if( sp == (libspectrum_word)( profile_last_sp - 2 ) ) {
+    opcode = readbyte_internal( profile_last_pc );
+    if( opcode == 0xcd || ( opcode & 0xc7 ) == 0xc4 ||
+        ( opcode & 0xc7 ) == 0xc7 ) {
+      mapping = &memory_map_read[ profile_last_pc >> MEMORY_PAGE_SIZE_LOGARITHM ];
+      frame_push( pc, sp,
+                  mapping->offset + ( profile_last_pc & MEMORY_PAGE_SIZE_MASK ) );
+      profile_last_sp = sp;
+      return;
+    }
+  }
+
+  /* Anything which moves the stack pointer above a frame's return address
+     (RET, RETI, RETN, POP, LD SP,nn, ...) means that frame has finished */
+  while( profile_depth &&
+         (libspectrum_signed_word)( sp - profile_stack[ profile_depth - 1 ].sp ) > 0 )
+    frame_pop();
+
+  profile_last_sp = sp;
 }
 
 static void
 init_profiling_counters( void )
 {
+  /* Keep the clock running on from the last sample, even if tstates has
+     jumped */
+  profile_clock_base = profile_last_sample - tstates;
+  profile_next_sample = tstates + profile_period;
+
+  while( profile_depth ) frame_pop();
+
   profile_last_pc = z80.pc.w;
-  profile_last_tstates = tstates;
+  profile_last_sp = z80.sp.w;
 }
 
 void
 profile_start( void )
 {
-  memset( total_tstates, 0, sizeof( total_tstates ) );
+  profile_free();
+
+  profile_blocks = g_hash_table_new_full( NULL, NULL, NULL, libspectrum_free );
+  profile_function_index = g_hash_table_new( NULL, NULL );
+  profile_functions = g_array_new( FALSE, FALSE, sizeof( profile_function_t ) );
+  function_add( -1, 0, 0 );		/* PROFILE_TOP_LEVEL */
+
+  profile_last_sample = 0;
+  profile_period = settings_current.profile_period > 0 ?
+                   settings_current.profile_period : 1;
 
   profile_active = 1;
   init_profiling_counters();
@@ -96,21 +435,49 @@ profile_start( void )
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 1 );
 }
 
+/* Called before every instruction, so kept to a couple of compares unless
+   the stack has moved or a sample is due */
 void
 profile_map( libspectrum_word pc )
 {
-  if( tstates - profile_last_tstates > 256 ) fuse_abort();
+  if( (libspectrum_signed_dword)( tstates - profile_next_sample ) >= 0 )
+    profile_sample( tstates );
+
+  if( z80.sp.w != profile_last_sp ) profile_stack_moved( z80.sp.w, pc );
+
+  profile_last_pc = pc;
+}
+
+/* Called after an interrupt or NMI has pushed the return address and
+   loaded PC with the handler's address; 'start' is when the acknowledge
+   cycle began */
+void
+profile_interrupt( libspectrum_dword start )
+{
+  libspectrum_word interrupted =
+    readbyte_internal( z80.sp.w ) | ( readbyte_internal( z80.sp.w + 1 ) << 8 );
 
-  total_tstates[ profile_last_pc ] += tstates - profile_last_tstates;
+  /* Finish off the instruction before the interrupt, which may itself
+     have been a call to 'interrupted' */
+  if( (libspectrum_signed_dword)( start - profile_next_sample ) >= 0 )
+    profile_sample( start );
 
+  if( (libspectrum_word)( z80.sp.w + 2 ) != profile_last_sp )
+    profile_stack_moved( z80.sp.w + 2, interrupted );
+
+  frame_push( z80.pc.w, z80.sp.w, interrupted );
+
+  /* The acknowledge cycle is charged to the first instruction of the
+     handler */
   profile_last_pc = z80.pc.w;
-  profile_last_tstates = tstates;
+  profile_last_sp = z80.sp.w;
 }
 
 void
 profile_frame( libspectrum_dword frame_length )
 {
-  profile_last_tstates -= frame_length;
+  profile_clock_base += frame_length;
+  profile_next_sample -= frame_length;
 }
 
 /* On snapshot load, PC and the tstate counter will jump so reset our
@@ -118,14 +485,148 @@ profile_frame( libspectrum_dword frame_length )
 static void
 profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED )
 {
-  init_profiling_counters();
+  if( profile_active ) init_profiling_counters();
+}
+
+/* One instruction's exclusive cost, collected for output */
+typedef struct profile_cost_t {
+
+  int function;
+  libspectrum_word offset;
+  libspectrum_qword tstates;
+
+} profile_cost_t;
+
+static void
+collect_costs( gpointer key GCC_UNUSED, gpointer value, gpointer user_data )
+{
+  profile_block_t *block = value;
+  GArray *costs = user_data;
+  profile_cost_t cost;
+  size_t i;
+
+  for( i = 0; i < MEMORY_PAGE_SIZE; i++ ) {
+
+    if( !block->tstates[ i ] ) continue;
+
+    cost.function = block->function[ i ];
+    cost.offset = block->offset + i;
+    cost.tstates = block->tstates[ i ];
+    g_array_append_val( costs, cost );
+
+  }
+}
+
+static int
+compare_costs( const void *a, const void *b )
+{
+  const profile_cost_t *cost1 = a, *cost2 = b;
+
+  if( cost1->function != cost2->function )
+    return cost1->function < cost2->function ? -1 : 1;
+
+  return (int)cost1->offset - (int)cost2->offset;
+}
+
+static void
+write_object( FILE *f, const char *prefix, profile_function_t *function )
+{
+  if( function->source == -1 ) {
+    fprintf( f, "%s=(none)\n", prefix );
+  } else {
+    fprintf( f, "%s=%s %d\n", prefix,
+             memory_source_description( function->source ),
+             function->page_num );
+  }
+}
+
+static void
+write_function( FILE *f, const char *prefix, profile_function_t *function )
+{
+  if( function->source == -1 ) {
+    fprintf( f, "%s=(top level)\n", prefix );
+  } else {
+    fprintf( f, "%s=%s %d:0x%04x\n", prefix,
+             memory_source_description( function->source ),
+             function->page_num, function->offset );
+  }
+}
+
+/* Write the profile in the callgrind format, which can be read by
+   KCachegrind and friends. Positions are offsets into the memory page
+   named by the "ob" (object) line */
+static void
+write_callgrind( FILE *f )
+{
+  profile_function_t *function, *callee;
+  profile_call_t *call;
+  profile_cost_t *cost;
+  GArray *costs;
+  guint i, j;
+  int last_function = -1;
+
+  costs = g_array_new( FALSE, FALSE, sizeof( profile_cost_t ) );
+  g_hash_table_foreach( profile_blocks, collect_costs, costs );
+  qsort( costs->data, costs->len, sizeof( profile_cost_t ), compare_costs );
+
+  fprintf( f, "# callgrind format\n" );
+  fprintf( f, "version: 1\n" );
+  fprintf( f, "creator: " PACKAGE_STRING "\n" );
+  fprintf( f, "positions: instr\n" );
+  fprintf( f, "events: Tstates\n" );
+  fprintf( f, "summary: %" PRIu64 "\n\n", (uint64_t)profile_last_sample );
+
+  for( i = 0; i < costs->len; i++ ) {
+
+    cost = &g_array_index( costs, profile_cost_t, i );
+
+    if( cost->function != last_function ) {
+      function = &g_array_index( profile_functions, profile_function_t,
+                                 cost->function );
+      fprintf( f, "\n" );
+      write_object( f, "ob", function );
+      write_function( f, "fn", function );
+      last_function = cost->function;
+    }
+
+    fprintf( f, "0x%04x %" PRIu64 "\n", cost->offset,
+             (uint64_t)cost->tstates );
+
+  }
+
+  /* Call graph edges can be given in any order, as long as they follow an
+     "fn" line for their caller */
+  for( i = 0; i < profile_functions->len; i++ ) {
+
+    function = &g_array_index( profile_functions, profile_function_t, i );
+    if( !function->calls->len ) continue;
+
+    fprintf( f, "\n" );
+    write_object( f, "ob", function );
+    write_function( f, "fn", function );
+
+    for( j = 0; j < function->calls->len; j++ ) {
+      call = &g_array_index( function->calls, profile_call_t, j );
+      callee = &g_array_index( profile_functions, profile_function_t,
+                               call->callee );
+
+      write_object( f, "cob", callee );
+      write_function( f, "cfn", callee );
+      fprintf( f, "calls=%lu 0x%04x\n", (unsigned long)call->count,
+               callee->offset );
+      fprintf( f, "0x%04x %" PRIu64 "\n", call->site,
+               (uint64_t)call->inclusive );
+    }
+
+  }
+
+  g_array_free( costs, TRUE );
 }
 
 void
 profile_finish( const char *filename )
 {
   FILE *f;
-  size_t i;
 
   f = fopen( filename, "w" );
   if( !f ) {
@@ -134,17 +635,16 @@ profile_finish( const char *filename )
     return;
   }
 
-  for( i = 0; i < 0x10000; i++ ) {
-
-    if( !total_tstates[ i ] ) continue;
+  /* Anything still on the stack is charged up to now */
+  profile_sample( tstates );
+  while( profile_depth ) frame_pop();
 
-    fprintf( f, "0x%04lx,%d\n", (unsigned long)i, total_tstates[ i ] );
-
-  }
+  write_callgrind( f );
 
   fclose( f );
 
   profile_active = 0;
+  profile_free();
 
   /* Again, schedule an event to ensure this change is picked up by
      the main loop */
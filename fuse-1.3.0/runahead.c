@@ -0,0 +1,228 @@
+/* runahead.c: Showing the screen from a few frames in the future
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* At the end of every frame, the machine state is saved, the next
+   `run_ahead' frames are emulated unseen and unheard with the input as it
+   stands, and the last of them is shown in place of the frame which was
+   really emulated. The state is then restored, and the emulation carries
+   on from where it really was. A game which reads the keyboard once a
+   frame so appears to respond that many frames sooner */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "debugger/debugger.h"
+#include "display.h"
+#include "event.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "netplay.h"
+#include "periph.h"
+#include "profile.h"
+#include "psg.h"
+#include "runahead.h"
+#include "rzx.h"
+#include "settings.h"
+#include "statesave.h"
+#include "tape.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+#include "z80/z80.h"
+
+#define RUNAHEAD_MAX_FRAMES 8
+
+int runahead_active = 0;
+
+static statesave_state *state = NULL;
+
+/* Set while the frames ahead are being emulated */
+static int running = 0;
+static unsigned long frames_run;
+
+/* Totals for --run-ahead-profile, in seconds */
+static unsigned long profile_frames, profile_frames_ahead;
+static double profile_save, profile_emulate, profile_restore;
+
+/* Printers would print everything run ahead as well */
+static const periph_type printers[] = {
+  PERIPH_TYPE_PARALLEL_PRINTER,
+  PERIPH_TYPE_ZXPRINTER,
+  PERIPH_TYPE_ZXPRINTER_FULL_DECODE,
+};
+
+/* How many frames to run ahead from the current state */
+static int
+frames_ahead( void )
+{
+  int frames = settings_current.run_ahead;
+  size_t i;
+
+  if( frames <= 0 ) return 0;
+  if( frames > RUNAHEAD_MAX_FRAMES ) frames = RUNAHEAD_MAX_FRAMES;
+
+  /* The tape, the debugger and the various recordings would see the frames
+     ahead as if they had really happened, and netplay has its own idea of
+     which frame is which. A stopped tape is frozen while running ahead,
+     so the traps and loader detection only ever act on the real frames */
+  if( tape_is_playing() || debugger_mode != DEBUGGER_MODE_INACTIVE ||
+      profile_active || rzx_recording || rzx_playback || psg_recording ||
+      netplay_active )
+    return 0;
+
+  for( i = 0; i < ARRAY_SIZE( printers ); i++ )
+    if( periph_is_active( printers[i] ) ) return 0;
+
+  /* Copying the state through a snapshot every frame is far too slow */
+  if( !statesave_fast() ) return 0;
+
+  return frames;
+}
+
+/* Run the emulation until the end of the current frame */
+static void
+run_frame( void )
+{
+  unsigned long start = frames_run;
+
+  while( frames_run == start ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+}
+
+void
+runahead_frame( void )
+{
+  int was_active, frames, i;
+  double start, saved, emulated;
+
+  if( running ) {
+    frames_run++;
+    return;
+  }
+
+  /* Someone else is emulating frames unseen */
+  if( fuse_emulation_hidden ) return;
+
+  was_active = runahead_active;
+  frames = frames_ahead();
+  runahead_active = frames > 0;
+
+  /* The frame just emulated has already been shown */
+  if( !was_active ) return;
+
+  if( !frames ) {
+    display_show_frame();
+    return;
+  }
+
+  start = timer_get_time();
+
+  if( !state ) state = statesave_alloc();
+  if( statesave_save( state ) ) {
+    runahead_active = 0;
+    display_show_frame();
+    return;
+  }
+
+  saved = timer_get_time();
+
+  fuse_emulation_hidden = 1;
+  running = 1;
+  tape_freeze( 1 );
+
+  for( i = 0; i < frames; i++ ) run_frame();
+
+  tape_freeze( 0 );
+  running = 0;
+  fuse_emulation_hidden = 0;
+
+  display_show_frame();
+
+  emulated = timer_get_time();
+
+  if( statesave_restore( state ) ) {
+    ui_error( UI_ERROR_ERROR, "Run-ahead: couldn't restore the machine state" );
+    runahead_active = 0;
+    return;
+  }
+
+  if( settings_current.run_ahead_profile ) {
+    profile_frames++;
+    profile_frames_ahead += frames;
+    profile_save += saved - start;
+    profile_emulate += emulated - saved;
+    profile_restore += timer_get_time() - emulated;
+  }
+}
+
+static void
+profile_line( const char *what, double seconds, unsigned long count )
+{
+  fprintf( stderr, "%s: run-ahead: %-10s %8.3f ms\n", fuse_progname, what,
+           seconds * 1000 / count );
+}
+
+static void
+runahead_end( void )
+{
+  if( settings_current.run_ahead_profile && profile_frames ) {
+    fprintf( stderr,
+             "%s: run-ahead: %lu frames, %.2f frames ahead; per frame:\n",
+             fuse_progname, profile_frames,
+             (double)profile_frames_ahead / profile_frames );
+    profile_line( "save", profile_save, profile_frames );
+    profile_line( "emulate", profile_emulate, profile_frames );
+    profile_line( "restore", profile_restore, profile_frames );
+    profile_line( "total",
+                  profile_save + profile_emulate + profile_restore,
+                  profile_frames );
+    profile_line( "one frame", profile_emulate, profile_frames_ahead );
+  }
+
+  statesave_free( state );
+  state = NULL;
+  runahead_active = 0;
+}
+
+void
+runahead_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_DISPLAY,
+    STARTUP_MANAGER_MODULE_EVENT,
+    STARTUP_MANAGER_MODULE_MACHINE,
+    STARTUP_MANAGER_MODULE_MEMORY,
+    STARTUP_MANAGER_MODULE_SOUND,
+    STARTUP_MANAGER_MODULE_SPECTRUM,
+    STARTUP_MANAGER_MODULE_TIMER,
+    STARTUP_MANAGER_MODULE_Z80,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_RUNAHEAD, dependencies,
+                            ARRAY_SIZE( dependencies ), NULL, NULL,
+                            runahead_end );
+}
@@ -82,6 +82,9 @@ static char *rzx_filename;
 /* Are we currently playing back a .rzx file? */
 int rzx_playback;
 
+/* Did the last playback reach the end of its .rzx file? */
+int rzx_playback_finished;
+
 /* The number of instructions in the current .rzx playback frame */
 size_t rzx_instruction_count;
 
@@ -360,6 +363,7 @@ start_playback( libspectrum_rzx *from_rzx )
   tstates = libspectrum_rzx_tstates( from_rzx );
   rzx_instruction_count = libspectrum_rzx_instructions( from_rzx );
   rzx_playback = 1;
+  rzx_playback_finished = 0;
   counter_reset();
 
   ui_menu_activate( UI_MENU_ITEM_RECORDING, 1 );
@@ -691,6 +695,7 @@ static int playback_frame( void )
   if( error ) return rzx_stop_playback( 0 );
 
   if( finished ) {
+    rzx_playback_finished = 1;
     ui_error( UI_ERROR_INFO, "Finished RZX playback" );
     return rzx_stop_playback( 0 );
   }
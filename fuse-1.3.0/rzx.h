@@ -50,6 +50,10 @@ extern int rzx_recording;
 /* Are we currently playing back a .rzx file? */
 extern int rzx_playback;
 
+/* Did the last playback reach the end of its .rzx file, rather than
+   stopping early because the recording and emulation diverged? */
+extern int rzx_playback_finished;
+
 /* Is the .rzx file being recorded in competition mode? */
 extern int rzx_competition_mode;
 
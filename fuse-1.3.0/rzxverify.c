@@ -0,0 +1,402 @@
+/* rzxverify.c: Replaying a directory of RZX files in parallel
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_FORK
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif				/* #ifdef HAVE_FORK */
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "event.h"
+#include "fuse.h"
+#include "headless.h"
+#include "rzx.h"
+#include "rzxverify.h"
+#include "settings.h"
+#include "statehash.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+typedef enum rzxverify_status {
+  RZXVERIFY_FINISHED,		/* Played through to the end */
+  RZXVERIFY_DIVERGED,		/* Playback stopped early */
+  RZXVERIFY_ERROR,		/* Couldn't start playback at all */
+} rzxverify_status;
+
+typedef struct rzxverify_file {
+
+  char *name;			/* The filename within the directory */
+
+  /* Filled in by the child process which replayed the file */
+  rzxverify_status status;
+  unsigned long frames;
+  double seconds;
+  libspectrum_qword hash;
+
+  /* The hash from the reference file, if any */
+  int have_reference;
+  libspectrum_qword reference;
+
+} rzxverify_file;
+
+static rzxverify_file *files;
+static size_t file_count;
+
+static int
+compare_files( const void *a, const void *b )
+{
+  return strcmp( ( (const rzxverify_file*)a )->name,
+                 ( (const rzxverify_file*)b )->name );
+}
+
+/* Find all the .rzx files in `directory', sorted by name */
+static int
+find_files( const char *directory )
+{
+  compat_dir dir;
+  compat_dir_result_t result;
+  char name[ PATH_MAX ];
+  size_t allocated = 0, length;
+
+  dir = compat_opendir( directory );
+  if( !dir ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open directory '%s'", directory );
+    return 1;
+  }
+
+  file_count = 0;
+
+  while( 1 ) {
+    result = compat_readdir( dir, name, sizeof( name ) );
+    if( result == COMPAT_DIR_RESULT_END ) break;
+    if( result == COMPAT_DIR_RESULT_ERROR ) {
+      ui_error( UI_ERROR_ERROR, "error reading directory '%s'", directory );
+      compat_closedir( dir );
+      return 1;
+    }
+
+    length = strlen( name );
+    if( length < 4 || strcasecmp( name + length - 4, ".rzx" ) ) continue;
+
+    if( file_count == allocated ) {
+      allocated = allocated ? 2 * allocated : 64;
+      files = libspectrum_renew( rzxverify_file, files, allocated );
+    }
+
+    memset( &files[ file_count ], 0, sizeof( *files ) );
+    files[ file_count++ ].name = utils_safe_strdup( name );
+  }
+
+  compat_closedir( dir );
+
+  qsort( files, file_count, sizeof( *files ), compare_files );
+
+  return 0;
+}
+
+/* Read a hash file: one "<hash> <filename>" pair per line */
+static int
+read_reference( const char *filename )
+{
+  FILE *f;
+  char line[ PATH_MAX + 32 ], *name;
+  size_t i, length;
+  libspectrum_qword hash;
+
+  f = fopen( filename, "r" );
+  if( !f ) return 0;
+
+  while( fgets( line, sizeof( line ), f ) ) {
+
+    length = strlen( line );
+    while( length && ( line[ length - 1 ] == '\n' ||
+                       line[ length - 1 ] == '\r' ) )
+      line[ --length ] = '\0';
+
+    hash = strtoull( line, &name, 16 );
+    if( name == line || *name != ' ' ) continue;
+    name++;
+
+    for( i = 0; i < file_count; i++ ) {
+      if( !strcmp( files[i].name, name ) ) {
+        files[i].have_reference = 1;
+        files[i].reference = hash;
+        break;
+      }
+    }
+  }
+
+  fclose( f );
+
+  return 1;
+}
+
+static int
+write_reference( const char *filename )
+{
+  FILE *f;
+  size_t i;
+
+  f = fopen( filename, "w" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "couldn't write '%s'", filename );
+    return 1;
+  }
+
+  for( i = 0; i < file_count; i++ )
+    if( files[i].status != RZXVERIFY_ERROR )
+      fprintf( f, "%016" PRIx64 " %s\n", files[i].hash, files[i].name );
+
+  if( fclose( f ) ) {
+    ui_error( UI_ERROR_ERROR, "couldn't write '%s'", filename );
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Replay one file from the machine's current state */
+static void
+replay( const char *directory, rzxverify_file *file )
+{
+  char path[ PATH_MAX ];
+  libspectrum_dword start_frame;
+  double start_time;
+
+  snprintf( path, sizeof( path ), "%s/%s", directory, file->name );
+
+  start_time = timer_get_time();
+  start_frame = headless_frame_count();
+
+  if( rzx_start_playback( path, 0 ) ) {
+    file->status = RZXVERIFY_ERROR;
+    return;
+  }
+
+  while( rzx_playback && !fuse_exiting ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+
+  file->frames = headless_frame_count() - start_frame;
+  file->seconds = timer_get_time() - start_time;
+  file->hash = statehash_compute();
+  file->status = rzx_playback_finished ? RZXVERIFY_FINISHED
+                                       : RZXVERIFY_DIVERGED;
+}
+
+#ifdef HAVE_FORK
+
+typedef struct rzxverify_job {
+  pid_t pid;
+  int fd;
+  size_t file;
+} rzxverify_job;
+
+/* Each file is replayed in a child forked from the freshly initialised
+   emulator, so every replay starts from the same state and any number can
+   run at once; the emulator's state is global, so threads could not */
+static int
+start_job( const char *directory, size_t index, rzxverify_job *job )
+{
+  int fds[2];
+  pid_t pid;
+
+  if( pipe( fds ) ) {
+    ui_error( UI_ERROR_ERROR, "couldn't create pipe" );
+    return 1;
+  }
+
+  fflush( stdout ); fflush( stderr );
+
+  pid = fork();
+  if( pid < 0 ) {
+    ui_error( UI_ERROR_ERROR, "couldn't fork" );
+    close( fds[0] ); close( fds[1] );
+    return 1;
+  }
+
+  if( pid == 0 ) {
+    ssize_t written;
+
+    close( fds[0] );
+    replay( directory, &files[ index ] );
+    written = write( fds[1], &files[ index ], sizeof( files[ index ] ) );
+    _exit( written == sizeof( files[ index ] ) ? 0 : 1 );
+  }
+
+  close( fds[1] );
+
+  job->pid = pid;
+  job->fd = fds[0];
+  job->file = index;
+
+  return 0;
+}
+
+/* Collect the result from a child which has exited */
+static void
+finish_job( rzxverify_job *job )
+{
+  rzxverify_file *file = &files[ job->file ], result;
+
+  if( read( job->fd, &result, sizeof( result ) ) == sizeof( result ) ) {
+    file->status = result.status;
+    file->frames = result.frames;
+    file->seconds = result.seconds;
+    file->hash = result.hash;
+  } else {
+    file->status = RZXVERIFY_ERROR;
+  }
+
+  close( job->fd );
+}
+
+static int
+replay_all( const char *directory )
+{
+  rzxverify_job *jobs;
+  size_t next = 0, running = 0, i;
+  int job_count;
+  pid_t pid;
+
+  job_count = settings_current.rzx_verify_jobs;
+#ifdef _SC_NPROCESSORS_ONLN
+  if( job_count <= 0 ) job_count = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+  if( job_count <= 0 ) job_count = 1;
+
+  jobs = libspectrum_new( rzxverify_job, job_count );
+
+  while( next < file_count || running ) {
+
+    while( next < file_count && running < (size_t)job_count ) {
+      if( start_job( directory, next, &jobs[ running ] ) ) {
+        files[ next ].status = RZXVERIFY_ERROR;
+      } else {
+        running++;
+      }
+      next++;
+    }
+
+    if( !running ) continue;
+
+    pid = wait( NULL );
+    if( pid < 0 ) break;
+
+    for( i = 0; i < running; i++ ) {
+      if( jobs[i].pid == pid ) {
+        finish_job( &jobs[i] );
+        jobs[i] = jobs[ --running ];
+        break;
+      }
+    }
+  }
+
+  libspectrum_free( jobs );
+
+  return 0;
+}
+
+#else				/* #ifdef HAVE_FORK */
+
+static int
+replay_all( const char *directory GCC_UNUSED )
+{
+  ui_error( UI_ERROR_ERROR, "RZX verification needs fork()" );
+  return 1;
+}
+
+#endif				/* #ifdef HAVE_FORK */
+
+int
+rzxverify_run( void )
+{
+  const char *directory = settings_current.rzx_verify;
+  const char *hashes = settings_current.rzx_verify_hashes;
+  int have_reference = 0, failures = 0;
+  size_t i;
+
+  if( find_files( directory ) ) return 1;
+
+  if( hashes ) have_reference = read_reference( hashes );
+
+  if( replay_all( directory ) ) return 1;
+
+  for( i = 0; i < file_count; i++ ) {
+    rzxverify_file *file = &files[i];
+    double fps = file->seconds > 0 ? file->frames / file->seconds : 0;
+
+    printf( "%s: ", file->name );
+
+    switch( file->status ) {
+
+    case RZXVERIFY_ERROR:
+      printf( "FAILED to start playback\n" );
+      failures++;
+      continue;
+
+    case RZXVERIFY_DIVERGED:
+      printf( "DIVERGED at frame %lu", file->frames );
+      failures++;
+      break;
+
+    case RZXVERIFY_FINISHED:
+      if( !file->have_reference ) {
+        printf( have_reference ? "NEW" : "OK" );
+      } else if( file->hash == file->reference ) {
+        printf( "OK" );
+      } else {
+        printf( "MISMATCH (expected %016" PRIx64 ")", file->reference );
+        failures++;
+      }
+      break;
+
+    }
+
+    printf( ", %lu frames, %.0f frames/sec, hash %016" PRIx64 "\n",
+            file->frames, fps, file->hash );
+  }
+
+  printf( "%lu files, %d failed\n", (unsigned long)file_count, failures );
+
+  /* With no existing hash file, record these results as the reference */
+  if( hashes && !have_reference && write_reference( hashes ) ) return 1;
+
+  for( i = 0; i < file_count; i++ ) libspectrum_free( files[i].name );
+  libspectrum_free( files );
+
+  return failures ? 1 : 0;
+}
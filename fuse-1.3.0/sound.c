@@ -35,6 +35,7 @@
 #include "machine.h"
 #include "movie.h"
 #include "options.h"
+#include "peripherals/if1.h"
 #include "settings.h"
 #include "sound.h"
 #include "tape.h"
@@ -207,7 +208,7 @@ sound_init( const char *device )
       /* only try for stereo if we need it */
       sound_stereo_ay = option_enumerate_sound_stereo_ay();
 
-      if( settings_current.sound &&
+      if( settings_current.sound && !settings_current.headless &&
           sound_lowlevel_init( device, &settings_current.sound_freq,
                                &sound_stereo_ay ) )
         return;
@@ -319,6 +320,8 @@ sound_unpause( void )
   /* No sound if fastloading in progress */
   if( settings_current.fastload && tape_is_playing() )
     return;
+  if( settings_current.mdr_fastload && if1_mdr_running() )
+    return;
 
   sound_init( settings_current.sound_device );
 }
@@ -344,7 +347,7 @@ sound_end( void )
         delete_Blip_Buffer( &left_buf );
         delete_Blip_Buffer( &right_buf );
 
-            if( settings_current.sound )
+            if( settings_current.sound && !settings_current.headless )
                 sound_lowlevel_end();
 
         libspectrum_free( samples );
@@ -603,6 +606,8 @@ sound_ay_overlay( void )
 void
 sound_ay_write( int reg, int val, libspectrum_dword now )
 {
+  if( fuse_emulation_hidden ) return;
+
   if( ay_change_count < AY_CHANGE_MAX ) {
     ay_change[ ay_change_count ].tstates = now;
     ay_change[ ay_change_count ].reg = ( reg & 15 );
@@ -630,6 +635,31 @@ sound_ay_reset( void )
   ay_tone_cycles = ay_env_cycles = 0;
 }
 
+/* Frames emulated unheard don't reach the synthesiser, so after netplay
+   has emulated frames again for real but unheard, bring the AY registers
+   and the SpecDrum level the synthesiser uses back into line with the
+   machine's. Run-ahead puts the machine back as it was, so doesn't need
+   this */
+void
+sound_resync( void )
+{
+  int f;
+
+  if( !sound_enabled ) return;
+
+  for( f = 0; f < 16; f++ )
+    if( sound_ay_registers[f] != machine_current->ay.registers[f] )
+      sound_ay_write( f, machine_current->ay.registers[f], 0 );
+
+  if( periph_is_active( PERIPH_TYPE_SPECDRUM ) ) {
+    blip_synth_update( left_specdrum_synth, 0,
+                       machine_current->specdrum.specdrum_dac * 128 );
+    if( right_specdrum_synth )
+      blip_synth_update( right_specdrum_synth, 0,
+                         machine_current->specdrum.specdrum_dac * 128 );
+  }
+}
+
 /*
  * sound_specdrum_write - very simple routine
  * as the output is already a digitized waveform
@@ -638,9 +668,11 @@ void
 sound_specdrum_write( libspectrum_word port GCC_UNUSED, libspectrum_byte val )
 {
   if( periph_is_active( PERIPH_TYPE_SPECDRUM ) ) {
-    blip_synth_update( left_specdrum_synth, tstates, ( val - 128) * 128);
-    if( right_specdrum_synth ) {
-      blip_synth_update( right_specdrum_synth, tstates, ( val - 128) * 128);
+    if( !fuse_emulation_hidden ) {
+      blip_synth_update( left_specdrum_synth, tstates, ( val - 128) * 128);
+      if( right_specdrum_synth ) {
+        blip_synth_update( right_specdrum_synth, tstates, ( val - 128) * 128);
+      }
     }
     machine_current->specdrum.specdrum_dac = val - 128;
   }
@@ -651,7 +683,10 @@ sound_frame( void )
 {
   long count;
 
-  if( !sound_enabled )
+  /* Frames emulated unseen are unheard as well. Nothing is synthesised
+     for them, so the sound carries on from the last frame which was heard
+     whatever state the machine is put back into; see sound_resync() */
+  if( !sound_enabled || fuse_emulation_hidden )
     return;
 
   /* overlay AY sound */
@@ -671,7 +706,7 @@ sound_frame( void )
     count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, BLIP_BUFFER_DEF_STEREO );
   }
 
-  if( settings_current.sound )
+  if( settings_current.sound && !settings_current.headless )
     sound_lowlevel_frame( samples, count );
 
   if( movie_recording )
@@ -686,7 +721,7 @@ sound_beeper( libspectrum_dword at_tstates, int on )
                                AMPL_BEEPER+AMPL_TAPE };
   int val;
 
-  if( !sound_enabled ) return;
+  if( !sound_enabled || fuse_emulation_hidden ) return;
 
   if( tape_is_playing() ) {
     /* Timex machines have no loading noise */
@@ -31,18 +31,25 @@
 #include "debugger/debugger.h"
 #include "display.h"
 #include "event.h"
+#include "fuse.h"
+#include "headless.h"
 #include "keyboard.h"
 #include "infrastructure/startup_manager.h"
 #include "loader.h"
 #include "machine.h"
 #include "memory.h"
+#include "netplay.h"
 #include "peripherals/printer.h"
+#include "peripherals/spectranet.h"
 #include "psg.h"
 #include "profile.h"
+#include "runahead.h"
 #include "rzx.h"
 #include "settings.h"
 #include "sound.h"
 #include "spectrum.h"
+#include "statehash.h"
+#include "statesave.h"
 #include "tape.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
@@ -71,12 +78,21 @@ spectrum_frame_event_fn( libspectrum_dword last_tstates, int type,
   rzx_frame();
   psg_frame();
   spectrum_frame();
+  startup_manager_frame();
   z80_interrupt();
   ui_joystick_poll();
-  timer_estimate_speed();
   debugger_add_time_events();
-  ui_event();
+  if( !fuse_emulation_hidden ) {
+    timer_estimate_speed();
+    if( settings_current.headless ) {
+      headless_frame();
+    } else {
+      ui_event();
+    }
+  }
   ui_error_frame();
+  if( netplay_active ) netplay_frame();
+  runahead_frame();
 }
 
 static int
@@ -85,6 +101,8 @@ spectrum_init( void *context )
   spectrum_frame_event = event_register( spectrum_frame_event_fn,
 					 "End of frame" );
 
+  statesave_register( &tstates, sizeof( tstates ) );
+
   return 0;
 }
 
@@ -111,6 +129,9 @@ spectrum_frame( void )
   frame_length = rzx_playback ? tstates
 			      : machine_current->timings.tstates_per_frame;
 
+  /* Catch the tape up before everything moves to the next frame */
+  tape_frame( frame_length );
+
   event_frame( frame_length );
   debugger_breakpoint_reduce_tstates( frame_length );
   tstates -= frame_length;
@@ -122,6 +143,7 @@ spectrum_frame( void )
   if( display_frame() ) return 1;
   if( profile_active ) profile_frame( frame_length );
   printer_frame();
+  if( spectranet_available ) spectranet_frame( frame_length );
 
   /* Add an interrupt unless they're being generated by .rzx playback */
   if( !rzx_playback )
@@ -130,6 +152,8 @@ spectrum_frame( void )
 
   loader_frame( frame_length );
 
+  if( statehash_active ) statehash_frame();
+
   return 0;
 }
 
@@ -0,0 +1,235 @@
+/* statehash.c: Fingerprinting the emulated machine state
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "debugger/debugger.h"
+#include "display.h"
+#include "infrastructure/startup_manager.h"
+#include "machine.h"
+#include "memory.h"
+#include "peripherals/scld.h"
+#include "peripherals/ula.h"
+#include "spectrum.h"
+#include "statehash.h"
+#include "z80/z80.h"
+#include "z80/z80_macros.h"
+
+libspectrum_byte statehash_page_dirty[ SPECTRUM_RAM_PAGES ];
+
+int statehash_active = 0;
+
+libspectrum_qword statehash_frame_hash;
+
+/* The hash of each RAM page, valid while its dirty flag is clear */
+static libspectrum_qword page_hash[ SPECTRUM_RAM_PAGES ];
+
+static const char * const debugger_type_string = "statehash";
+static const char * const low_detail_string = "low";
+static const char * const high_detail_string = "high";
+
+/* The 64-bit FNV-1a parameters, applied a word rather than a byte at a
+   time */
+#define STATEHASH_OFFSET 0xcbf29ce484222325ULL
+#define STATEHASH_PRIME  0x00000100000001b3ULL
+
+static libspectrum_qword
+hash_value( libspectrum_qword hash, libspectrum_qword value )
+{
+  return ( hash ^ value ) * STATEHASH_PRIME;
+}
+
+/* Hash one 16K RAM page. The words are assembled from bytes so the result
+   does not depend on the host's byte order */
+static libspectrum_qword
+hash_page( const libspectrum_byte *data )
+{
+  libspectrum_qword hash = STATEHASH_OFFSET;
+  size_t i;
+
+  for( i = 0; i < 0x4000; i += 8 ) {
+    libspectrum_qword word =
+      ( (libspectrum_qword)data[ i     ]       ) |
+      ( (libspectrum_qword)data[ i + 1 ] <<  8 ) |
+      ( (libspectrum_qword)data[ i + 2 ] << 16 ) |
+      ( (libspectrum_qword)data[ i + 3 ] << 24 ) |
+      ( (libspectrum_qword)data[ i + 4 ] << 32 ) |
+      ( (libspectrum_qword)data[ i + 5 ] << 40 ) |
+      ( (libspectrum_qword)data[ i + 6 ] << 48 ) |
+      ( (libspectrum_qword)data[ i + 7 ] << 56 );
+    hash = hash_value( hash, word );
+  }
+
+  return hash;
+}
+
+static libspectrum_qword
+hash_registers( libspectrum_qword hash )
+{
+  hash = hash_value( hash, AF  ); hash = hash_value( hash, BC  );
+  hash = hash_value( hash, DE  ); hash = hash_value( hash, HL  );
+  hash = hash_value( hash, AF_ ); hash = hash_value( hash, BC_ );
+  hash = hash_value( hash, DE_ ); hash = hash_value( hash, HL_ );
+  hash = hash_value( hash, IX  ); hash = hash_value( hash, IY  );
+  hash = hash_value( hash, SP  ); hash = hash_value( hash, PC  );
+  hash = hash_value( hash, I );
+  hash = hash_value( hash, ( R7 & 0x80 ) | ( R & 0x7f ) );
+  hash = hash_value( hash, IFF1 ); hash = hash_value( hash, IFF2 );
+  hash = hash_value( hash, IM );
+  hash = hash_value( hash, z80.halted );
+  hash = hash_value( hash, z80.iff2_read );
+  hash = hash_value( hash, (libspectrum_dword)z80.interrupts_enabled_at );
+  hash = hash_value( hash, tstates );
+
+  return hash;
+}
+
+static libspectrum_qword
+hash_paging( libspectrum_qword hash )
+{
+  const spectrum_raminfo *ram = &machine_current->ram;
+  size_t i;
+
+  hash = hash_value( hash, ram->last_byte );
+  hash = hash_value( hash, ram->last_byte2 );
+  hash = hash_value( hash, ram->current_page );
+  hash = hash_value( hash, ram->current_rom );
+  hash = hash_value( hash, ram->special );
+  hash = hash_value( hash, ram->romcs );
+  hash = hash_value( hash, ram->locked );
+
+  for( i = 0; i < MEMORY_PAGES_IN_64K; i++ ) {
+    const memory_page *page = &memory_map_read[i];
+    hash = hash_value( hash, page->source );
+    hash = hash_value( hash, page->page_num );
+    hash = hash_value( hash, page->offset );
+    hash = hash_value( hash, memory_map_write[i].writable );
+  }
+
+  return hash;
+}
+
+static libspectrum_qword
+hash_peripherals( libspectrum_qword hash )
+{
+  const ayinfo *ay = &machine_current->ay;
+  size_t i;
+
+  hash = hash_value( hash, ay->current_register );
+  for( i = 0; i < AY_REGISTERS; i++ )
+    hash = hash_value( hash, ay->registers[i] );
+
+  hash = hash_value( hash, ula_last_byte() );
+  hash = hash_value( hash, display_lores_border );
+  hash = hash_value( hash, display_hires_border );
+  hash = hash_value( hash, scld_last_dec.byte );
+
+  return hash;
+}
+
+libspectrum_qword
+statehash_compute( void )
+{
+  libspectrum_qword hash = STATEHASH_OFFSET;
+  int i;
+
+  hash = hash_registers( hash );
+  hash = hash_paging( hash );
+  hash = hash_peripherals( hash );
+
+  for( i = 0; i < machine_current->ram.valid_pages; i++ ) {
+    if( statehash_page_dirty[i] ) {
+      page_hash[i] = hash_page( RAM[i] );
+      statehash_page_dirty[i] = 0;
+    }
+    hash = hash_value( hash, page_hash[i] );
+  }
+
+  /* Final mix so every input bit can affect every output bit */
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+void
+statehash_set_active( int active )
+{
+  statehash_active = active;
+  if( active ) statehash_frame_hash = statehash_compute();
+}
+
+void
+statehash_frame( void )
+{
+  statehash_frame_hash = statehash_compute();
+}
+
+void
+statehash_invalidate( void )
+{
+  memset( statehash_page_dirty, 1, sizeof( statehash_page_dirty ) );
+}
+
+static libspectrum_dword
+get_low( void )
+{
+  return statehash_compute() & 0xffffffff;
+}
+
+static libspectrum_dword
+get_high( void )
+{
+  return statehash_compute() >> 32;
+}
+
+static int
+statehash_init( void *context )
+{
+  statehash_invalidate();
+
+  debugger_system_variable_register(
+    debugger_type_string, low_detail_string, get_low, NULL );
+  debugger_system_variable_register(
+    debugger_type_string, high_detail_string, get_high, NULL );
+
+  return 0;
+}
+
+void
+statehash_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_DEBUGGER,
+    STARTUP_MANAGER_MODULE_SETUID,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_STATEHASH, dependencies,
+                            ARRAY_SIZE( dependencies ), statehash_init, NULL,
+                            NULL );
+}
@@ -0,0 +1,62 @@
+/* statehash.h: Fingerprinting the emulated machine state
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_STATEHASH_H
+#define FUSE_STATEHASH_H
+
+#include <libspectrum.h>
+
+#include "memory.h"
+
+/* Has each 16K RAM page been written since its hash was last computed? */
+extern libspectrum_byte statehash_page_dirty[ SPECTRUM_RAM_PAGES ];
+
+/* Is the hash being recomputed at the end of every frame? */
+extern int statehash_active;
+
+/* The hash as of the end of the most recent frame, while active */
+extern libspectrum_qword statehash_frame_hash;
+
+void statehash_register_startup( void );
+
+/* A 64-bit hash of the Z80 registers, tstates, the memory paging, the
+   machine's RAM and the AY and ULA state. Two runs of the same build which
+   give the same hash are (almost certainly) in the same state. Only RAM
+   pages written since the last call are rehashed */
+libspectrum_qword statehash_compute( void );
+
+/* Start or stop updating statehash_frame_hash every frame */
+void statehash_set_active( int active );
+
+/* Called at the end of every frame while active */
+void statehash_frame( void );
+
+/* Rehash all RAM next time; for when RAM is changed other than by
+   writebyte_internal(), for example by loading a snapshot */
+void statehash_invalidate( void );
+
+/* Note a write to RAM page `page_num' */
+#define statehash_ram_written( page_num ) \
+  ( statehash_page_dirty[ (page_num) ] = 1 )
+
+#endif			/* #ifndef FUSE_STATEHASH_H */
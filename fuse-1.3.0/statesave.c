@@ -0,0 +1,273 @@
+/* statesave.c: Saving and restoring the machine state in memory
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <string.h>
+
+#ifdef HAVE_LIB_GLIB
+#include <glib.h>
+#endif				/* #ifdef HAVE_LIB_GLIB */
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "display.h"
+#include "event.h"
+#include "machine.h"
+#include "memory.h"
+#include "periph.h"
+#include "peripherals/scld.h"
+#include "snapshot.h"
+#include "spectrum.h"
+#include "statehash.h"
+#include "statesave.h"
+
+typedef struct statesave_block {
+  void *data;
+  size_t length;
+} statesave_block;
+
+/* The plain data blocks registered by each module */
+static GArray *blocks = NULL;
+static size_t blocks_length = 0;
+
+struct statesave_state {
+
+  int valid;
+  libspectrum_machine machine;
+
+  /* The fast copy */
+  libspectrum_byte *data;
+  size_t data_length;
+
+  spectrum_raminfo ram;
+  ayinfo ay;
+  specdrum_info specdrum;
+
+  libspectrum_byte *ram_pages;
+  int ram_pages_allocated;
+
+  event_t *events;
+  size_t event_count, events_allocated;
+
+  /* Or the slow one */
+  libspectrum_snap *snap;
+
+};
+
+/* Peripherals with state beyond the registered blocks: disk controllers,
+   IDE and network interfaces, and so on. While any of these is active,
+   states are saved as snapshots instead */
+static const periph_type slow_periphs[] = {
+  PERIPH_TYPE_BETA128,
+  PERIPH_TYPE_BETA128_PENTAGON,
+  PERIPH_TYPE_BETA128_PENTAGON_LATE,
+  PERIPH_TYPE_DIDAKTIK80,
+  PERIPH_TYPE_DISCIPLE,
+  PERIPH_TYPE_DIVIDE,
+  PERIPH_TYPE_INTERFACE1,
+  PERIPH_TYPE_OPUS,
+  PERIPH_TYPE_PLUSD,
+  PERIPH_TYPE_SIMPLEIDE,
+  PERIPH_TYPE_SPECCYBOOT,
+  PERIPH_TYPE_SPECTRANET,
+  PERIPH_TYPE_UPD765,
+  PERIPH_TYPE_USOURCE,
+  PERIPH_TYPE_ZXATASP,
+  PERIPH_TYPE_ZXCF,
+};
+
+void
+statesave_register( void *data, size_t length )
+{
+  statesave_block block;
+
+  if( !blocks )
+    blocks = g_array_new( FALSE, FALSE, sizeof( statesave_block ) );
+
+  block.data = data;
+  block.length = length;
+  g_array_append_val( blocks, block );
+
+  blocks_length += length;
+}
+
+int
+statesave_fast( void )
+{
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( slow_periphs ); i++ )
+    if( periph_is_active( slow_periphs[i] ) ) return 0;
+
+  /* RAM in the Timex DOCK and EXROM banks isn't copied */
+  if( periph_is_active( PERIPH_TYPE_SCLD ) ) {
+    for( i = 0; i < MEMORY_PAGES_IN_64K; i++ )
+      if( timex_dock[i].writable || timex_exrom[i].writable ) return 0;
+  }
+
+  return 1;
+}
+
+statesave_state*
+statesave_alloc( void )
+{
+  statesave_state *state = libspectrum_new( statesave_state, 1 );
+
+  memset( state, 0, sizeof( *state ) );
+
+  return state;
+}
+
+void
+statesave_free( statesave_state *state )
+{
+  if( !state ) return;
+
+  libspectrum_free( state->data );
+  libspectrum_free( state->ram_pages );
+  libspectrum_free( state->events );
+  if( state->snap ) libspectrum_snap_free( state->snap );
+
+  libspectrum_free( state );
+}
+
+static void
+save_event( gpointer data, gpointer user_data )
+{
+  event_t *event = data;
+  statesave_state *state = user_data;
+
+  if( state->event_count == state->events_allocated ) {
+    state->events_allocated = state->events_allocated ?
+                              2 * state->events_allocated : 16;
+    state->events = libspectrum_renew( event_t, state->events,
+                                       state->events_allocated );
+  }
+
+  state->events[ state->event_count++ ] = *event;
+}
+
+static void
+save_fast( statesave_state *state )
+{
+  libspectrum_byte *ptr;
+  size_t i;
+  int pages = machine_current->ram.valid_pages;
+
+  if( state->data_length != blocks_length ) {
+    state->data = libspectrum_renew( libspectrum_byte, state->data,
+                                     blocks_length );
+    state->data_length = blocks_length;
+  }
+
+  for( i = 0, ptr = state->data; blocks && i < blocks->len; i++ ) {
+    statesave_block *block = &g_array_index( blocks, statesave_block, i );
+    memcpy( ptr, block->data, block->length );
+    ptr += block->length;
+  }
+
+  state->ram = machine_current->ram;
+  state->ay = machine_current->ay;
+  state->specdrum = machine_current->specdrum;
+
+  if( pages > state->ram_pages_allocated ) {
+    state->ram_pages = libspectrum_renew( libspectrum_byte, state->ram_pages,
+                                          pages * 0x4000 );
+    state->ram_pages_allocated = pages;
+  }
+  memcpy( state->ram_pages, RAM, pages * 0x4000 );
+
+  state->event_count = 0;
+  event_foreach( save_event, state );
+}
+
+static void
+restore_fast( statesave_state *state )
+{
+  const libspectrum_byte *ptr;
+  size_t i;
+
+  for( i = 0, ptr = state->data; blocks && i < blocks->len; i++ ) {
+    statesave_block *block = &g_array_index( blocks, statesave_block, i );
+    memcpy( block->data, ptr, block->length );
+    ptr += block->length;
+  }
+
+  machine_current->ram = state->ram;
+  machine_current->ay = state->ay;
+  machine_current->specdrum = state->specdrum;
+
+  memcpy( RAM, state->ram_pages, state->ram.valid_pages * 0x4000 );
+
+  event_reset();
+  for( i = 0; i < state->event_count; i++ )
+    event_add_with_data( state->events[i].tstates, state->events[i].type,
+                         state->events[i].user_data );
+
+  /* Everything derived from the state rather than part of it */
+  memory_update_handlers();
+  statehash_invalidate();
+  display_reset_border();
+  display_refresh_all();
+}
+
+int
+statesave_save( statesave_state *state )
+{
+  if( statesave_fast() ) {
+    if( state->snap ) {
+      libspectrum_snap_free( state->snap );
+      state->snap = NULL;
+    }
+    save_fast( state );
+  } else {
+    if( state->snap ) libspectrum_snap_free( state->snap );
+    state->snap = libspectrum_snap_alloc();
+    if( snapshot_copy_to( state->snap ) ) {
+      libspectrum_snap_free( state->snap );
+      state->snap = NULL;
+      state->valid = 0;
+      return 1;
+    }
+  }
+
+  state->machine = machine_current->machine;
+  state->valid = 1;
+
+  return 0;
+}
+
+int
+statesave_restore( statesave_state *state )
+{
+  if( !state->valid || state->machine != machine_current->machine )
+    return 1;
+
+  if( state->snap ) return snapshot_copy_from( state->snap );
+
+  restore_fast( state );
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+/* statesave.h: Saving and restoring the machine state in memory
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_STATESAVE_H
+#define FUSE_STATESAVE_H
+
+#include <stddef.h>
+
+/* A copy of the machine state, kept in memory so it can be restored many
+   times a second. States must be saved and restored between frames, and
+   only within the same machine; the keyboard and joysticks are host input
+   and are not part of the state */
+typedef struct statesave_state statesave_state;
+
+statesave_state* statesave_alloc( void );
+void statesave_free( statesave_state *state );
+
+int statesave_save( statesave_state *state );
+int statesave_restore( statesave_state *state );
+
+/* Is the state of the current configuration small enough to be copied
+   directly? If not, states go through snapshot_copy_to() instead, which
+   is much slower */
+int statesave_fast( void );
+
+/* Register a block of plain data as part of the machine state. Called by
+   each module from its init function */
+void statesave_register( void *data, size_t length );
+
+#endif			/* #ifndef FUSE_STATESAVE_H */
@@ -65,6 +65,10 @@ int tape_playing;
 /* Was the tape playing started automatically? */
 static int tape_autoplay;
 
+/* Set while frames are emulated only to be thrown away: the tape isn't
+   part of the machine state which is then restored, so it mustn't move */
+static int tape_frozen = 0;
+
 /* Is there a high input to the EAR socket? */
 int tape_microphone;
 
@@ -82,11 +86,46 @@ static int tape_mic_off_event;
 
 static libspectrum_dword next_tape_edge_tstates;
 
+/* Rather than scheduling an event for every edge, the tape is decoded a
+   chunk at a time into a compact stream of pulses, and the EAR level is
+   brought up to date from the stream only when something needs it: ULA
+   reads and writes, and the end of each frame. The only event is a
+   backstop at the start of the last pulse in the chunk. A chunk always
+   ends at a pulse which ends a block or stops the tape, so block and stop
+   handling happens exactly as it would edge by edge. As the decoder may
+   be well ahead of the pulse being played, whether each pulse is part of
+   a pilot tone is noted as it is decoded */
+#define TAPE_PULSE_CHUNK 4096
+
+typedef struct tape_pulse_t {
+
+  libspectrum_dword length;	/* tstates until the next pulse starts */
+  int flags;			/* Flags from libspectrum_tape_get_next_edge */
+  int pilot;			/* Part of a pilot tone? */
+
+} tape_pulse_t;
+
+static tape_pulse_t tape_pulses[ TAPE_PULSE_CHUNK ];
+static size_t tape_pulse_count, tape_pulse_next;
+
+/* When tape_pulses[ tape_pulse_next ] starts */
+static libspectrum_dword tape_pulse_tstates;
+
+/* tstates from then until the last pulse in the chunk starts */
+static libspectrum_dword tape_pulse_remaining;
+
+/* Set while we're working through the pulse stream */
+static int tape_pulse_updating;
+
 /* Function prototypes */
 
 static int tape_autoload( libspectrum_machine hardware );
 static int trap_load_block( libspectrum_tape_block *block );
 static int tape_play( int autoplay );
+static void tape_pulse_restart( libspectrum_dword start );
+static void tape_pulse_clear( void );
+static int tape_pulse_in_pilot( void );
+static libspectrum_tape_block* tape_peek_data_block( int *skip );
 static void make_name( unsigned char *name, const unsigned char *data );
 static void
 tape_event_record_sample( libspectrum_dword last_tstates, int type,
@@ -119,6 +158,8 @@ tape_init( void *context )
   tape_microphone = 0;
 
   next_tape_edge_tstates = 0;
+
+  loader_init();
   
   return 0;
 }
@@ -259,6 +300,9 @@ int tape_close( void )
   error = libspectrum_tape_clear( tape );
   if( error ) return error;
 
+  tape_pulse_clear();
+  next_tape_edge_tstates = 0;
+
   tape_modified = 0;
   ui_tape_browser_update( UI_TAPE_BROWSER_NEW_TAPE, NULL );
 
@@ -291,7 +335,17 @@ tape_select_block( size_t n )
 int
 tape_select_block_no_update( size_t n )
 {
-  return libspectrum_tape_nth_block( tape, n );
+  int error;
+
+  error = libspectrum_tape_nth_block( tape, n ); if( error ) return error;
+
+  if( tape_playing ) {
+    tape_pulse_restart( tstates );
+  } else {
+    tape_pulse_clear();
+  }
+
+  return 0;
 }
 
 /* Which block is current? */
@@ -357,8 +411,9 @@ int tape_load_trap( void )
   libspectrum_tape_block *block, *next_block;
   int error;
 
-  /* Do nothing if tape traps aren't active, or the tape is already playing */
-  if( !settings_current.tape_traps || tape_playing ) return 2;
+  /* Do nothing if tape traps aren't active, or the tape is already playing
+     or frozen */
+  if( !settings_current.tape_traps || tape_playing || tape_frozen ) return 2;
 
   /* Do nothing if we're not in the correct ROM */
   if( !trap_check_rom( CHECK_TAPE_ROM ) ) return 3;
@@ -378,7 +433,7 @@ int tape_load_trap( void )
      that, return with `error' so that we actually do whichever
      instruction it was that caused the trap to hit */
   if( libspectrum_tape_block_type( block ) != LIBSPECTRUM_TAPE_BLOCK_ROM ||
-      libspectrum_tape_state( tape ) != LIBSPECTRUM_TAPE_STATE_PILOT ) {
+      !tape_pulse_in_pilot() ) {
     tape_play( 1 );
     return -1;
   }
@@ -401,6 +456,10 @@ int tape_load_trap( void )
   error = trap_load_block( block );
   if( error ) return error;
 
+  /* Any pulses decoded from this block are now stale */
+  tape_pulse_clear();
+  next_tape_edge_tstates = 0;
+
   /* Peek at the next block. If it's a ROM block, move along, initialise
      the block, and return */
   next_block = libspectrum_tape_peek_next_block( tape );
@@ -422,6 +481,82 @@ int tape_load_trap( void )
   return 0;
 }
 
+/* Load the current tape block directly into memory on behalf of a turbo
+   loader which uses the same register conventions as the ROM's LD-BYTES
+   routine. Returns 0 if the block was loaded, in which case the caller
+   should return from the loader */
+int
+tape_flash_load( void )
+{
+  libspectrum_tape_block *block;
+  libspectrum_tape_type type;
+  int error, skip;
+
+  if( !tape_playing || !libspectrum_tape_present( tape ) ) return 1;
+
+  /* Find out which pulse is playing now; this may stop the tape */
+  tape_update( tstates );
+  if( !tape_playing ) return 1;
+
+  /* Look for the data block without moving the tape, so that a loader we
+     can't handle carries on from exactly where it was */
+  block = tape_peek_data_block( &skip );
+  if( !block ) return 1;
+
+  type = libspectrum_tape_block_type( block );
+  if( type != LIBSPECTRUM_TAPE_BLOCK_ROM &&
+      type != LIBSPECTRUM_TAPE_BLOCK_TURBO ) return 1;
+
+  /* We only handle the case of the loader being called right at the start
+     of a data block: in its pilot tone, or in the gap before it */
+  if( ( !skip && !tape_pulse_in_pilot() ) ||
+      libspectrum_tape_block_data_length( block ) != DE + 2 ) return 1;
+
+  while( skip-- )
+    libspectrum_tape_select_next_block( tape );
+
+  error = trap_load_block( block );
+  if( error ) return error;
+
+  /* Carry on with the next block from its start */
+  if( !libspectrum_tape_select_next_block( tape ) ) return 0;
+
+  ui_tape_browser_update( UI_TAPE_BROWSER_SELECT_BLOCK, NULL );
+
+  tape_pulse_restart( tstates );
+
+  return 0;
+}
+
+/* The first block from the current one on which isn't meta-data or a
+   timed pause, and in `skip' how many blocks on that is. The tape itself
+   doesn't move */
+static libspectrum_tape_block*
+tape_peek_data_block( int *skip )
+{
+  libspectrum_tape_block *block;
+  libspectrum_tape_iterator iterator;
+  int current, n;
+
+  if( libspectrum_tape_position( &current, tape ) ) return NULL;
+
+  block = libspectrum_tape_iterator_init( &iterator, tape );
+  for( n = 0; block && n < current; n++ )
+    block = libspectrum_tape_iterator_next( &iterator );
+
+  *skip = 0;
+  while( block &&
+         ( libspectrum_tape_block_metadata( block ) ||
+           ( libspectrum_tape_block_type( block ) ==
+               LIBSPECTRUM_TAPE_BLOCK_PAUSE &&
+             libspectrum_tape_block_pause( block ) ) ) ) {
+    block = libspectrum_tape_iterator_next( &iterator );
+    (*skip)++;
+  }
+
+  return block;
+}
+
 static int
 trap_load_block( libspectrum_tape_block *block )
 {
@@ -528,8 +663,9 @@ int tape_save_trap( void )
 
   int i;
 
-  /* Do nothing if tape traps aren't active */
-  if( !settings_current.tape_traps || tape_recording ) return 2;
+  /* Do nothing if tape traps aren't active, or the tape is frozen */
+  if( !settings_current.tape_traps || tape_recording || tape_frozen )
+    return 2;
 
   /* Check we're in the right ROM */
   if( !trap_check_rom( CHECK_TAPE_ROM ) ) return 3;
@@ -579,7 +715,7 @@ int tape_save_trap( void )
 static int
 tape_play( int autoplay )
 {
-  if( !libspectrum_tape_present( tape ) ) return 1;
+  if( !libspectrum_tape_present( tape ) || tape_frozen ) return 1;
   
   /* Otherwise, start the tape going */
   tape_playing = 1;
@@ -596,7 +732,14 @@ tape_play( int autoplay )
 
   loader_tape_play();
 
-  event_add( tstates + next_tape_edge_tstates, tape_edge_event );
+  if( tape_pulse_next < tape_pulse_count ) {
+    /* Carry on from where we stopped */
+    tape_pulse_tstates = tstates + next_tape_edge_tstates;
+    event_remove_type( tape_edge_event );
+    event_add( tape_pulse_tstates + tape_pulse_remaining, tape_edge_event );
+  } else {
+    tape_pulse_restart( tstates + next_tape_edge_tstates );
+  }
   next_tape_edge_tstates = 0;
 
   debugger_event( play_event );
@@ -623,25 +766,13 @@ int tape_toggle_play( int autoplay )
   }
 }
 
-static void
-save_next_tape_edge( gpointer data, gpointer user_data )
-{
-  event_t *ptr = data;
-
-  if( ptr->type == tape_edge_event ) {
-    next_tape_edge_tstates = ptr->tstates - tstates;
-  }
-}
-
-static void
-tape_save_next_edge( void )
-{
-  event_foreach( save_next_tape_edge, NULL );
-}
-
 int
 tape_stop( void )
 {
+  /* Catch up with the tape before stopping it; this may itself stop
+     the tape */
+  if( tape_playing && !tape_pulse_updating ) tape_update( tstates );
+
   if( tape_playing ) {
 
     tape_playing = 0;
@@ -655,7 +786,9 @@ tape_stop( void )
       timer_estimate_reset();
     }
 
-    tape_save_next_edge();
+    next_tape_edge_tstates = tape_pulse_next < tape_pulse_count &&
+                             tape_pulse_tstates > tstates ?
+                             tape_pulse_tstates - tstates : 0;
     event_remove_type( tape_edge_event );
 
     /* Turn off any lingering MIC level in a second (some loaders like Alkatraz
@@ -682,6 +815,12 @@ tape_present( void )
   return libspectrum_tape_present( tape );
 }
 
+void
+tape_freeze( int frozen )
+{
+  tape_frozen = frozen;
+}
+
 typedef struct
 {
   libspectrum_byte *tape_buffer;
@@ -804,25 +943,93 @@ tape_record_stop( void )
   return 0;
 }
 
-void
-tape_next_edge( libspectrum_dword last_tstates, int type, void *user_data )
+static void
+tape_pulse_clear( void )
+{
+  tape_pulse_count = tape_pulse_next = 0;
+  tape_pulse_remaining = 0;
+}
+
+/* Decode the next chunk of pulses from the tape; returns non-zero if
+   there weren't any */
+static int
+tape_pulse_fill( void )
 {
   libspectrum_error libspec_error;
-  libspectrum_tape_block *block;
+  tape_pulse_t *pulse;
 
-  libspectrum_dword edge_tstates;
-  int flags;
+  tape_pulse_clear();
 
-  /* If the tape's not playing, just return */
-  if( ! tape_playing ) return;
+  while( tape_pulse_count < TAPE_PULSE_CHUNK ) {
+
+    pulse = &tape_pulses[ tape_pulse_count ];
+    pulse->pilot =
+      libspectrum_tape_state( tape ) == LIBSPECTRUM_TAPE_STATE_PILOT;
+
+    libspec_error = libspectrum_tape_get_next_edge( &pulse->length,
+                                                    &pulse->flags, tape );
+    if( libspec_error != LIBSPECTRUM_ERROR_NONE ) break;
+
+    tape_pulse_count++;
+    tape_pulse_remaining += pulse->length;
+
+    if( pulse->flags & ( LIBSPECTRUM_TAPE_FLAGS_BLOCK |
+                         LIBSPECTRUM_TAPE_FLAGS_STOP |
+                         LIBSPECTRUM_TAPE_FLAGS_STOP48 ) ) break;
+
+  }
+
+  if( !tape_pulse_count ) return 1;
+
+  /* We want the time until the last pulse starts, not ends */
+  tape_pulse_remaining -= tape_pulses[ tape_pulse_count - 1 ].length;
+
+  return 0;
+}
+
+/* Is the next pulse to be played part of a pilot tone? */
+static int
+tape_pulse_in_pilot( void )
+{
+  if( tape_pulse_next < tape_pulse_count )
+    return tape_pulses[ tape_pulse_next ].pilot;
+
+  return libspectrum_tape_state( tape ) == LIBSPECTRUM_TAPE_STATE_PILOT;
+}
+
+/* Make sure the backstop event is at the start of the last pulse */
+static void
+tape_pulse_schedule( void )
+{
+  event_remove_type( tape_edge_event );
+  event_add( tape_pulse_tstates + tape_pulse_remaining, tape_edge_event );
+}
+
+/* Throw away any decoded pulses and start again from the tape's current
+   position at 'start' */
+static void
+tape_pulse_restart( libspectrum_dword start )
+{
+  tape_pulse_tstates = start;
+  if( tape_pulse_fill() ) return;
+  tape_pulse_schedule();
+}
+
+/* Start the next pulse in the stream, at tape_pulse_tstates */
+static void
+tape_pulse_process( void )
+{
+  libspectrum_tape_block *block;
+  tape_pulse_t *pulse = &tape_pulses[ tape_pulse_next++ ];
+  libspectrum_dword edge_tstates = tape_pulse_tstates;
+  int flags = pulse->flags;
 
-  /* Get the time until the next edge */
-  libspec_error = libspectrum_tape_get_next_edge( &edge_tstates, &flags,
-						  tape );
-  if( libspec_error != LIBSPECTRUM_ERROR_NONE ) return;
+  tape_pulse_tstates += pulse->length;
+  if( tape_pulse_next < tape_pulse_count )
+    tape_pulse_remaining -= pulse->length;
 
   /* Invert the microphone state */
-  if( edge_tstates ||
+  if( pulse->length ||
       !( flags & LIBSPECTRUM_TAPE_FLAGS_NO_EDGE ) ||
       ( flags & ( LIBSPECTRUM_TAPE_FLAGS_STOP |
                   LIBSPECTRUM_TAPE_FLAGS_LEVEL_LOW |
@@ -839,10 +1046,10 @@ tape_next_edge( libspectrum_dword last_tstates, int type, void *user_data )
     }
   }
 
-  sound_beeper( last_tstates, tape_microphone );
+  sound_beeper( edge_tstates, tape_microphone );
 
   /* If we've been requested to stop the tape, do so and then
-     return without stacking another edge */
+     return without starting another pulse */
   if( ( flags & LIBSPECTRUM_TAPE_FLAGS_STOP ) ||
       ( ( flags & LIBSPECTRUM_TAPE_FLAGS_STOP48 ) && 
 	( !( libspectrum_machine_capabilities( machine_current->machine ) &
@@ -852,6 +1059,7 @@ tape_next_edge( libspectrum_dword last_tstates, int type, void *user_data )
       )
     )
   {
+    tape_pulse_clear();
     tape_stop();
     return;
   }
@@ -863,7 +1071,7 @@ tape_next_edge( libspectrum_dword last_tstates, int type, void *user_data )
 
     /* If the tape was started automatically, tape traps are active
        and the new block is a ROM loader, stop the tape and return
-       without putting another event into the queue */
+       without starting another pulse */
     block = libspectrum_tape_current_block( tape );
     if( tape_autoplay && settings_current.tape_traps &&
 	libspectrum_tape_block_type( block ) == LIBSPECTRUM_TAPE_BLOCK_ROM
@@ -873,16 +1081,61 @@ tape_next_edge( libspectrum_dword last_tstates, int type, void *user_data )
     }
   }
 
-  /* Otherwise, put this into the event queue; remember that this edge
-     should occur 'edge_tstates' after the last edge, not after the
-     current time (these will be slightly different as we only process
-     events between instructions). */
-  event_add( last_tstates + edge_tstates, tape_edge_event );
-
   /* Store length flags for acceleration purposes */
   loader_set_acceleration_flags( flags );
 }
 
+/* Bring the EAR level up to date with the tape at time 'until' */
+void
+tape_update( libspectrum_dword until )
+{
+  tape_pulse_updating = 1;
+
+  while( tape_playing && tape_pulse_tstates <= until ) {
+
+    if( tape_pulse_next == tape_pulse_count ) {
+      if( tape_pulse_fill() ) break;
+      tape_pulse_schedule();
+    }
+
+    tape_pulse_process();
+
+  }
+
+  tape_pulse_updating = 0;
+}
+
+/* Start the next pulse right now, as if the current one had finished
+   early; used by the loader acceleration */
+void
+tape_skip_to_next_edge( void )
+{
+  if( !tape_playing ) return;
+
+  tape_pulse_tstates = tstates;
+  tape_update( tstates );
+}
+
+void
+tape_frame( libspectrum_dword frame_length )
+{
+  if( !tape_playing ) return;
+
+  tape_update( frame_length - 1 );
+  tape_pulse_tstates -= frame_length;
+}
+
+void
+tape_next_edge( libspectrum_dword last_tstates, int type, void *user_data )
+{
+  /* If the tape's not playing, just return */
+  if( ! tape_playing ) return;
+
+  tape_update( last_tstates );
+
+  if( tape_playing ) tape_pulse_schedule();
+}
+
 static void
 tape_stop_mic_off( libspectrum_dword last_tstates, int type, void *user_data )
 {
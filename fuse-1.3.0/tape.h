@@ -47,6 +47,7 @@ int tape_write( const char *filename );
 int tape_can_autoload( void );
 
 int tape_load_trap( void );
+int tape_flash_load( void );
 int tape_save_trap( void );
 
 int tape_do_play( int autoplay );
@@ -54,11 +55,17 @@ int tape_toggle_play( int autoplay );
 
 void tape_next_edge( libspectrum_dword last_tstates, int type,
 		     void *user_data );
+void tape_update( libspectrum_dword until );
+void tape_skip_to_next_edge( void );
+void tape_frame( libspectrum_dword frame_length );
 
 int tape_stop( void );
 int tape_is_playing( void );
 int tape_present( void );
 
+/* Stop the traps, and loader detection, from moving the tape */
+void tape_freeze( int frozen );
+
 void tape_record_start( void );
 int tape_record_stop( void );
 
@@ -26,8 +26,10 @@
 #include <config.h>
 
 #include "event.h"
+#include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "movie.h"
+#include "peripherals/if1.h"
 #include "settings.h"
 #include "sound.h"
 #include "tape.h"
@@ -183,14 +185,17 @@ timer_frame( libspectrum_dword last_tstates, int event GCC_UNUSED,
   double current_time, difference;
   long tstates;
 
-  if( sound_enabled && settings_current.sound ) {
+  if( sound_enabled && settings_current.sound && !settings_current.headless &&
+      !fuse_emulation_hidden ) {
     timer_frame_callback_sound( last_tstates );
     return;
   }
 
-  /* If we're fastloading, just schedule another check in a frame's time
-     and do nothing else */
-  if( settings_current.fastload && tape_is_playing() ) {
+  /* If we're fastloading, running headless or catching the state up, just
+     schedule another check in a frame's time and do nothing else */
+  if( settings_current.headless || fuse_emulation_hidden ||
+      ( settings_current.fastload && tape_is_playing() ) ||
+      ( settings_current.mdr_fastload && if1_mdr_running() ) ) {
 
     libspectrum_dword next_check_time =
       last_tstates + machine_current->timings.tstates_per_frame;
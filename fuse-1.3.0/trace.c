@@ -0,0 +1,396 @@
+/* trace.c: Recording every instruction executed to a file
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* The emulation fills one buffer of records after another; each full
+   buffer is handed to a separate thread which writes it out, so the
+   emulation only waits for the disk if it gets a whole ring of buffers
+   ahead. Without threads, each buffer is written out as soon as it is
+   full */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif				/* #ifdef HAVE_PTHREAD */
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "infrastructure/startup_manager.h"
+#include "memory.h"
+#include "settings.h"
+#include "spectrum.h"
+#include "trace.h"
+#include "ui/ui.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+#define TRACE_BUFFER_RECORDS 32768
+
+#ifdef HAVE_PTHREAD
+#define TRACE_BUFFERS 4
+#else				/* #ifdef HAVE_PTHREAD */
+#define TRACE_BUFFERS 1
+#endif				/* #ifdef HAVE_PTHREAD */
+
+typedef struct trace_buffer {
+  libspectrum_byte data[ TRACE_BUFFER_RECORDS * TRACE_RECORD_LENGTH ];
+  size_t length;		/* Bytes in use */
+  int full;			/* Waiting to be written */
+} trace_buffer;
+
+int trace_active = 0;
+
+static FILE *trace_file = NULL;
+static char *trace_filename = NULL;
+
+static trace_buffer *buffers = NULL;
+
+/* Where the next record goes, and the end of the current buffer */
+static libspectrum_byte *next, *end;
+static int current;
+
+static libspectrum_dword limit;
+static libspectrum_qword saved;		/* Records written out so far */
+static int write_error, complete;
+
+#ifdef HAVE_PTHREAD
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buffer_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t buffer_empty = PTHREAD_COND_INITIALIZER;
+static int writer_to_write;		/* The next buffer the writer takes */
+static int writer_stop;
+#endif				/* #ifdef HAVE_PTHREAD */
+
+static libspectrum_byte*
+put_word( libspectrum_byte *ptr, libspectrum_word value )
+{
+  *ptr++ = value & 0xff; *ptr++ = value >> 8;
+  return ptr;
+}
+
+static libspectrum_byte*
+put_dword( libspectrum_byte *ptr, libspectrum_dword value )
+{
+  ptr = put_word( ptr, value & 0xffff );
+  return put_word( ptr, value >> 16 );
+}
+
+static void
+write_header( void )
+{
+  libspectrum_byte header[ TRACE_HEADER_LENGTH ], *ptr;
+
+  memset( header, 0, sizeof( header ) );
+  memcpy( header, TRACE_MAGIC, 7 );
+  header[7] = TRACE_VERSION;
+  header[8] = TRACE_RECORD_LENGTH;
+  header[9] = complete;
+
+  ptr = put_dword( header + 12, limit );
+  ptr = put_dword( ptr, saved & 0xffffffff );
+  put_dword( ptr, saved >> 32 );
+
+  if( fseek( trace_file, 0, SEEK_SET ) ||
+      fwrite( header, sizeof( header ), 1, trace_file ) != 1 )
+    write_error = errno ? errno : EIO;
+}
+
+/* Write out a buffer of records, wrapping around the ring if there is
+   one. Called by the writer */
+static void
+write_buffer( trace_buffer *buffer )
+{
+  const libspectrum_byte *ptr = buffer->data;
+  size_t records = buffer->length / TRACE_RECORD_LENGTH, count;
+  libspectrum_dword slot;
+
+  while( records && !write_error ) {
+
+    count = records;
+
+    if( limit ) {
+      slot = saved % limit;
+      if( count > limit - slot ) count = limit - slot;
+      if( fseeko( trace_file,
+                  TRACE_HEADER_LENGTH + (off_t)slot * TRACE_RECORD_LENGTH,
+                  SEEK_SET ) ) {
+        write_error = errno ? errno : EIO;
+        break;
+      }
+    }
+
+    if( fwrite( ptr, TRACE_RECORD_LENGTH, count, trace_file ) != count ) {
+      write_error = errno ? errno : EIO;
+      break;
+    }
+
+    ptr += count * TRACE_RECORD_LENGTH;
+    records -= count;
+    saved += count;
+  }
+}
+
+#ifdef HAVE_PTHREAD
+
+static void*
+writer_thread( void *arg GCC_UNUSED )
+{
+  trace_buffer *buffer;
+
+  pthread_mutex_lock( &lock );
+
+  while( 1 ) {
+
+    while( !buffers[ writer_to_write ].full && !writer_stop )
+      pthread_cond_wait( &buffer_full, &lock );
+
+    /* Only stop once everything has been written */
+    buffer = &buffers[ writer_to_write ];
+    if( !buffer->full ) break;
+
+    pthread_mutex_unlock( &lock );
+    write_buffer( buffer );
+    pthread_mutex_lock( &lock );
+
+    buffer->full = 0;
+    writer_to_write = ( writer_to_write + 1 ) % TRACE_BUFFERS;
+    pthread_cond_signal( &buffer_empty );
+  }
+
+  pthread_mutex_unlock( &lock );
+
+  return NULL;
+}
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
+/* Pass the current buffer to the writer and move on to the next one */
+static void
+hand_over( void )
+{
+  trace_buffer *buffer = &buffers[ current ];
+
+  buffer->length = next - buffer->data;
+
+#ifdef HAVE_PTHREAD
+
+  pthread_mutex_lock( &lock );
+
+  buffer->full = 1;
+  pthread_cond_signal( &buffer_full );
+
+  current = ( current + 1 ) % TRACE_BUFFERS;
+  while( buffers[ current ].full )
+    pthread_cond_wait( &buffer_empty, &lock );
+
+  pthread_mutex_unlock( &lock );
+
+#else				/* #ifdef HAVE_PTHREAD */
+
+  write_buffer( buffer );
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
+  next = buffers[ current ].data;
+  end = next + sizeof( buffers[ current ].data );
+}
+
+void
+trace_instruction( void )
+{
+  libspectrum_word pc = z80.pc.w;
+  const memory_page *page =
+    &memory_map_read[ pc >> MEMORY_PAGE_SIZE_LOGARITHM ];
+  libspectrum_byte *ptr = next;
+
+  if( z80.flags_lazy ) z80_flags_evaluate();
+
+  ptr = put_word( ptr, pc );
+  *ptr++ = page->source;
+  *ptr++ = page->page_num;
+  *ptr++ = readbyte_internal( pc );
+  *ptr++ = readbyte_internal( pc + 1 );
+  *ptr++ = readbyte_internal( pc + 2 );
+  *ptr++ = readbyte_internal( pc + 3 );
+  ptr = put_word( ptr, z80.af.w );
+  ptr = put_word( ptr, z80.bc.w );
+  ptr = put_word( ptr, z80.de.w );
+  ptr = put_word( ptr, z80.hl.w );
+  ptr = put_word( ptr, z80.ix.w );
+  ptr = put_word( ptr, z80.iy.w );
+  ptr = put_word( ptr, z80.sp.w );
+  *ptr++ = ( z80.r7 & 0x80 ) | ( z80.r & 0x7f );
+  *ptr++ = ( z80.iff1 ? TRACE_FLAG_IFF1 : 0 ) |
+           ( z80.iff2 ? TRACE_FLAG_IFF2 : 0 ) |
+           ( ( z80.im << 2 ) & TRACE_FLAG_IM ) |
+           ( z80.halted ? TRACE_FLAG_HALTED : 0 );
+  next = put_dword( ptr, tstates );
+
+  if( next == end ) hand_over();
+}
+
+int
+trace_start( const char *filename, libspectrum_dword ring )
+{
+  if( trace_active ) trace_stop();
+
+  trace_file = fopen( filename, "wb" );
+  if( !trace_file ) {
+    ui_error( UI_ERROR_ERROR, "Couldn't open trace file '%s': %s", filename,
+              strerror( errno ) );
+    return 1;
+  }
+
+  if( !buffers ) buffers = libspectrum_new0( trace_buffer, TRACE_BUFFERS );
+
+  trace_filename = utils_safe_strdup( filename );
+  limit = ring;
+  saved = 0;
+  write_error = complete = 0;
+
+  write_header();
+
+  current = 0;
+  next = buffers[ current ].data;
+  end = next + sizeof( buffers[ current ].data );
+
+#ifdef HAVE_PTHREAD
+  writer_to_write = 0;
+  writer_stop = 0;
+  if( pthread_create( &writer, NULL, writer_thread, NULL ) ) {
+    ui_error( UI_ERROR_ERROR, "Couldn't start the trace writer" );
+    fclose( trace_file ); trace_file = NULL;
+    libspectrum_free( trace_filename ); trace_filename = NULL;
+    return 1;
+  }
+#endif				/* #ifdef HAVE_PTHREAD */
+
+  trace_active = 1;
+
+  return 0;
+}
+
+/* Write the names of the memory sources after the last record */
+static void
+write_sources( void )
+{
+  libspectrum_byte count[2];
+  libspectrum_qword slots = limit ? limit : saved;
+  const char *name;
+  int i, sources = memory_source_count();
+
+  if( limit && saved < limit ) slots = saved;
+
+  if( fseeko( trace_file,
+              TRACE_HEADER_LENGTH + (off_t)slots * TRACE_RECORD_LENGTH,
+              SEEK_SET ) ) {
+    write_error = errno ? errno : EIO;
+    return;
+  }
+
+  put_word( count, sources );
+  fwrite( count, sizeof( count ), 1, trace_file );
+
+  for( i = 0; i < sources; i++ ) {
+    name = memory_source_description( i );
+    fwrite( name, strlen( name ) + 1, 1, trace_file );
+  }
+
+  if( ferror( trace_file ) ) write_error = errno ? errno : EIO;
+}
+
+int
+trace_stop( void )
+{
+  int error = 0;
+
+  if( !trace_active ) return 0;
+
+  trace_active = 0;
+
+  if( next != buffers[ current ].data ) hand_over();
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &lock );
+  writer_stop = 1;
+  pthread_cond_signal( &buffer_full );
+  pthread_mutex_unlock( &lock );
+  pthread_join( writer, NULL );
+#endif				/* #ifdef HAVE_PTHREAD */
+
+  write_sources();
+  complete = 1;
+  write_header();
+
+  if( fclose( trace_file ) && !write_error ) write_error = errno;
+  trace_file = NULL;
+
+  if( write_error ) {
+    ui_error( UI_ERROR_ERROR, "Error writing trace file '%s': %s",
+              trace_filename, strerror( write_error ) );
+    error = 1;
+  }
+
+  libspectrum_free( trace_filename ); trace_filename = NULL;
+
+  return error;
+}
+
+static int
+trace_init( void *context )
+{
+  if( settings_current.trace )
+    trace_start( settings_current.trace,
+                 settings_current.trace_limit > 0 ?
+                   settings_current.trace_limit : 0 );
+
+  return 0;
+}
+
+static void
+trace_end( void )
+{
+  trace_stop();
+
+  libspectrum_free( buffers ); buffers = NULL;
+}
+
+void
+trace_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_MEMORY,
+    STARTUP_MANAGER_MODULE_SETUID,
+    STARTUP_MANAGER_MODULE_Z80,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_TRACE, dependencies,
+                            ARRAY_SIZE( dependencies ), trace_init, NULL,
+                            trace_end );
+}
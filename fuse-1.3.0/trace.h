@@ -0,0 +1,77 @@
+/* trace.h: Recording every instruction executed to a file
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_TRACE_H
+#define FUSE_TRACE_H
+
+#include <libspectrum.h>
+
+/* A trace file is a header, the records and then the names of the memory
+   sources. Everything is little-endian.
+
+   Header:
+      0  8  "FuseTrc" and the format version
+      8  1  length of each record
+      9  1  1 once tracing has stopped and the file is complete
+     10  2  reserved, zero
+     12  4  records in the ring, or 0 if the file just grows
+     16  8  records written, once the file is complete
+
+   Each record, taken just before the instruction is fetched:
+      0  2  PC
+      2  1  memory source of the page PC is in
+      3  1  page number within that source
+      4  4  the four bytes from PC on
+      8 14  AF, BC, DE, HL, IX, IY, SP
+     22  1  R
+     23  1  IFF1 (bit 0), IFF2 (bit 1), IM (bits 2-3), halted (bit 4)
+     24  4  tstates since the start of the frame
+
+   In a ring, record n is written to slot n modulo the ring's size. The
+   source names follow the last slot: a count (2 bytes), then each name nul
+   terminated */
+
+#define TRACE_MAGIC "FuseTrc"
+#define TRACE_VERSION 1
+
+#define TRACE_HEADER_LENGTH 24
+#define TRACE_RECORD_LENGTH 28
+
+#define TRACE_FLAG_IFF1   0x01
+#define TRACE_FLAG_IFF2   0x02
+#define TRACE_FLAG_IM     0x0c
+#define TRACE_FLAG_HALTED 0x10
+
+extern int trace_active;
+
+void trace_register_startup( void );
+
+/* Start recording to `filename'; if `limit' is non-zero, only the last
+   `limit' instructions are kept */
+int trace_start( const char *filename, libspectrum_dword limit );
+int trace_stop( void );
+
+/* Record the instruction about to be executed */
+void trace_instruction( void );
+
+#endif			/* #ifndef FUSE_TRACE_H */
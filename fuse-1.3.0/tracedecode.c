@@ -0,0 +1,396 @@
+/* tracedecode.c: Print the instructions recorded in a trace file
+   Copyright (c) 2016 Philip Kendall
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* Built with CORETEST defined, so the disassembler reads the instruction
+   bytes through readbyte_internal() below rather than from the memory
+   map */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <libspectrum.h>
+
+#include "debugger/debugger.h"
+#include "memory.h"
+#include "trace.h"
+
+#define MAX_FILTERS 16
+
+typedef struct address_filter {
+  libspectrum_word start, end;
+} address_filter;
+
+typedef struct bank_filter {
+  const char *source;
+  int page;			/* -1 for any page */
+} bank_filter;
+
+static const char *progname;
+
+static address_filter address_filters[ MAX_FILTERS ];
+static size_t address_filter_count = 0;
+
+static bank_filter bank_filters[ MAX_FILTERS ];
+static size_t bank_filter_count = 0;
+
+static int show_registers = 0;
+
+static char **sources = NULL;
+static size_t source_count = 0;
+
+/* The instruction being disassembled */
+static libspectrum_word record_pc;
+static const libspectrum_byte *record_bytes;
+
+int debugger_output_base = 16;
+
+libspectrum_byte
+readbyte_internal( libspectrum_word address )
+{
+  libspectrum_word offset = address - record_pc;
+
+  return offset < 4 ? record_bytes[ offset ] : 0;
+}
+
+static libspectrum_word
+get_word( const libspectrum_byte *ptr )
+{
+  return ptr[0] | ( ptr[1] << 8 );
+}
+
+static libspectrum_dword
+get_dword( const libspectrum_byte *ptr )
+{
+  return get_word( ptr ) | ( (libspectrum_dword)get_word( ptr + 2 ) << 16 );
+}
+
+static void
+usage( void )
+{
+  fprintf( stderr,
+           "Usage: %s [options] <tracefile>\n"
+           "  -a, --address START-END  only instructions at these addresses\n"
+           "  -b, --bank SOURCE[:PAGE] only instructions in this memory "
+                                       "bank, e.g. RAM:5\n"
+           "  -r, --registers          show the registers before each "
+                                       "instruction\n"
+           "Several -a or -b options select any of the addresses or banks.\n",
+           progname );
+}
+
+static int
+parse_number( const char *string, char **end, long max, long *value )
+{
+  errno = 0;
+  *value = strtol( string, end, 0 );
+  return errno || *end == string || *value < 0 || *value > max;
+}
+
+static int
+parse_address( const char *string )
+{
+  address_filter *filter;
+  long start, end;
+  char *ptr;
+
+  if( address_filter_count == MAX_FILTERS ) return 1;
+
+  if( parse_number( string, &ptr, 0xffff, &start ) ) return 1;
+
+  if( *ptr == '-' ) {
+    if( parse_number( ptr + 1, &ptr, 0xffff, &end ) || end < start )
+      return 1;
+  } else {
+    end = start;
+  }
+  if( *ptr ) return 1;
+
+  filter = &address_filters[ address_filter_count++ ];
+  filter->start = start; filter->end = end;
+
+  return 0;
+}
+
+static int
+parse_bank( char *string )
+{
+  bank_filter *filter;
+  char *colon, *end;
+  long page = -1;
+
+  if( bank_filter_count == MAX_FILTERS ) return 1;
+
+  colon = strrchr( string, ':' );
+  if( colon ) {
+    if( parse_number( colon + 1, &end, 255, &page ) || *end ) return 1;
+    *colon = '\0';
+  }
+
+  filter = &bank_filters[ bank_filter_count++ ];
+  filter->source = string; filter->page = page;
+
+  return 0;
+}
+
+static const char*
+source_name( int source )
+{
+  return (size_t)source < source_count ? sources[ source ] : NULL;
+}
+
+static int
+wanted( const libspectrum_byte *record )
+{
+  libspectrum_word pc = get_word( record );
+  const char *name;
+  size_t i;
+  int found;
+
+  if( address_filter_count ) {
+    for( i = 0, found = 0; i < address_filter_count && !found; i++ )
+      found = pc >= address_filters[i].start && pc <= address_filters[i].end;
+    if( !found ) return 0;
+  }
+
+  if( bank_filter_count ) {
+    name = source_name( record[2] );
+    for( i = 0, found = 0; i < bank_filter_count && !found; i++ )
+      found = name && !strcasecmp( name, bank_filters[i].source ) &&
+              ( bank_filters[i].page == -1 ||
+                bank_filters[i].page == record[3] );
+    if( !found ) return 0;
+  }
+
+  return 1;
+}
+
+static void
+print_record( const libspectrum_byte *record, unsigned long frame )
+{
+  char instruction[ 40 ], bank[ 40 ], bytes[ 16 ];
+  const char *name;
+  size_t length, i;
+
+  record_pc = get_word( record );
+  record_bytes = record + 4;
+  debugger_disassemble( instruction, sizeof( instruction ), &length,
+                        record_pc );
+
+  bytes[0] = '\0';
+  for( i = 0; i < length && i < 4; i++ )
+    snprintf( bytes + 3 * i, sizeof( bytes ) - 3 * i, "%02X ",
+              record[ 4 + i ] );
+
+  name = source_name( record[2] );
+  if( name ) {
+    snprintf( bank, sizeof( bank ), "%s %d", name, record[3] );
+  } else {
+    snprintf( bank, sizeof( bank ), "source %d %d", record[2], record[3] );
+  }
+
+  printf( "%7lu %6lu  %-12s %04X  %-12s %-*s", frame,
+          (unsigned long)get_dword( record + 24 ), bank, record_pc, bytes,
+          show_registers ? 20 : 0, instruction );
+
+  if( show_registers )
+    printf( " AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SP=%04X"
+            " R=%02X IFF=%d/%d IM%d%s",
+            get_word( record + 8 ), get_word( record + 10 ),
+            get_word( record + 12 ), get_word( record + 14 ),
+            get_word( record + 16 ), get_word( record + 18 ),
+            get_word( record + 20 ), record[22],
+            !!( record[23] & TRACE_FLAG_IFF1 ),
+            !!( record[23] & TRACE_FLAG_IFF2 ),
+            ( record[23] & TRACE_FLAG_IM ) >> 2,
+            record[23] & TRACE_FLAG_HALTED ? " HALT" : "" );
+
+  printf( "\n" );
+}
+
+/* Read the names of the memory sources from after the last record */
+static void
+read_sources( FILE *f, off_t offset )
+{
+  libspectrum_byte count[2];
+  char name[ 256 ];
+  size_t i, j;
+  int c;
+
+  if( fseeko( f, offset, SEEK_SET ) || fread( count, 2, 1, f ) != 1 ) return;
+
+  source_count = get_word( count );
+  sources = calloc( source_count, sizeof( *sources ) );
+  if( !sources ) { source_count = 0; return; }
+
+  for( i = 0; i < source_count; i++ ) {
+    for( j = 0; ( c = getc( f ) ) != EOF && c && j < sizeof( name ) - 1; j++ )
+      name[j] = c;
+    name[j] = '\0';
+    if( c == EOF ) { source_count = i; break; }
+    sources[i] = strdup( name );
+    if( !sources[i] ) { source_count = i; break; }
+  }
+}
+
+static int
+decode( FILE *f, const char *filename )
+{
+  libspectrum_byte header[ TRACE_HEADER_LENGTH ], *record;
+  libspectrum_dword limit, last_tstates = 0, now;
+  libspectrum_qword total, slots, first, n;
+  unsigned long frame = 0;
+  size_t record_length;
+  off_t size;
+
+  if( fread( header, sizeof( header ), 1, f ) != 1 ||
+      memcmp( header, TRACE_MAGIC, 7 ) ) {
+    fprintf( stderr, "%s: `%s' is not a trace file\n", progname, filename );
+    return 1;
+  }
+
+  if( header[7] != TRACE_VERSION || header[8] < TRACE_RECORD_LENGTH ) {
+    fprintf( stderr, "%s: `%s' has an unknown trace format\n", progname,
+             filename );
+    return 1;
+  }
+
+  record_length = header[8];
+  limit = get_dword( header + 12 );
+  total = get_dword( header + 16 ) |
+          ( (libspectrum_qword)get_dword( header + 20 ) << 32 );
+
+  /* Tracing didn't stop cleanly, so go by the length of the file. In a
+     ring, where the oldest record is can't be told */
+  if( !header[9] ) {
+    if( fseeko( f, 0, SEEK_END ) || ( size = ftello( f ) ) < 0 ) {
+      fprintf( stderr, "%s: couldn't find the length of `%s': %s\n",
+               progname, filename, strerror( errno ) );
+      return 1;
+    }
+    total = ( size - TRACE_HEADER_LENGTH ) / record_length;
+    if( limit && total > limit ) total = limit;
+    if( total )
+      fprintf( stderr, "%s: `%s' is incomplete; the last few records may "
+               "be missing%s\n", progname, filename,
+               limit ? " and the order may be wrong" : "" );
+    if( bank_filter_count )
+      fprintf( stderr, "%s: `%s' has no memory bank names, so no "
+               "instructions match -b\n", progname, filename );
+  } else {
+    slots = limit && total > limit ? limit : total;
+    read_sources( f, TRACE_HEADER_LENGTH + (off_t)slots * record_length );
+  }
+
+  slots = limit && total > limit ? limit : total;
+  first = limit && total > limit ? total % limit : 0;
+
+  record = malloc( record_length );
+  if( !record ) {
+    fprintf( stderr, "%s: out of memory\n", progname );
+    return 1;
+  }
+
+  for( n = 0; n < slots; n++ ) {
+
+    if( n == 0 || first + n == slots ) {
+      if( fseeko( f, TRACE_HEADER_LENGTH +
+                     (off_t)( ( first + n ) % slots ) * record_length,
+                  SEEK_SET ) ) {
+        fprintf( stderr, "%s: couldn't seek in `%s': %s\n", progname,
+                 filename, strerror( errno ) );
+        free( record );
+        return 1;
+      }
+    }
+
+    if( fread( record, record_length, 1, f ) != 1 ) {
+      fprintf( stderr, "%s: `%s' is truncated\n", progname, filename );
+      free( record );
+      return 1;
+    }
+
+    /* The tstate count starts again at each frame */
+    now = get_dword( record + 24 );
+    if( n && now < last_tstates ) frame++;
+    last_tstates = now;
+
+    if( wanted( record ) ) print_record( record, frame );
+  }
+
+  free( record );
+
+  return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+  const char *filename = NULL;
+  FILE *f;
+  int i, error;
+
+  progname = argv[0];
+
+  for( i = 1; i < argc; i++ ) {
+
+    if( !strcmp( argv[i], "-a" ) || !strcmp( argv[i], "--address" ) ) {
+      if( ++i == argc || parse_address( argv[i] ) ) {
+        usage(); return 1;
+      }
+    } else if( !strcmp( argv[i], "-b" ) || !strcmp( argv[i], "--bank" ) ) {
+      if( ++i == argc || parse_bank( argv[i] ) ) {
+        usage(); return 1;
+      }
+    } else if( !strcmp( argv[i], "-r" ) ||
+               !strcmp( argv[i], "--registers" ) ) {
+      show_registers = 1;
+    } else if( argv[i][0] == '-' || filename ) {
+      usage(); return 1;
+    } else {
+      filename = argv[i];
+    }
+
+  }
+
+  if( !filename ) {
+    usage(); return 1;
+  }
+
+  f = fopen( filename, "rb" );
+  if( !f ) {
+    fprintf( stderr, "%s: couldn't open `%s': %s\n", progname, filename,
+             strerror( errno ) );
+    return 1;
+  }
+
+  error = decode( f, filename );
+
+  fclose( f );
+
+  return error;
+}
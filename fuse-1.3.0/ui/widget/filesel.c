@@ -28,17 +28,18 @@
 #include <config.h>
 
 #include <sys/types.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef WIN32
 #include <windows.h>
 #include <direct.h>
-#include <ctype.h>
 #endif				/* #ifdef WIN32 */
 
 #include "fuse.h"
@@ -120,6 +121,56 @@ char* widget_filesel_name;
 /* Should we exit all widgets when we're done with this selector? */
 static int exit_all_widgets;
 
+/* The most recently scanned directories, so that going back into one
+   doesn't read and stat() every entry again */
+#define SCAN_CACHE_SIZE 8
+
+typedef struct scan_cache_entry {
+  char *path;
+  time_t mtime;		/* of the directory itself when it was scanned */
+  size_t count;
+  struct widget_dirent *files;
+#ifdef WIN32
+  int is_rootdir;
+#endif				/* #ifdef WIN32 */
+} scan_cache_entry;
+
+static scan_cache_entry scan_cache[ SCAN_CACHE_SIZE ];
+static size_t scan_cache_next;
+
+/* For each initial character the first file starting with it, and for
+   each file the next one with the same initial, or (size_t)-1 */
+static size_t initial_first[ 256 ];
+static size_t *initial_next;
+
+static void
+scan_cache_free_entry( scan_cache_entry *entry )
+{
+  size_t i;
+
+  if( !entry->path ) return;
+
+  for( i = 0; i < entry->count; i++ ) free( entry->files[i].name );
+  free( entry->files );
+  free( entry->path );
+
+  entry->path = NULL;
+  entry->files = NULL;
+  entry->count = 0;
+}
+
+void
+widget_filesel_cache_clear( void )
+{
+  size_t i;
+
+  for( i = 0; i < SCAN_CACHE_SIZE; i++ )
+    scan_cache_free_entry( &scan_cache[i] );
+
+  free( initial_next );
+  initial_next = NULL;
+}
+
 static char *
 widget_get_filename( const char *title, int saving )
 {
@@ -398,9 +449,160 @@ static int widget_scandrives( struct widget_dirent ***namelist )
 }
 #endif
 
+/* Copy the cached listing of `dir' into widget_filenames if we have one
+   and the directory hasn't changed since */
+static int
+scan_cache_lookup( const char *dir, time_t mtime )
+{
+  scan_cache_entry *entry = NULL;
+  size_t i, j;
+
+  for( i = 0; i < SCAN_CACHE_SIZE; i++ ) {
+    if( scan_cache[i].path && !strcmp( scan_cache[i].path, dir ) ) {
+      entry = &scan_cache[i];
+      break;
+    }
+  }
+
+  if( !entry ) return 1;
+
+  if( entry->mtime != mtime ) {
+    scan_cache_free_entry( entry );
+    return 1;
+  }
+
+  widget_filenames =
+    malloc( ( entry->count ? entry->count : 1 ) * sizeof( *widget_filenames ) );
+  if( !widget_filenames ) return 1;
+
+  for( i = 0; i < entry->count; i++ ) {
+    widget_filenames[i] = malloc( sizeof( *widget_filenames[i] ) );
+    if( widget_filenames[i] ) {
+      widget_filenames[i]->name = malloc( strlen( entry->files[i].name ) + 1 );
+      if( !widget_filenames[i]->name ) free( widget_filenames[i] );
+    }
+    if( !widget_filenames[i] || !widget_filenames[i]->name ) {
+      for( j = 0; j < i; j++ ) {
+        free( widget_filenames[j]->name );
+        free( widget_filenames[j] );
+      }
+      free( widget_filenames );
+      widget_filenames = NULL;
+      return 1;
+    }
+
+    strcpy( widget_filenames[i]->name, entry->files[i].name );
+    widget_filenames[i]->mode = entry->files[i].mode;
+  }
+
+  widget_numfiles = entry->count;
+#ifdef WIN32
+  is_rootdir = entry->is_rootdir;
+#endif				/* #ifdef WIN32 */
+
+  return 0;
+}
+
+/* Remember the listing now in widget_filenames; failing to do so just
+   means the next visit scans again */
+static void
+scan_cache_store( const char *dir, time_t mtime )
+{
+  scan_cache_entry *entry = NULL;
+  size_t i;
+
+  for( i = 0; i < SCAN_CACHE_SIZE; i++ ) {
+    if( scan_cache[i].path && !strcmp( scan_cache[i].path, dir ) ) {
+      entry = &scan_cache[i];
+      break;
+    }
+  }
+
+  if( !entry ) {
+    entry = &scan_cache[ scan_cache_next ];
+    scan_cache_next = ( scan_cache_next + 1 ) % SCAN_CACHE_SIZE;
+  }
+
+  scan_cache_free_entry( entry );
+
+  entry->path = malloc( strlen( dir ) + 1 );
+  entry->files =
+    malloc( ( widget_numfiles ? widget_numfiles : 1 ) *
+            sizeof( *entry->files ) );
+  if( !entry->path || !entry->files ) {
+    free( entry->path ); entry->path = NULL;
+    free( entry->files ); entry->files = NULL;
+    return;
+  }
+
+  strcpy( entry->path, dir );
+  entry->mtime = mtime;
+#ifdef WIN32
+  entry->is_rootdir = is_rootdir;
+#endif				/* #ifdef WIN32 */
+
+  for( i = 0; i < widget_numfiles; i++ ) {
+    entry->files[i].name = malloc( strlen( widget_filenames[i]->name ) + 1 );
+    if( !entry->files[i].name ) {
+      entry->count = i;
+      scan_cache_free_entry( entry );
+      return;
+    }
+    strcpy( entry->files[i].name, widget_filenames[i]->name );
+    entry->files[i].mode = widget_filenames[i]->mode;
+  }
+
+  entry->count = widget_numfiles;
+}
+
+/* Rebuild the by-initial index used to jump to a file by typing its
+   first character */
+static void
+widget_filesel_index( void )
+{
+  size_t i; int c;
+
+  free( initial_next );
+  initial_next = NULL;
+
+  for( c = 0; c < 256; c++ ) initial_first[c] = (size_t)-1;
+
+  if( widget_numfiles == (size_t)-1 || !widget_numfiles ) return;
+
+  initial_next = malloc( widget_numfiles * sizeof( *initial_next ) );
+  if( !initial_next ) return;
+
+  for( i = widget_numfiles; i-- > 0; ) {
+    c = tolower( (unsigned char)widget_filenames[i]->name[0] );
+    initial_next[i] = initial_first[c];
+    initial_first[c] = i;
+  }
+}
+
+static size_t
+widget_filesel_find_initial( int c )
+{
+  size_t next;
+
+  c = tolower( c );
+
+  if( !initial_next || initial_first[c] == (size_t)-1 ) return current_file;
+
+  /* Cycle through the files with this initial on repeated presses */
+  if( tolower( (unsigned char)widget_filenames[ current_file ]->name[0] ) ==
+      c ) {
+    next = initial_next[ current_file ];
+    if( next != (size_t)-1 ) return next;
+  }
+
+  return initial_first[c];
+}
+
 static void widget_scan( char *dir )
 {
   struct stat file_info;
+  time_t mtime = 0;
+  int cacheable = 0;
 
   size_t i; int error;
   
@@ -409,6 +611,20 @@ static void widget_scan( char *dir )
     free( widget_filenames[i]->name );
     free( widget_filenames[i] );
   }
+  free( widget_filenames );
+  widget_filenames = NULL;
+  widget_numfiles = 0;
+
+  /* A directory modified in the current second could change again without
+     its mtime moving on, so only trust listings of older ones */
+  if( dir && !stat( dir, &file_info ) ) {
+    mtime = file_info.st_mtime;
+    cacheable = mtime < time( NULL );
+    if( cacheable && !scan_cache_lookup( dir, mtime ) ) {
+      widget_filesel_index();
+      return;
+    }
+  }
 
 #ifdef WIN32
   if( dir ) {
@@ -422,7 +638,10 @@ static void widget_scan( char *dir )
 				    widget_select_file );
 #endif				/* #ifdef WIN32 */
 
-  if( widget_numfiles == (size_t)-1 ) return;
+  if( widget_numfiles == (size_t)-1 ) {
+    widget_filesel_index();
+    return;
+  }
 
   for( i=0; i<widget_numfiles; i++ ) {
     error = stat( widget_filenames[i]->name, &file_info );
@@ -432,6 +651,9 @@ static void widget_scan( char *dir )
   qsort( widget_filenames, widget_numfiles, sizeof(struct widget_dirent*),
 	 (int(*)(const void*,const void*))widget_scan_compare );
 
+  if( cacheable ) scan_cache_store( dir, mtime );
+
+  widget_filesel_index();
 }
 
 static int
@@ -949,7 +1171,10 @@ widget_filesel_keyhandler( input_key key )
 #endif				/* #ifdef WIN32 */
     break;
 
-  default:	/* Keep gcc happy */
+  default:
+    /* Jump to the next file starting with that letter or digit */
+    if( key < 0x80 && isalnum( key ) )
+      new_current_file = widget_filesel_find_initial( key );
     break;
 
   }
@@ -45,9 +45,13 @@
 #include <fcntl.h>
 
 #include <sys/mman.h>
+#include <time.h>
 
+#include "display.h"
+#include "machine.h"
 #include "ui/fb/fbdisplay.h"
 #include "sound.h"
+#include "utils.h"
 
 #define MENU_MSG_INFO -1
 #define MENU_VIRTUAL_KEYBOARD 0
@@ -1175,81 +1179,133 @@ void displaySettings() {
     }
 }
 
+// What was last drawn in each game list row, so that navigating only
+// redraws (and pushes to the display) the rows that changed
+typedef struct {
+    int game;
+    int present;
+    int favourite;
+    int selected;
+} GAME_LIST_ROW;
+
+GAME_LIST_ROW gameListRows[NUM_GAMES_ON_SCREEN];
+int gameListRowsValid = 0;
+
 void displayGameList(int offset) {
     char path[64];
     getcwd(&path, 64);
     strcat(&path, "/roms/");
 
-    int i=0;
+    int i;
     int x, y;
     int stringWidth;
-    int resetY = 0;
+    int fullRedraw = !gameListRowsValid;
+    int ended = 0;
 
     if (offset < 0)
         offset = 0;
     if (offset > MAX_GAME_NUM)
         offset = MAX_GAME_NUM;
 
-    int limit = offset + NUM_GAMES_ON_SCREEN;
+    // Left edge, column split and right edge of the list area
+    int rowLeft = virtual_keyboard.x_pos+30;
+    int rowSplit = -16 + (virtual_keyboard.width/2) + 1 + 8*DISPLAY_BORDER_WIDTH_COLS;
+    int rowRight = virtual_keyboard.x_pos+30 + virtual_keyboard.width+5;
+
+    if (fullRedraw) {
+        // Clear screen
+        widget_draw_rectangle_solid( virtual_keyboard.x_pos+30,
+                                     virtual_keyboard.y_pos+30,
+                                     virtual_keyboard.width+5,
+                                     virtual_keyboard.height,
+                                     WIDGET_COLOUR_BACKGROUND );
+    }
 
-    // Clear screen
-    widget_draw_rectangle_solid( virtual_keyboard.x_pos+30,
-                                 virtual_keyboard.y_pos+30,
-                                 virtual_keyboard.width+5,
-                                 virtual_keyboard.height,
-                                 WIDGET_COLOUR_BACKGROUND );
+    for (i = 0; i < NUM_GAMES_ON_SCREEN; i++) {
+        GAME_LIST_ROW row;
+        int game = offset + i;
 
-    while (offset < limit) {
-        if (gameData[offset].filename) {
-            char filePath[256];
-            strcpy(&filePath, &path);
-            strncat(&filePath, gameData[offset].filename, 256 - 64);
+        row.game = -1;
+        row.present = 0;
+        row.favourite = 0;
+        row.selected = 0;
 
-            x = -16;
-            y = i*8;
-            if (i >= NUM_GAMES_ON_SCREEN / 2) {
-                if (resetY == 0)
-                    resetY = i;
-                x = -16 + (virtual_keyboard.width/2) + 1;
-                y = (i-resetY)*8;
+        if (!ended && gameData[game].filename) {
+            row.game = game;
+            row.favourite = gameData[game].isFavourite == 1;
+            row.selected = i == selectedGameOnScreen;
+
+            // Only look for the file when a new game scrolls into the row
+            if (!fullRedraw && gameListRows[i].game == game) {
+                row.present = gameListRows[i].present;
             }
-            if (access(&filePath, F_OK) != -1) {
-                if (gameData[offset].isFavourite == 1)
-                    stringWidth = widget_printstring(x, y, 10, gameData[offset].title);
-                else
-                    stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, gameData[offset].title);
+            else {
+                char filePath[256];
+                strcpy(&filePath, &path);
+                strncat(&filePath, gameData[game].filename, 256 - 64);
+                row.present = access(&filePath, F_OK) != -1;
+            }
+        }
+        else
+            ended = 1;
 
-                if (i == selectedGameOnScreen) {
-                    if (i >= NUM_GAMES_ON_SCREEN / 2) {
-                        widget_draw_rectangle_solid(x + 8*DISPLAY_BORDER_WIDTH_COLS,
-                                                    y + 8*DISPLAY_BORDER_HEIGHT_COLS,
-                                                    stringWidth+16 - (virtual_keyboard.width/2)-1, 8,
-                                                    WIDGET_COLOUR_HIGHLIGHT );
-                    }
-                    else {
-                        widget_draw_rectangle_solid(x + 8*DISPLAY_BORDER_WIDTH_COLS,
-                                                    y + 8*DISPLAY_BORDER_HEIGHT_COLS,
-                                                    stringWidth+16, 8,
-                                                    WIDGET_COLOUR_HIGHLIGHT );
-                    }
+        if (!fullRedraw && memcmp(&row, &gameListRows[i], sizeof(row)) == 0)
+            continue;
+        gameListRows[i] = row;
 
-                    if (gameData[offset].isFavourite == 1)
-                        stringWidth = widget_printstring(x, y, 10, gameData[offset].title);
-                    else
-                        stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, gameData[offset].title);
+        x = -16;
+        y = i*8;
+        if (i >= NUM_GAMES_ON_SCREEN / 2) {
+            x = -16 + (virtual_keyboard.width/2) + 1;
+            y = (i - NUM_GAMES_ON_SCREEN / 2)*8;
+        }
+
+        if (!fullRedraw) {
+            if (i >= NUM_GAMES_ON_SCREEN / 2)
+                widget_draw_rectangle_solid(rowSplit, y + 8*DISPLAY_BORDER_HEIGHT_COLS,
+                                            rowRight - rowSplit, 8,
+                                            WIDGET_COLOUR_BACKGROUND );
+            else
+                widget_draw_rectangle_solid(rowLeft, y + 8*DISPLAY_BORDER_HEIGHT_COLS,
+                                            rowSplit - rowLeft, 8,
+                                            WIDGET_COLOUR_BACKGROUND );
+        }
+
+        if (row.game >= 0 && row.present) {
+            if (row.favourite)
+                stringWidth = widget_printstring(x, y, 10, gameData[game].title);
+            else
+                stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, gameData[game].title);
+
+            if (row.selected) {
+                if (i >= NUM_GAMES_ON_SCREEN / 2) {
+                    widget_draw_rectangle_solid(x + 8*DISPLAY_BORDER_WIDTH_COLS,
+                                                y + 8*DISPLAY_BORDER_HEIGHT_COLS,
+                                                stringWidth+16 - (virtual_keyboard.width/2)-1, 8,
+                                                WIDGET_COLOUR_HIGHLIGHT );
+                }
+                else {
+                    widget_draw_rectangle_solid(x + 8*DISPLAY_BORDER_WIDTH_COLS,
+                                                y + 8*DISPLAY_BORDER_HEIGHT_COLS,
+                                                stringWidth+16, 8,
+                                                WIDGET_COLOUR_HIGHLIGHT );
                 }
+
+                if (row.favourite)
+                    stringWidth = widget_printstring(x, y, 10, gameData[game].title);
+                else
+                    stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, gameData[game].title);
             }
-            i++;
         }
-        else
-            break;
-        offset++;
     }
 
-    y= 184;
-    stringWidth = widget_printstring(-16, y, WIDGET_COLOUR_FOREGROUND, "Use D-Pad (Up,Down,Left,Right) to navigate through");
-    y+= 10;
-    stringWidth = widget_printstring(-16, y, WIDGET_COLOUR_FOREGROUND, "games. F to play, 1 to mark as favourite");
+    if (fullRedraw) {
+        y= 184;
+        stringWidth = widget_printstring(-16, y, WIDGET_COLOUR_FOREGROUND, "Use D-Pad (Up,Down,Left,Right) to navigate through");
+        y+= 10;
+        stringWidth = widget_printstring(-16, y, WIDGET_COLOUR_FOREGROUND, "games. F to play, 1 to mark as favourite");
+        gameListRowsValid = 1;
+    }
 }
 
 void displaySDCardGameList(int offset) {
@@ -1709,56 +1765,201 @@ void displaySDGameInfo() {
     }
 }
 
-void displaySaveGameMenu() {
-    // Clear screen
-    printf("\nDisplaySettings %d", currentSettingsItem);
-    widget_draw_rectangle_solid( virtual_keyboard.x_pos+20,
-                                 virtual_keyboard.y_pos+20,
-                                 virtual_keyboard.width,
-                                 virtual_keyboard.height,
-                                 WIDGET_COLOUR_BACKGROUND );
+// Save state slots of the current game. Their existence, save time,
+// machine and a small preview are kept in "<game>.slots" next to the
+// states, so the save and load menus render without touching the SD card
+#define NUM_SAVE_SLOTS 8
+#define SLOT_THUMB_WIDTH 64
+#define SLOT_THUMB_HEIGHT 48
+#define SLOT_INDEX_MAGIC 0x544c5356 // "VSLT"
 
-    int stringWidth;
-    int x = 24;
-    int y = 30;
+typedef struct {
+    u_int8_t exists;
+    char machine[15];
+    u_int32_t timestamp;
+    u_int8_t thumb[SLOT_THUMB_WIDTH * SLOT_THUMB_HEIGHT]; // colour per pixel
+} SAVE_SLOT;
+
+typedef struct {
+    u_int32_t magic;
+    SAVE_SLOT slots[NUM_SAVE_SLOTS];
+} SAVE_SLOT_INDEX;
+
+SAVE_SLOT_INDEX slotIndex;
+int slotIndexGame = -1;
+int slotIndexFromSD = -1;
+
+// On disk the index is the magic, then for each slot the exists flag, the
+// machine, the timestamp and the preview, with no padding and the 32-bit
+// values little endian
+#define SLOT_FILE_LENGTH (1 + 15 + 4 + SLOT_THUMB_WIDTH * SLOT_THUMB_HEIGHT)
+
+static void putSlotDword(u_int8_t *ptr, u_int32_t value) {
+    ptr[0] = value & 0xff; ptr[1] = (value >> 8) & 0xff;
+    ptr[2] = (value >> 16) & 0xff; ptr[3] = value >> 24;
+}
+
+static u_int32_t getSlotDword(const u_int8_t *ptr) {
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((u_int32_t)ptr[3] << 24);
+}
+
+// Returns 0 if a valid index was read into slotIndex
+static int readSlotIndex(FILE *f) {
+    u_int8_t buffer[SLOT_FILE_LENGTH];
     int i;
-    char customString[40];
 
-    for (i=0;i<8;i++) {
-        sprintf(customString, "Save state %d", i+1);
-        if (i == currentSaveGame) {
-            stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
-            widget_draw_rectangle_solid(x + 8*DISPLAY_BORDER_WIDTH_COLS,
-                y + 8*DISPLAY_BORDER_HEIGHT_COLS,
-                stringWidth - x, 8,
-                WIDGET_COLOUR_HIGHLIGHT );
-            stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
-        }
-        else {
-            char gameState[255];
+    if (fread(buffer, 4, 1, f) != 1 || getSlotDword(buffer) != SLOT_INDEX_MAGIC)
+        return -1;
+    slotIndex.magic = SLOT_INDEX_MAGIC;
+
+    for (i=0;i<NUM_SAVE_SLOTS;i++) {
+        SAVE_SLOT *entry = &slotIndex.slots[i];
+
+        if (fread(buffer, sizeof(buffer), 1, f) != 1)
+            return -1;
+        entry->exists = buffer[0];
+        memcpy(entry->machine, buffer + 1, sizeof(entry->machine));
+        entry->machine[sizeof(entry->machine) - 1] = 0;
+        entry->timestamp = getSlotDword(buffer + 16);
+        memcpy(entry->thumb, buffer + 20, sizeof(entry->thumb));
+    }
+    return 0;
+}
+
+// Returns 0 if slotIndex was written
+static int writeSlotIndex(FILE *f) {
+    u_int8_t buffer[SLOT_FILE_LENGTH];
+    int i;
+
+    putSlotDword(buffer, SLOT_INDEX_MAGIC);
+    if (fwrite(buffer, 4, 1, f) != 1)
+        return -1;
+
+    for (i=0;i<NUM_SAVE_SLOTS;i++) {
+        const SAVE_SLOT *entry = &slotIndex.slots[i];
+
+        buffer[0] = entry->exists;
+        memcpy(buffer + 1, entry->machine, sizeof(entry->machine));
+        putSlotDword(buffer + 16, entry->timestamp);
+        memcpy(buffer + 20, entry->thumb, sizeof(entry->thumb));
+        if (fwrite(buffer, sizeof(buffer), 1, f) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+// Path of the current game's save state files, with the given suffix
+int getSaveStatePath(char *path, size_t length, const char *suffix) {
+    const char *filename;
+
+    if (lastGameLoaded < 0)
+        return -1;
+    if (lastGameLoadFromSD == 1)
+        filename = sdGameData[lastGameLoaded].filename;
+    else if (lastGameLoadFromSD == 0)
+        filename = gameData[lastGameLoaded].filename;
+    else
+        return -1;
+
 #ifdef __arm__
-            if (lastGameLoadFromSD == 1 && lastGameLoaded >=0)
-                sprintf(gameState, "/media/%s.s0%d", sdGameData[lastGameLoaded].filename, i+1);
-            else
-                sprintf(gameState, "/media/%s.s0%d", gameData[lastGameLoaded].filename, i+1);
+    snprintf(path, length, "/media/%s%s", filename, suffix);
 #else
-            if (lastGameLoadFromSD == 1 && lastGameLoaded >=0)
-                sprintf(gameState, "/home/./test/%s.s0%d", sdGameData[lastGameLoaded].filename, i+1);
-            else
-                sprintf(gameState, "/home/./test/%s.s0%d", gameData[lastGameLoaded].filename, i+1);
+    snprintf(path, length, "/home/./test/%s%s", filename, suffix);
 #endif
-            if (access(&gameState, F_OK) != -1)
-                stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
-            else
-                stringWidth = widget_printstring(x, y, 10, customString);
+    return 0;
+}
+
+// Read the current game's slot index, unless it is the one already held.
+// Games saved before the index existed are probed once, without previews
+void loadSaveSlotIndex() {
+    char path[255];
+    int i;
+
+    if (slotIndexGame == lastGameLoaded && slotIndexFromSD == lastGameLoadFromSD)
+        return;
+
+    memset(&slotIndex, 0, sizeof(slotIndex));
+    slotIndexGame = lastGameLoaded;
+    slotIndexFromSD = lastGameLoadFromSD;
+
+    if (getSaveStatePath(path, sizeof(path), ".slots"))
+        return;
+
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        if (readSlotIndex(f) == 0) {
+            fclose(f);
+            return;
+        }
+        fclose(f);
+        memset(&slotIndex, 0, sizeof(slotIndex));
+    }
+
+    for (i=0;i<NUM_SAVE_SLOTS;i++) {
+        char suffix[8];
+        struct stat info;
+
+        sprintf(suffix, ".s0%d", i+1);
+        if (getSaveStatePath(path, sizeof(path), suffix) == 0 &&
+            stat(path, &info) == 0) {
+            slotIndex.slots[i].exists = 1;
+            slotIndex.slots[i].timestamp = info.st_mtime;
         }
-        y+= 10;
     }
 }
 
-void displayLoadGameMenu() {
+// Record a just saved state: when, on what machine, and a preview taken
+// from the emulated screen as last drawn
+void updateSaveSlotIndex(int slot) {
+    char path[255];
+    int tx, ty;
+
+    if (slot < 0 || slot >= NUM_SAVE_SLOTS)
+        return;
+
+    loadSaveSlotIndex();
+
+    SAVE_SLOT *entry = &slotIndex.slots[slot];
+    entry->exists = 1;
+    entry->timestamp = time(NULL);
+    strncpy(entry->machine, machine_current->id, sizeof(entry->machine) - 1);
+    entry->machine[sizeof(entry->machine) - 1] = 0;
+
+    // display_last_screen holds (flash << 24) | (mode << 16) | (attr << 8) | data
+    // for each 8 pixel chunk; sample every fourth pixel of the main screen
+    for (ty=0;ty<SLOT_THUMB_HEIGHT;ty++) {
+        for (tx=0;tx<SLOT_THUMB_WIDTH;tx++) {
+            int px = tx * DISPLAY_WIDTH_COLS * 8 / SLOT_THUMB_WIDTH;
+            int py = ty * DISPLAY_HEIGHT / SLOT_THUMB_HEIGHT;
+            libspectrum_dword chunk = display_last_screen[
+                DISPLAY_BORDER_WIDTH_COLS + px / 8 +
+                (DISPLAY_BORDER_HEIGHT + py) * DISPLAY_SCREEN_WIDTH_COLS];
+            int data = chunk & 0xff, attr = (chunk >> 8) & 0xff;
+            int bright = (attr & 0x40) ? 8 : 0;
+            int ink = (attr & 0x07) | bright, paper = ((attr >> 3) & 0x07) | bright;
+            int set = (data & (0x80 >> (px % 8))) != 0;
+
+            if (chunk >> 24)
+                set = !set;
+            entry->thumb[ty * SLOT_THUMB_WIDTH + tx] = set ? ink : paper;
+        }
+    }
+
+    slotIndex.magic = SLOT_INDEX_MAGIC;
+    if (getSaveStatePath(path, sizeof(path), ".slots"))
+        return;
+
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        if (writeSlotIndex(f))
+            printf("\nError writing %s", path);
+        fclose(f);
+    }
+}
+
+// Draw the slot list from the index, with a preview of the selected slot
+void displaySaveSlots(const char *label, int currentSlot) {
     // Clear screen
-    printf("\nDisplaySettings %d", currentSettingsItem);
     widget_draw_rectangle_solid( virtual_keyboard.x_pos+20,
                                  virtual_keyboard.y_pos+20,
                                  virtual_keyboard.width,
@@ -1771,9 +1972,11 @@ void displayLoadGameMenu() {
     int i;
     char customString[40];
 
-    for (i=0;i<8;i++) {
-        sprintf(customString, "Load state %d", i+1);
-        if (i == currentLoadGame) {
+    loadSaveSlotIndex();
+
+    for (i=0;i<NUM_SAVE_SLOTS;i++) {
+        sprintf(customString, "%s %d", label, i+1);
+        if (i == currentSlot) {
             stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
             widget_draw_rectangle_solid(x + 8*DISPLAY_BORDER_WIDTH_COLS,
                 y + 8*DISPLAY_BORDER_HEIGHT_COLS,
@@ -1781,26 +1984,54 @@ void displayLoadGameMenu() {
                 WIDGET_COLOUR_HIGHLIGHT );
             stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
         }
-        else {
-            char gameState[255];
-#ifdef __arm__
-            if (lastGameLoadFromSD == 1 && lastGameLoaded >=0)
-                sprintf(gameState, "/media/%s.s0%d", sdGameData[lastGameLoaded].filename, i+1);
-            else
-                sprintf(gameState, "/media/%s.s0%d", gameData[lastGameLoaded].filename, i+1);
-#else
-            if (lastGameLoadFromSD == 1 && lastGameLoaded >=0)
-                sprintf(gameState, "/home/./test/%s.s0%d", sdGameData[lastGameLoaded].filename, i+1);
-            else
-                sprintf(gameState, "/home/./test/%s.s0%d", gameData[lastGameLoaded].filename, i+1);
-#endif
-            if (access(&gameState, F_OK) != -1)
-                stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
-            else
-                stringWidth = widget_printstring(x, y, 10, customString);
-        }
+        else if (slotIndex.slots[i].exists)
+            stringWidth = widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
+        else
+            stringWidth = widget_printstring(x, y, 10, customString);
         y+= 10;
     }
+
+    if (currentSlot < 0 || currentSlot >= NUM_SAVE_SLOTS ||
+        !slotIndex.slots[currentSlot].exists)
+        return;
+
+    SAVE_SLOT *entry = &slotIndex.slots[currentSlot];
+    int tx, ty;
+    x = 130;
+    y = 30;
+
+    if (entry->machine[0]) {
+        for (ty=0;ty<SLOT_THUMB_HEIGHT;ty++)
+            for (tx=0;tx<SLOT_THUMB_WIDTH;tx++)
+                widget_putpixel(x + tx, y + ty, entry->thumb[ty * SLOT_THUMB_WIDTH + tx]);
+        widget_draw_rectangle_outline(x + 8*DISPLAY_BORDER_WIDTH_COLS - 1,
+                                      y + 8*DISPLAY_BORDER_HEIGHT_COLS - 1,
+                                      SLOT_THUMB_WIDTH + 2, SLOT_THUMB_HEIGHT + 2,
+                                      WIDGET_COLOUR_FOREGROUND);
+        widget_damage_rasters(y + 8*DISPLAY_BORDER_HEIGHT_COLS - 1, SLOT_THUMB_HEIGHT + 2);
+    }
+    y += SLOT_THUMB_HEIGHT + 6;
+
+    time_t saved = entry->timestamp;
+    struct tm *when = localtime(&saved);
+    if (when) {
+        strftime(customString, sizeof(customString), "%d/%m %H:%M", when);
+        widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
+    }
+    y += 10;
+
+    if (entry->machine[0]) {
+        snprintf(customString, sizeof(customString), "Machine: %s", entry->machine);
+        widget_printstring(x, y, WIDGET_COLOUR_FOREGROUND, customString);
+    }
+}
+
+void displaySaveGameMenu() {
+    displaySaveSlots("Save state", currentSaveGame);
+}
+
+void displayLoadGameMenu() {
+    displaySaveSlots("Load state", currentLoadGame);
 }
 
 void displayRemapKeysMenu() {
@@ -2090,6 +2321,7 @@ widget_virtualkeyboard_draw( void *data )
                                  virtual_keyboard.height/8+3 );
 
       widget_printstring(-22, -16, WIDGET_COLOUR_TITLE, "Game List");
+      gameListRowsValid = 0;
       displayGameList(gameListOffset);
 
       int scale = machine_current->timex ? 2 : 1;
@@ -2495,11 +2727,33 @@ void doPleaseWait()
     uidisplay_frame_end();
 }
 
+// Progress bar under the "Please wait." message while the file is read in
+static void pleaseWaitProgress(size_t done, size_t total)
+{
+    int x = virtual_keyboard.x_pos + 24;
+    int y = virtual_keyboard.y_pos + 40;
+    int width = virtual_keyboard.width - 48;
+
+    if (total == 0)
+        return;
+
+    widget_rectangle(x - 2, y - 2, width + 4, 10, WIDGET_COLOUR_FOREGROUND);
+    widget_draw_rectangle_solid(x, y, width * (double)done / total, 6,
+                                WIDGET_COLOUR_HIGHLIGHT);
+
+    int scale = machine_current->timex ? 2 : 1;
+    uidisplay_area( 0, 0, scale * DISPLAY_ASPECT_WIDTH,
+                    scale * DISPLAY_SCREEN_HEIGHT );
+    uidisplay_frame_end();
+}
+
 void loadGame(char *fileName)
 {
     printf("Doing utils_open_file %s\n", fileName);
     fflush(stdout);    
+    utils_set_open_progress(pleaseWaitProgress);
     utils_open_file(fileName, tape_can_autoload(), NULL );    
+    utils_set_open_progress(NULL);
 }
 
 void msgInfo(char *title, char *text)
@@ -3072,10 +3326,8 @@ widget_virtualkeyboard_keyhandler( input_key key )
 
       }
 
-      int scale = machine_current->timex ? 2 : 1;
-      uidisplay_area( 0, 0, scale * DISPLAY_ASPECT_WIDTH,
-                      scale * DISPLAY_SCREEN_HEIGHT );
-      uidisplay_frame_end();
+      // Only the list rows redrawn above need to reach the display
+      widget_damage_flush();
   }
   else if (menuWidgetType == MENU_SAVE_GAME || menuWidgetType == MENU_LOAD_GAME) {
       int gameDetected = 0;
@@ -3151,7 +3403,8 @@ widget_virtualkeyboard_keyhandler( input_key key )
                   FILE *f = fopen(&gameState, "wt");
                   if (f) {
                       fclose(f);
-                      snapshot_write( gameState );
+                      if (snapshot_write( gameState ) == 0)
+                          updateSaveSlotIndex(selectedGameIndex);
                   }
                   else {
                       msgInfo("Error saving data in SD Card", "Please make sure that an SD Card\nis inserted in the Micro-SD slot.\nThe card must be formatted using\nFAT32.");
@@ -58,25 +58,32 @@
 #include <windows.h>
 #endif
 
-/* Bitmap font storage */
+/* Bitmap font storage. `bitmap' holds one byte per column as read from
+   the font file; `rows' is the same glyph transposed to one bit per column
+   for each raster, so drawing only visits set pixels */
 typedef struct {
   libspectrum_byte bitmap[15], left, width, defined;
+  libspectrum_word rows[8];
 } widget_font_character;
 
 static widget_font_character *widget_font[1] = {0};
 
-static const widget_font_character default_invalid = {
+static widget_font_character default_invalid = {
   { 0x7E, 0xDF, 0x9F, 0xB5, 0xA5, 0x8F, 0xDF, 0x7E }, 0, 8, 1
 }; /* "(?)" (inv) */
 
-static const widget_font_character default_unknown = {
+static widget_font_character default_unknown = {
   { 0x7C, 0xDE, 0xBE, 0xAA, 0xDE, 0x7C }, 1, 6, 1
 }; /* "(?)" */
 
-static const widget_font_character default_keyword = {
+static widget_font_character default_keyword = {
   { 0x7C, 0x82, 0xEE, 0xD6, 0xBA, 0x7C }, 1, 6, 1
 }; /* "(K)" */
 
+/* The span of display rasters drawn on since the last
+   widget_damage_flush() */
+static int damage_top = DISPLAY_SCREEN_HEIGHT, damage_bottom = 0;
+
 /* The current widget keyhandler */
 widget_keyhandler_fn widget_keyhandler;
 
@@ -95,6 +102,18 @@ static widget_recurse_t widget_return[10]; /* The stack to recurse on */
 /* The settings used whilst playing with an options dialog box */
 settings_info widget_options_settings;
 
+static void
+widget_font_rows( widget_font_character *ch )
+{
+  int mx, my;
+
+  for( my = 0; my < 8; my++ ) {
+    ch->rows[my] = 0;
+    for( mx = 0; mx < ch->width; mx++ )
+      if( ch->bitmap[mx] & 128 >> my ) ch->rows[my] |= 1 << mx;
+  }
+}
+
 static int widget_read_font( const char *filename )
 {
   utils_file file;
@@ -151,6 +170,7 @@ static int widget_read_font( const char *filename )
     widget_font[page][code].left = left < 0 ? 0 : left;
     widget_font[page][code].width = width ? width : 3;
     memcpy( &widget_font[page][code].bitmap, &file.buffer[i+3], width );
+    widget_font_rows( &widget_font[page][code] );
 
     i += 3 + width;
   }
@@ -172,13 +192,12 @@ widget_char( int pp )
 static int
 printchar( int x, int y, int col, int ch )
 {
-  int mx, my;
+  int mx, my, row;
   const widget_font_character *bitmap = widget_char( ch );
 
-  for( mx = 0; mx < bitmap->width; mx++ ) {
-    int b = bitmap->bitmap[mx];
-    for( my = 0; my < 8; my++ )
-      if( b & 128 >> my ) widget_putpixel( x + mx, y + my, col );
+  for( my = 0; my < 8; my++ ) {
+    for( mx = 0, row = bitmap->rows[my]; row; mx++, row >>= 1 )
+      if( row & 1 ) widget_putpixel( x + mx, y + my, col );
   }
 
   return x + bitmap->width + 1;
@@ -191,6 +210,9 @@ widget_printstring( int x, int y, int col, const char *s )
   int shadow = 0;
   if( !s ) return x;
 
+  /* Allow for a shadow one pixel either side */
+  widget_damage_rasters( DISPLAY_BORDER_HEIGHT + y - 1, 10 );
+
   while( x < 256 + DISPLAY_BORDER_ASPECT_WIDTH
 	 && ( c = *(libspectrum_byte *)s++ ) != 0 ) {
     if( col == WIDGET_COLOUR_DISABLED && c < 26 ) continue;
@@ -300,6 +322,8 @@ void widget_rectangle( int x, int y, int w, int h, int col )
 {
     int mx, my;
     
+    widget_damage_rasters( DISPLAY_BORDER_HEIGHT + y, h );
+
     for( my = 0; my < h; my++ )
       for( mx = 0; mx < w; mx++ )
         widget_putpixel( x + mx, y + my, col );
@@ -356,6 +380,8 @@ widget_draw_rectangle_solid( int x, int y, int w, int h, int colour )
   if( y + h > DISPLAY_SCREEN_HEIGHT - 1 )
     h = DISPLAY_SCREEN_HEIGHT - y;
 
+  widget_damage_rasters( y, h );
+
   for (v=0; v<h; v++) {
     for (p=0; p<w; p++) {
         uidisplay_putpixel( x+p, y+v, colour );
@@ -447,6 +473,35 @@ widget_display_rasters( int y, int h )
   uidisplay_frame_end();
 }
 
+/* Note that display rasters y to (y+h) have been drawn on */
+void
+widget_damage_rasters( int y, int h )
+{
+  if( h <= 0 ) return;
+
+  if( y < damage_top ) damage_top = y < 0 ? 0 : y;
+  if( y + h > damage_bottom )
+    damage_bottom = y + h > DISPLAY_SCREEN_HEIGHT ? DISPLAY_SCREEN_HEIGHT :
+                                                    y + h;
+}
+
+/* Redraw just the rasters drawn on since the last call, if any */
+void
+widget_damage_flush( void )
+{
+  int scale;
+
+  if( damage_bottom <= damage_top ) return;
+
+  scale = machine_current->timex ? 2 : 1;
+  uidisplay_area( 0, scale * damage_top, scale * DISPLAY_ASPECT_WIDTH,
+                  scale * ( damage_bottom - damage_top ) );
+  uidisplay_frame_end();
+
+  damage_top = DISPLAY_SCREEN_HEIGHT;
+  damage_bottom = 0;
+}
+
 /* Global initialisation/end routines */
 
 int widget_init( void )
@@ -456,6 +511,10 @@ int widget_init( void )
   error = widget_read_font( "fuse.font" );
   if( error ) return error;
 
+  widget_font_rows( &default_invalid );
+  widget_font_rows( &default_unknown );
+  widget_font_rows( &default_keyword );
+
   widget_filenames = NULL;
   widget_numfiles = 0;
 
@@ -483,6 +542,8 @@ int widget_end( void )
     free( widget_filenames );
   }
 
+  widget_filesel_cache_clear();
+
   /* we don't currently have more than page 0 */
   free( widget_font[0] );
 
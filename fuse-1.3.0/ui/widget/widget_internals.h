@@ -77,6 +77,8 @@ void widget_printchar_fixed( int x, int y, int col, int c );
 void widget_print_title( int y, int col, const char *s );
 void widget_printstring_right( int x, int y, int col, const char *s );
 void widget_display_rasters( int y, int h );
+void widget_damage_rasters( int y, int h );
+void widget_damage_flush( void );
 #define widget_display_lines(y,h) widget_display_rasters((y)*8,(h)*8)
 
 size_t widget_stringwidth( const char *s );
@@ -114,6 +116,7 @@ extern size_t widget_numfiles;
 int widget_filesel_load_draw( void* data );
 int widget_filesel_save_draw( void* data );
 int widget_filesel_finish( widget_finish_state finished );
+void widget_filesel_cache_clear( void );
 void widget_filesel_keyhandler( input_key key );
 
 /* Tape menu */
@@ -29,6 +29,7 @@
 #include <libspectrum.h>
 
 #include "fuse.h"
+#include "loader.h"
 #include "machine.h"
 #include "mempool.h"
 #include "periph.h"
@@ -42,6 +43,7 @@
 #include "peripherals/ide/zxcf.h"
 #include "peripherals/if1.h"
 #include "peripherals/if2.h"
+#include "peripherals/nic/w5100.h"
 #include "peripherals/speccyboot.h"
 #include "peripherals/ula.h"
 #include "peripherals/usource.h"
@@ -224,8 +226,6 @@ floating_bus_test( void )
   return error;
 }
 
-#define TEST_ASSERT(x) do { if( !(x) ) { printf("Test assertion failed at %s:%d: %s\n", __FILE__, __LINE__, #x ); return 1; } } while( 0 )
-
 static int
 floating_bus_merge_test( void )
 {
@@ -782,6 +782,10 @@ unittests_run( void )
   r += floating_bus_merge_test();
   r += mempool_test();
   r += paging_test();
+  r += loader_unittest();
+#ifdef BUILD_SPECTRANET
+  r += nic_w5100_unittest();
+#endif
 
   return r;
 }
@@ -26,6 +26,10 @@
 #ifndef FUSE_UNITTESTS_H
 #define FUSE_UNITTESTS_H
 
+#include <stdio.h>
+
+#define TEST_ASSERT(x) do { if( !(x) ) { printf("Test assertion failed at %s:%d: %s\n", __FILE__, __LINE__, #x ); return 1; } } while( 0 )
+
 int unittests_run( void );
 
 int unittests_assert_2k_page( libspectrum_word base, int source, int page );
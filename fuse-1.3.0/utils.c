@@ -62,6 +62,39 @@ static void init_path_context( path_context *ctx, utils_aux_type type );
 
 static int networking_init_count = 0;
 
+/* Reporting of progress while reading a file in */
+static utils_progress_fn open_progress = NULL;
+
+#define UTILS_STREAM_CHUNK 0x40000
+#define UTILS_STREAM_PAGE 0x1000
+
+static volatile unsigned char stream_touch;
+
+void
+utils_set_open_progress( utils_progress_fn progress )
+{
+  open_progress = progress;
+}
+
+/* Read the pages of a mapped file in a chunk at a time before the whole
+   file is parsed, so progress can be shown */
+static void
+stream_file( utils_file *file )
+{
+  size_t done, end, i;
+
+  if( !open_progress ) return;
+
+  for( done = 0; done < file->length; done = end ) {
+    end = done + UTILS_STREAM_CHUNK;
+    if( end > file->length ) end = file->length;
+    if( file->mapped )
+      for( i = done; i < end; i += UTILS_STREAM_PAGE )
+	stream_touch = file->buffer[i];
+    open_progress( end, file->length );
+  }
+}
+
 /* Open `filename' and do something sensible with it; autoload tapes
    if `autoload' is true and return the type of file found in `type' */
 int
@@ -78,22 +111,29 @@ utils_open_file( const char *filename, int autoload,
   if( rzx_playback  ) error = rzx_stop_playback( 1 );
   if( error ) return error;
 
-  /* Read the file into a buffer */
-  if( utils_read_file( filename, &file ) ) return 1;
+  /* Map the file; only the pages identification and the parser use are
+     actually read. Media which are opened again by name (disks, hard
+     disks, cartridges...) are never read in here */
+  if( utils_map_file( filename, &file ) ) return 1;
 
   /* See if we can work out what it is */
   if( libspectrum_identify_file_with_class( &type, &class, filename,
 					    file.buffer, file.length ) ) {
-    utils_close_file( &file );
+    utils_unmap_file( &file );
     return 1;
   }
 
+  if( class == LIBSPECTRUM_CLASS_RECORDING ||
+      class == LIBSPECTRUM_CLASS_SNAPSHOT ||
+      class == LIBSPECTRUM_CLASS_TAPE )
+    stream_file( &file );
+
   switch( class ) {
     
   case LIBSPECTRUM_CLASS_UNKNOWN:
     ui_error( UI_ERROR_ERROR, "utils_open_file: couldn't identify `%s'",
 	      filename );
-    utils_close_file( &file );
+    utils_unmap_file( &file );
     return 1;
 
   case LIBSPECTRUM_CLASS_RECORDING:
@@ -210,7 +250,7 @@ utils_open_file( const char *filename, int autoload,
     } else {
       error = divide_insert( filename, LIBSPECTRUM_IDE_MASTER );
     }
-    if( error ) return error;
+    if( error ) { utils_unmap_file( &file ); return error; }
     
     break;
 
@@ -226,9 +266,9 @@ utils_open_file( const char *filename, int autoload,
     break;
   }
 
-  if( error ) { utils_close_file( &file ); return error; }
+  if( error ) { utils_unmap_file( &file ); return error; }
 
-  utils_close_file( &file );
+  utils_unmap_file( &file );
 
   if( type_ptr ) *type_ptr = type;
 
@@ -369,6 +409,48 @@ utils_close_file( utils_file *file )
   libspectrum_free( file->buffer );
 }
 
+/* Map a file into memory read only, so its pages are only read in when
+   used. Falls back to reading the whole file where mapping isn't
+   possible */
+int
+utils_map_file( const char *filename, utils_file *file )
+{
+  compat_fd fd;
+
+  fd = compat_file_open( filename, 0 );
+  if( fd == COMPAT_FILE_OPEN_FAILED ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s': %s", filename,
+	      strerror( errno ) );
+    return 1;
+  }
+
+  file->length = compat_file_get_length( fd );
+  if( file->length == -1 ) {
+    compat_file_close( fd );
+    return 1;
+  }
+
+  if( compat_file_map( fd, file ) ) {
+    compat_file_close( fd );
+    return 1;
+  }
+
+  if( compat_file_close( fd ) ) {
+    ui_error( UI_ERROR_ERROR, "Couldn't close '%s': %s", filename,
+	      strerror( errno ) );
+    utils_unmap_file( file );
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+utils_unmap_file( utils_file *file )
+{
+  compat_file_unmap( file );
+}
+
 int utils_write_file( const char *filename, const unsigned char *buffer,
 		      size_t length )
 {
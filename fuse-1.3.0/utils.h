@@ -34,11 +34,17 @@ typedef struct utils_file {
 
   unsigned char *buffer;
   size_t length;
+  int mapped;		/* buffer is a memory mapping of the file */
 
 } utils_file;
 
+/* Called while utils_open_file() reads a file in: `done' of `total'
+   bytes so far */
+typedef void (*utils_progress_fn)( size_t done, size_t total );
+
 int utils_open_file( const char *filename, int autoload,
 		     libspectrum_id_t *type );
+void utils_set_open_progress( utils_progress_fn progress );
 int utils_open_snap( void );
 int utils_read_auxiliary_file( const char *filename, utils_file *file,
                                utils_aux_type type );
@@ -46,6 +52,8 @@ int utils_read_auxiliary_file( const char *filename, utils_file *file,
 int utils_read_file( const char *filename, utils_file *file );
 int utils_read_fd( compat_fd fd, const char *filename, utils_file *file );
 void utils_close_file( utils_file *file );
+int utils_map_file( const char *filename, utils_file *file );
+void utils_unmap_file( utils_file *file );
 
 int utils_write_file( const char *filename, const unsigned char *buffer,
 		      size_t length );
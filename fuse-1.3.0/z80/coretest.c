@@ -44,7 +44,9 @@
 #include "profile.h"
 #include "rzx.h"
 #include "slt.h"
+#include "statesave.h"
 #include "tape.h"
+#include "trace.h"
 
 #include "event.h"
 #include "infrastructure/startup_manager.h"
@@ -397,6 +399,15 @@ tape_save_trap( void )
   abort();
 }
 
+int loader_flash_active = 0;
+
+void
+loader_flash_check( void )
+{
+  /* Should never be called */
+  abort();
+}
+
 scld scld_last_dec;
 
 size_t rzx_instruction_count;
@@ -419,6 +430,12 @@ profile_map( libspectrum_word pc GCC_UNUSED )
   abort();
 }
 
+void
+profile_interrupt( libspectrum_dword start GCC_UNUSED )
+{
+  abort();
+}
+
 int
 debugger_check( debugger_breakpoint_type type GCC_UNUSED, libspectrum_dword value GCC_UNUSED )
 {
@@ -583,6 +600,16 @@ startup_manager_register( startup_manager_module module,
 {
 }
 
+int fuse_emulation_hidden = 0;
+
+int trace_active = 0;
+
+void
+trace_instruction( void )
+{
+  abort();
+}
+
 int svg_capture_active = 0;     /* SVG capture enabled? */
 
 void
@@ -621,6 +648,11 @@ z80_debugger_variables_init( void )
 {
 }
 
+void
+statesave_register( void *data GCC_UNUSED, size_t length GCC_UNUSED )
+{
+}
+
 fuse_machine_info *machine_current;
 static fuse_machine_info dummy_machine;
 
@@ -36,9 +36,11 @@
 #include "module.h"
 #include "peripherals/scld.h"
 #include "peripherals/spectranet.h"
+#include "profile.h"
 #include "rzx.h"
 #include "settings.h"
 #include "spectrum.h"
+#include "statesave.h"
 #include "ui/ui.h"
 #include "z80.h"
 #include "z80_internals.h"
@@ -114,6 +116,8 @@ z80_init( void *context )
 
   module_register( &z80_module_info );
 
+  statesave_register( &z80, sizeof( z80 ) );
+
   z80_debugger_variables_init();
 
   return 0;
@@ -154,6 +158,7 @@ static void z80_init_tables(void)
 void
 z80_reset( int hard_reset )
 {
+  z80.flags_lazy = 0;
   AF =AF_=0xffff;
   I=R=R7=0;
   PC=0;
@@ -171,10 +176,70 @@ z80_reset( int hard_reset )
   z80.interrupts_enabled_at = -1;
 }
 
+/* Compute F from the last lazily evaluated ALU operation, if any. This
+   is normally called via the F and AF macros, so anything reading or
+   writing the flags through those sees the correct value */
+void
+z80_flags_evaluate( void )
+{
+  libspectrum_dword lazy = z80.flags_lazy;
+  libspectrum_byte result = lazy & 0xff;
+  libspectrum_byte carry = ( lazy >> 8 ) & FLAG_C;
+  libspectrum_byte operand = ( lazy >> 9 ) & 0xff;
+  libspectrum_byte lookup =
+    ( ( lazy >> 20 ) & 0x11 ) | ( ( lazy >> 11 ) & 0x22 ) |
+    ( ( lazy >> 1 ) & 0x44 );
+
+  switch( lazy >> 28 ) {
+
+  case Z80_FLAGS_NONE:
+    return;
+
+  case Z80_FLAGS_ADD:
+    z80.af.b.l = carry | halfcarry_add_table[lookup & 0x07] |
+      overflow_add_table[lookup >> 4] | sz53_table[result];
+    break;
+
+  case Z80_FLAGS_SUB:
+    z80.af.b.l = carry | FLAG_N | halfcarry_sub_table[lookup & 0x07] |
+      overflow_sub_table[lookup >> 4] | sz53_table[result];
+    break;
+
+  case Z80_FLAGS_CP:
+    z80.af.b.l = ( carry ? FLAG_C : ( result ? 0 : FLAG_Z ) ) | FLAG_N |
+      halfcarry_sub_table[lookup & 0x07] | overflow_sub_table[lookup >> 4] |
+      ( operand & ( FLAG_3 | FLAG_5 ) ) | ( result & FLAG_S );
+    break;
+
+  case Z80_FLAGS_INC:
+    z80.af.b.l = carry | ( result == 0x80 ? FLAG_V : 0 ) |
+      ( result & 0x0f ? 0 : FLAG_H ) | sz53_table[result];
+    break;
+
+  case Z80_FLAGS_DEC:
+    z80.af.b.l = carry | ( ( result & 0x0f ) == 0x0f ? FLAG_H : 0 ) |
+      FLAG_N | ( result == 0x7f ? FLAG_V : 0 ) | sz53_table[result];
+    break;
+
+  case Z80_FLAGS_AND:
+    z80.af.b.l = FLAG_H | sz53p_table[result];
+    break;
+
+  case Z80_FLAGS_OR:
+    z80.af.b.l = sz53p_table[result];
+    break;
+
+  }
+
+  z80.flags_lazy = 0;
+}
+
 /* Process a z80 maskable interrupt */
 int
 z80_interrupt( void )
 {
+  libspectrum_dword start = tstates;
+
   /* An interrupt will occur if IFF1 is set and the /INT line hasn't
      gone high again. On a Timex machine, we also need the SCLD's
      INTDISABLE to be clear */
@@ -234,6 +299,8 @@ z80_interrupt( void )
 	fuse_abort();
     }
 
+    if( profile_active ) profile_interrupt( start );
+
     return 1;			/* Accepted an interrupt */
 
   } else {
@@ -247,6 +314,8 @@ z80_interrupt( void )
 static void
 z80_nmi( libspectrum_dword ts, int type, void *user_data )
 {
+  libspectrum_dword start = tstates;
+
   /* TODO: this isn't ideal */
   if( spectranet_available && spectranet_nmi_flipflop() )
     return;
@@ -276,6 +345,8 @@ z80_nmi( libspectrum_dword ts, int type, void *user_data )
   }
 
   PC = 0x0066;
+
+  if( profile_active ) profile_interrupt( start );
 }
 
 /* Special peripheral processing for RETN */
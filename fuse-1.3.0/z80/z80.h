@@ -54,8 +54,28 @@ typedef struct {
      until tstates > this value */
   libspectrum_signed_dword interrupts_enabled_at;
 
+  /* If non-zero, the 8-bit ALU operation which last set the flags; F is
+     computed from this only when it is actually read. Bits 0-7 hold the
+     result, bit 8 the carry out, bits 9-16 and 17-24 the second and first
+     operands and bits 28-31 the operation. See z80_flags_evaluate() */
+  libspectrum_dword flags_lazy;
+
 } processor;
 
+/* The kinds of ALU operation whose flags are evaluated lazily. INC and
+   DEC store the previous carry as their carry out, and AND and OR store
+   zero */
+enum z80_flags_op {
+  Z80_FLAGS_NONE = 0,
+  Z80_FLAGS_ADD,		/* ADD, ADC */
+  Z80_FLAGS_SUB,		/* SUB, SBC */
+  Z80_FLAGS_CP,
+  Z80_FLAGS_INC,
+  Z80_FLAGS_DEC,
+  Z80_FLAGS_AND,
+  Z80_FLAGS_OR			/* OR, XOR */
+};
+
 void z80_register_startup( void );
 int z80_init( void *context );
 void z80_reset( int hard_reset );
@@ -67,6 +87,8 @@ void z80_do_opcodes(void);
 
 void z80_enable_interrupts( void );
 
+void z80_flags_evaluate( void );
+
 extern processor z80;
 extern const libspectrum_byte halfcarry_add_table[];
 extern const libspectrum_byte halfcarry_sub_table[];
@@ -29,10 +29,10 @@ use Fuse;
 
 # The status of which flags relates to which condition
 
-# These conditions involve !( F & FLAG_<whatever> )
+# These conditions involve ! TEST_FLAG_<whatever>()
 my %not = map { $_ => 1 } qw( NC NZ P PO );
 
-# Use F & FLAG_<whatever>
+# Use TEST_FLAG_<whatever>()
 my %flag = (
 
       C => 'C', NC => 'C',
@@ -109,9 +109,9 @@ sub call_jp ($$$) {
     } else {
 	my $condition_string;
 	if( defined $not{$condition} ) {
-	    $condition_string = "! ( F & FLAG_$flag{$condition} )";
+	    $condition_string = "! TEST_FLAG_$flag{$condition}()";
 	} else {
-	    $condition_string = "F & FLAG_$flag{$condition}";
+	    $condition_string = "TEST_FLAG_$flag{$condition}()";
 	}
 	print << "CALL";
       if( $condition_string ) {
@@ -695,9 +695,9 @@ sub opcode_JR (@) {
     } else {
 	my $condition_string;
 	if( defined $not{$condition} ) {
-	    $condition_string = "! ( F & FLAG_$flag{$condition} )";
+	    $condition_string = "! TEST_FLAG_$flag{$condition}()";
 	} else {
-	    $condition_string = "F & FLAG_$flag{$condition}";
+	    $condition_string = "TEST_FLAG_$flag{$condition}()";
 	}
 	print << "JR";
       if( $condition_string ) {
@@ -942,9 +942,9 @@ RET
         }
 
 	if( defined $not{$condition} ) {
-	    print "      if( ! ( F & FLAG_$flag{$condition} ) ) { RET(); }\n";
+	    print "      if( ! TEST_FLAG_$flag{$condition}() ) { RET(); }\n";
 	} else {
-	    print "      if( F & FLAG_$flag{$condition} ) { RET(); }\n";
+	    print "      if( TEST_FLAG_$flag{$condition}() ) { RET(); }\n";
 	}
     }
 }
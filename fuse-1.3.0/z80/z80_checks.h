@@ -1,4 +1,5 @@
 SETUP_CHECK( profile, profile_active )
+SETUP_CHECK( loader_flash, loader_flash_active )
 SETUP_CHECK( rzx, rzx_playback )
 SETUP_CHECK( debugger, debugger_mode != DEBUGGER_MODE_INACTIVE )
 SETUP_CHECK( beta, beta_available )
@@ -9,6 +10,7 @@ SETUP_CHECK( usource, usource_available )
 SETUP_CHECK( if1p, if1_available )
 SETUP_CHECK( divide_early, settings_current.divide_enabled )
 SETUP_CHECK( spectranet_page, spectranet_available && !settings_current.spectranet_disable )
+SETUP_CHECK( trace, trace_active && !fuse_emulation_hidden )
 SETUP_NEXT( opcode_delay )
 SETUP_CHECK( evenm1, even_m1 )
 SETUP_NEXT( run_opcode )
@@ -28,4 +28,10 @@
 
 void z80_debugger_variables_init( void );
 
+/* The most tstates any single instruction can take when it isn't
+   contended, with some allowance for an even M1 cycle */
+#define Z80_MAX_INSTRUCTION_TSTATES 32
+
+void z80_do_opcodes_uncontended( libspectrum_dword limit );
+
 #endif			/* #ifndef FUSE_Z80_INTERNALS */
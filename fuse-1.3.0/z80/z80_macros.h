@@ -29,8 +29,13 @@
 
 /* Macros used for accessing the registers */
 #define A   z80.af.b.h
-#define F   z80.af.b.l
-#define AF  z80.af.w
+
+/* Any access to F or AF first brings the lazily evaluated flags up to
+   date; see z80_flags_evaluate() */
+#define F   (*( z80.flags_lazy ? ( z80_flags_evaluate(), &z80.af.b.l ) : \
+		&z80.af.b.l ))
+#define AF  (*( z80.flags_lazy ? ( z80_flags_evaluate(), &z80.af.w ) : \
+		&z80.af.w ))
 
 #define B   z80.bc.b.h
 #define C   z80.bc.b.l
@@ -129,23 +134,40 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 
 #endif				/* #ifndef CORETEST */
 
+/* Individual flags which can be tested without evaluating all of F */
+#define FLAGS_CARRY() \
+  ( z80.flags_lazy ? ( ( z80.flags_lazy >> 8 ) & FLAG_C ) : \
+		     ( z80.af.b.l & FLAG_C ) )
+
+#define TEST_FLAG_C() FLAGS_CARRY()
+
+#define TEST_FLAG_Z() \
+  ( z80.flags_lazy ? !( z80.flags_lazy & 0xff ) : ( z80.af.b.l & FLAG_Z ) )
+
+#define TEST_FLAG_S() \
+  ( z80.flags_lazy ? ( z80.flags_lazy & FLAG_S ) : ( z80.af.b.l & FLAG_S ) )
+
+#define TEST_FLAG_P() ( F & FLAG_P )
+
+/* Record an 8-bit ALU operation for later flag evaluation; 'result'
+   includes the carry out in bit 8 */
+#define LAZY_FLAGS(op,op1,op2,result)\
+  z80.flags_lazy = ( (libspectrum_dword)(op) << 28 ) |\
+    ( (libspectrum_dword)(op1) << 17 ) | ( (libspectrum_dword)(op2) << 9 ) |\
+    ( (result) & 0x1ff )
+
 /* Some commonly used instructions */
 #define AND(value)\
 {\
   A &= (value);\
-  F = FLAG_H | sz53p_table[A];\
+  LAZY_FLAGS( Z80_FLAGS_AND, 0, 0, A );\
 }
 
 #define ADC(value)\
 {\
-  libspectrum_word adctemp = A + (value) + ( F & FLAG_C ); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( ( adctemp & 0x88 ) >> 1 );  \
+  libspectrum_word adctemp = A + (value) + FLAGS_CARRY(); \
+  LAZY_FLAGS( Z80_FLAGS_ADD, A, (value), adctemp );\
   A=adctemp;\
-  F = ( adctemp & 0x100 ? FLAG_C : 0 ) |\
-    halfcarry_add_table[lookup & 0x07] | overflow_add_table[lookup >> 4] |\
-    sz53_table[A];\
 }
 
 #define ADC16(value)\
@@ -165,13 +187,8 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 #define ADD(value)\
 {\
   libspectrum_word addtemp = A + (value); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( ( addtemp & 0x88 ) >> 1 );  \
+  LAZY_FLAGS( Z80_FLAGS_ADD, A, (value), addtemp );\
   A=addtemp;\
-  F = ( addtemp & 0x100 ? FLAG_C : 0 ) |\
-    halfcarry_add_table[lookup & 0x07] | overflow_add_table[lookup >> 4] |\
-    sz53_table[A];\
 }
 
 #define ADD16(value1,value2)\
@@ -215,15 +232,8 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 
 #define CP(value)\
 {\
-  libspectrum_word cptemp = A - value; \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( (  cptemp & 0x88 ) >> 1 );  \
-  F = ( cptemp & 0x100 ? FLAG_C : ( cptemp ? 0 : FLAG_Z ) ) | FLAG_N |\
-    halfcarry_sub_table[lookup & 0x07] |\
-    overflow_sub_table[lookup >> 4] |\
-    ( value & ( FLAG_3 | FLAG_5 ) ) |\
-    ( cptemp & FLAG_S );\
+  libspectrum_word cptemp = A - (value); \
+  LAZY_FLAGS( Z80_FLAGS_CP, A, (value), cptemp );\
 }
 
 /* Macro for the {DD,FD} CB dd xx rotate/shift instructions */
@@ -238,9 +248,9 @@ break
 
 #define DEC(value)\
 {\
-  F = ( F & FLAG_C ) | ( (value)&0x0f ? 0 : FLAG_H ) | FLAG_N;\
+  libspectrum_word dectemp = FLAGS_CARRY() << 8;\
   (value)--;\
-  F |= ( (value)==0x7f ? FLAG_V : 0 ) | sz53_table[value];\
+  LAZY_FLAGS( Z80_FLAGS_DEC, 0, 0, dectemp | (value) );\
 }
 
 #define Z80_IN( reg, port )\
@@ -251,9 +261,9 @@ break
 
 #define INC(value)\
 {\
+  libspectrum_word inctemp = FLAGS_CARRY() << 8;\
   (value)++;\
-  F = ( F & FLAG_C ) | ( (value)==0x80 ? FLAG_V : 0 ) |\
-  ( (value)&0x0f ? 0 : FLAG_H ) | sz53_table[(value)];\
+  LAZY_FLAGS( Z80_FLAGS_INC, 0, 0, inctemp | (value) );\
 }
 
 #define LD16_NNRR(regl,regh)\
@@ -295,7 +305,7 @@ break
 #define OR(value)\
 {\
   A |= (value);\
-  F = sz53p_table[A];\
+  LAZY_FLAGS( Z80_FLAGS_OR, 0, 0, A );\
 }
 
 #define POP16(regl,regh)\
@@ -350,14 +360,9 @@ break
 
 #define SBC(value)\
 {\
-  libspectrum_word sbctemp = A - (value) - ( F & FLAG_C ); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( ( sbctemp & 0x88 ) >> 1 );  \
+  libspectrum_word sbctemp = A - (value) - FLAGS_CARRY(); \
+  LAZY_FLAGS( Z80_FLAGS_SUB, A, (value), sbctemp );\
   A=sbctemp;\
-  F = ( sbctemp & 0x100 ? FLAG_C : 0 ) | FLAG_N |\
-    halfcarry_sub_table[lookup & 0x07] | overflow_sub_table[lookup >> 4] |\
-    sz53_table[A];\
 }
 
 #define SBC16(value)\
@@ -405,19 +410,14 @@ break
 #define SUB(value)\
 {\
   libspectrum_word subtemp = A - (value); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    (  (subtemp & 0x88 ) >> 1 );  \
+  LAZY_FLAGS( Z80_FLAGS_SUB, A, (value), subtemp );\
   A=subtemp;\
-  F = ( subtemp & 0x100 ? FLAG_C : 0 ) | FLAG_N |\
-    halfcarry_sub_table[lookup & 0x07] | overflow_sub_table[lookup >> 4] |\
-    sz53_table[A];\
 }
 
 #define XOR(value)\
 {\
   A ^= (value);\
-  F = sz53p_table[A];\
+  LAZY_FLAGS( Z80_FLAGS_OR, 0, 0, A );\
 }
 
 #endif		/* #ifndef FUSE_Z80_MACROS_H */
@@ -32,6 +32,8 @@
 
 #include "debugger/debugger.h"
 #include "event.h"
+#include "fuse.h"
+#include "loader.h"
 #include "machine.h"
 #include "memory.h"
 #include "periph.h"
@@ -51,10 +53,39 @@
 #include "slt.h"
 #include "svg.h"
 #include "tape.h"
+#include "trace.h"
 #include "z80.h"
+#include "z80_internals.h"
 
 #include "z80_macros.h"
 
+#ifdef Z80_OPS_UNCONTENDED
+
+/* This copy of the core is built from z80_ops_uncontended.c and is only
+   run when no memory access can be contended (see z80_do_opcodes()), so
+   every access just takes its base time */
+
+#undef contend_read
+#undef contend_read_no_mreq
+#undef contend_write_no_mreq
+
+#define contend_read( address, time ) tstates += (time);
+#define contend_read_no_mreq( address, time ) tstates += (time);
+#define contend_write_no_mreq( address, time ) tstates += (time);
+
+#define readbyte readbyte_uncontended
+#define writebyte writebyte_uncontended
+
+#define Z80_CORE z80_do_opcodes_uncontended
+
+#else				/* #ifdef Z80_OPS_UNCONTENDED */
+
+#define Z80_CORE z80_do_opcodes_contended
+
+static void Z80_CORE( libspectrum_dword limit );
+
+#endif				/* #ifdef Z80_OPS_UNCONTENDED */
+
 #ifndef HAVE_ENOUGH_MEMORY
 static int z80_cbxx( libspectrum_byte opcode2 );
 static int z80_ddxx( libspectrum_byte opcode2 );
@@ -109,10 +140,39 @@ enum {
 static libspectrum_byte opcode = 0x00;
 #endif
 
-/* Execute Z80 opcodes until the next event */
+#ifndef Z80_OPS_UNCONTENDED
+
+/* Execute Z80 opcodes until the next event. Outside the part of the
+   frame where the ULA contends memory, the core without contention
+   checks is used; an instruction is started there only if it will have
+   finished before the contended part begins */
 void
 z80_do_opcodes( void )
 {
+#ifndef CORETEST
+  while( tstates < event_next_event ) {
+    if( debugger_mode != DEBUGGER_MODE_INACTIVE ) {
+      z80_do_opcodes_contended( event_next_event );
+    } else if( tstates >= ula_contention_end ) {
+      z80_do_opcodes_uncontended( event_next_event );
+    } else if( tstates + Z80_MAX_INSTRUCTION_TSTATES < ula_contention_start ) {
+      z80_do_opcodes_uncontended( ula_contention_start -
+				  Z80_MAX_INSTRUCTION_TSTATES );
+    } else {
+      z80_do_opcodes_contended( ula_contention_end );
+    }
+  }
+#else				/* #ifndef CORETEST */
+  z80_do_opcodes_contended( event_next_event );
+#endif				/* #ifndef CORETEST */
+}
+
+static void
+#else				/* #ifndef Z80_OPS_UNCONTENDED */
+void
+#endif				/* #ifndef Z80_OPS_UNCONTENDED */
+Z80_CORE( libspectrum_dword limit )
+{
 #ifdef HAVE_ENOUGH_MEMORY
   libspectrum_byte opcode = 0x00;
 #endif
@@ -138,7 +198,7 @@ z80_do_opcodes( void )
 
 #endif				/* #ifdef __GNUC__ */
 
-  while( tstates < event_next_event ) {
+  while( tstates < event_next_event && tstates < limit ) {
 
     /* Profiler */
     CHECK( profile, profile_active )
@@ -147,6 +207,13 @@ z80_do_opcodes( void )
 
     END_CHECK
 
+    /* Flash loading of turbo loaders */
+    CHECK( loader_flash, loader_flash_active )
+
+    loader_flash_check();
+
+    END_CHECK
+
     /* If we're due an end of frame from RZX playback, generate one */
     CHECK( rzx, rzx_playback )
 
@@ -244,6 +311,12 @@ z80_do_opcodes( void )
 
     END_CHECK
 
+    CHECK( trace, trace_active && !fuse_emulation_hidden )
+
+    trace_instruction();
+
+    END_CHECK
+
   opcode_delay:
 
     contend_read( PC, 4 );